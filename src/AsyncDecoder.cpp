@@ -0,0 +1,197 @@
+#include <iostream>
+
+#include <avro/Decoder.hh>
+
+#include "HelperFunctions.h"
+#include "AsyncDecoder.h"
+#include "ThreadPool.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+AsyncDecoder::AsyncDecoder(std::shared_ptr<AvroForeign> avro_foreign, std::shared_ptr<RowFilter> filter, int64_t decode_offset, bool continue_on_error, K callback, K error_callback) :
+  avro_foreign_(avro_foreign), filter_(filter), decode_offset_(decode_offset), continue_on_error_(continue_on_error),
+  callback_(r1(callback)), error_callback_(error_callback ? r1(error_callback) : NULL), next_id_(0)
+{
+  try {
+    notifier_.reset(new MainThreadNotifier([this] { DeliverCompleted(); }));
+  } catch (...) {
+    r0(callback_);
+    if (error_callback_)
+      r0(error_callback_);
+    throw;
+  }
+}
+
+AsyncDecoder::~AsyncDecoder()
+{
+  for (auto& i : in_flight_) {
+    i.second.future.wait();
+    r0(i.second.job->data);
+  }
+  in_flight_.clear();
+
+  // A delivered job is no longer in flight but its task may still be in
+  // Complete, which notifies while holding the mutex
+  {
+    std::lock_guard<std::mutex> lock(completed_mutex_);
+    notifier_.reset();
+  }
+
+  r0(callback_);
+  if (error_callback_)
+    r0(error_callback_);
+}
+
+void AsyncDecoder::Complete(std::shared_ptr<AsyncDecodeJob> job)
+{
+  // The job can be delivered, and the decoder destroyed, as soon as the mutex
+  // is released so this must be the last access to the decoder
+  std::lock_guard<std::mutex> lock(completed_mutex_);
+  completed_.push_back(job);
+  notifier_->Notify();
+}
+
+int64_t AsyncDecoder::Submit(K data)
+{
+  const auto id = next_id_++;
+  const auto filter = data->t == 0 ? filter_.get() : nullptr;
+  auto job = std::make_shared<AsyncDecodeJob>(id, r1(data), *avro_foreign_, decode_offset_, filter, continue_on_error_);
+
+  // Each job has its own decoder since they don't support concurrent use.
+  // The decoder waits for undelivered jobs in its destructor, and for
+  // delivered ones to leave Complete, so this is valid for the lifetime of the
+  // task.
+  auto avro_foreign = avro_foreign_;
+  const auto new_decoder = [avro_foreign] { return GetDecoder(*avro_foreign.get(), "BINARY", true); };
+  try {
+    auto future = ThreadPool::Shared().Submit([this, job, new_decoder] {
+      try {
+        DecodeBatchChunks(job->batch, new_decoder(), new_decoder);
+      } catch (const std::exception& e) {
+        job->batch.items.front().state = BatchItem::FAILED;
+        job->batch.items.front().error = e.what();
+      }
+      Complete(job);
+    });
+    in_flight_[id] = { job, std::move(future) };
+  } catch (...) {
+    r0(data);
+    throw;
+  }
+
+  return id;
+}
+
+void AsyncDecoder::Deliver(std::shared_ptr<AsyncDecodeJob> job)
+{
+  const auto id = job->id;
+  K result = NULL;
+  std::string error;
+  try {
+    result = BatchToKdb(job->batch, avro_foreign_->schema->root());
+  } catch (const std::exception& e) {
+    error = e.what();
+  }
+  r0(job->data);
+  in_flight_.erase(id);
+
+  if (result)
+    CallCallback("async decode", callback_, kj(id), result);
+  else if (error_callback_)
+    CallCallback("async decode", error_callback_, kj(id), kp((S)error.c_str()));
+  else
+    std::cerr << "avrokdb async decode " << id << ": " << error << std::endl;
+}
+
+size_t AsyncDecoder::DeliverCompleted()
+{
+  // A callback may release the last reference to the decoder's foreign so keep
+  // it alive until every completed job has been delivered
+  auto self = shared_from_this();
+
+  std::deque<std::shared_ptr<AsyncDecodeJob>> completed;
+  {
+    std::lock_guard<std::mutex> lock(completed_mutex_);
+    completed.swap(completed_);
+  }
+  for (auto& job : completed)
+    Deliver(job);
+
+  return completed.size();
+}
+
+size_t AsyncDecoder::Flush()
+{
+  for (auto& i : in_flight_)
+    i.second.future.wait();
+
+  return DeliverCompleted();
+}
+
+K AsyncDecoderCreate(K schema, K callback, K options)
+{
+  if (!IsCallback(callback))
+    return krr((S)"callback not -11|100-112h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+
+  int64_t decode_offset = 0;
+  options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
+
+  int64_t continue_on_error = 0;
+  options_parser.GetIntOption(Options::CONTINUE_ON_ERROR, continue_on_error);
+
+  K error_callback = NULL;
+  options_parser.GetObjectOption(Options::ERROR_CALLBACK, error_callback);
+  if (error_callback && !IsCallback(error_callback))
+    return krr((S)"ERROR_CALLBACK not -11|100-112h");
+
+  const auto filter = GetRowFilter(avro_foreign->schema->root(), options_parser);
+
+  return MakeForeign(std::make_shared<AsyncDecoder>(avro_foreign, filter, decode_offset, continue_on_error, callback, error_callback));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncDecode(K async_decoder, K data)
+{
+  if (data->t != 0 && data->t != KG && data->t != KC)
+    return krr((S)"data not 0|4|10h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto decoder = GetForeign<AsyncDecoder>(async_decoder);
+
+  return kj(decoder->Submit(data));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncFlush(K async_decoder)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto decoder = GetForeign<AsyncDecoder>(async_decoder);
+
+  return kj(decoder->Flush());
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncPending(K async_decoder)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto decoder = GetForeign<AsyncDecoder>(async_decoder);
+
+  return kj(decoder->Pending());
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "Schema.h"
+#include "Decode.h"
+#include "Notifier.h"
+#include "RowFilter.h"
+
+
+// A message, or list of messages, submitted to an asynchronous decoder
+struct AsyncDecodeJob
+{
+  int64_t id;
+  // Reference to the submitted data, held until the result is delivered
+  K data;
+  BatchDecode batch;
+
+  AsyncDecodeJob(int64_t id_, K data_, const AvroForeign& avro_foreign, int64_t decode_offset, const RowFilter* filter, bool continue_on_error) :
+    id(id_), data(data_), batch(*avro_foreign.schema, data_, decode_offset, filter, continue_on_error, avro_foreign.memory)
+  {}
+};
+
+// The structure that is stored in the async decoder foreign.
+//
+// Submitted data is decoded on avrokdb's thread pool, without creating any
+// kdb+ objects.  Completed jobs are queued and the main q thread is woken by
+// the notifier, which converts each job to kdb+ and passes it to the callback
+// in the order the jobs completed.
+class AsyncDecoder : public std::enable_shared_from_this<AsyncDecoder>
+{
+private:
+  struct InFlight
+  {
+    std::shared_ptr<AsyncDecodeJob> job;
+    std::future<void> future;
+  };
+
+  std::shared_ptr<AvroForeign> avro_foreign_;
+  std::shared_ptr<RowFilter> filter_;
+  int64_t decode_offset_;
+  bool continue_on_error_;
+  K callback_;
+  K error_callback_;
+
+  // Only accessed on the main thread
+  int64_t next_id_;
+  std::map<int64_t, InFlight> in_flight_;
+
+  // Jobs which have been decoded by the pool but not yet delivered
+  std::mutex completed_mutex_;
+  std::deque<std::shared_ptr<AsyncDecodeJob>> completed_;
+
+  std::unique_ptr<MainThreadNotifier> notifier_;
+
+  // Called on a pool thread once a job has been decoded
+  void Complete(std::shared_ptr<AsyncDecodeJob> job);
+
+  void Deliver(std::shared_ptr<AsyncDecodeJob> job);
+
+public:
+  // The callbacks are referenced by the decoder.  error_callback may be NULL.
+  AsyncDecoder(std::shared_ptr<AvroForeign> avro_foreign, std::shared_ptr<RowFilter> filter, int64_t decode_offset, bool continue_on_error, K callback, K error_callback);
+
+  // Waits for any jobs still being decoded, which are discarded
+  ~AsyncDecoder();
+
+  AsyncDecoder(const AsyncDecoder&) = delete;
+  AsyncDecoder& operator=(const AsyncDecoder&) = delete;
+
+  // Queue data for decoding, returning the job id passed to the callback
+  int64_t Submit(K data);
+
+  // Convert and deliver every job which has been decoded, returning the number
+  // delivered
+  size_t DeliverCompleted();
+
+  // Wait for every job to be decoded then deliver them all
+  size_t Flush();
+
+  size_t Pending() const
+  {
+    return in_flight_.size();
+  }
+};
+
+extern "C"
+{
+  /// @brief Create a decoder which decodes Avro binary data in the background
+  ///
+  /// Data submitted with AsyncDecode is decoded on avrokdb's thread pool so
+  /// the main q thread is free to process other messages.  When a submission
+  /// has been decoded the main thread is woken through its event loop (using
+  /// sd1) and the callback is called with (id; result), where result is as
+  /// returned by Decode for a single message or DecodeBatch for a list of
+  /// messages.  Results are delivered in the order their decoding completes.
+  ///
+  /// Supported options:
+  ///
+  /// * DECODE_OFFSET (long).  Offset into each message that decoding should
+  /// begin from.  Default 0.
+  ///
+  /// * CONTINUE_ON_ERROR (long).  If non-zero bad messages in a list are
+  /// skipped and reported as for DecodeBatch.  Default 0.
+  ///
+  /// * FILTER (predicate).  Selects the messages of a list to decode, as for
+  /// DecodeBatch.
+  ///
+  /// * ERROR_CALLBACK (function).  Called with (id; error string) for a
+  /// submission which could not be decoded.  By default the error is written
+  /// to stderr.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema to use for
+  /// decoding.
+  ///
+  /// @param callback.  Function, or symbol naming a function, called with the
+  /// results.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return foreign containing the async decoder.  Any submissions which have
+  /// not been delivered are discarded when it is garbage collected.
+  EXP K AsyncDecoderCreate(K schema, K callback, K options);
+
+  /// @brief Submit data to an async decoder
+  ///
+  /// The data is referenced by the decoder until its result is delivered.
+  ///
+  /// @param async_decoder.  Foreign object containing the async decoder.
+  ///
+  /// @param data.  4h or 10h list containing a single message, or mixed list
+  /// of messages.
+  ///
+  /// @return Long id of the submission, passed to the callback.
+  EXP K AsyncDecode(K async_decoder, K data);
+
+  /// @brief Wait for every submission to an async decoder to be decoded and
+  /// deliver the results to the callback before returning
+  ///
+  /// @param async_decoder.  Foreign object containing the async decoder.
+  ///
+  /// @return Long number of results delivered.
+  EXP K AsyncFlush(K async_decoder);
+
+  /// @brief Return the number of submissions to an async decoder which have
+  /// not yet been delivered
+  ///
+  /// @param async_decoder.  Foreign object containing the async decoder.
+  ///
+  /// @return Long count of pending submissions.
+  EXP K AsyncPending(K async_decoder);
+}
@@ -0,0 +1,322 @@
+#include <iostream>
+
+#include <avro/Encoder.hh>
+
+#include "HelperFunctions.h"
+#include "AsyncWriter.h"
+#include "SplayedExport.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+AsyncWriter::AsyncWriter(std::shared_ptr<AvroForeign> avro_foreign, const std::string& filename, avro::Codec codec, size_t block_rows, int64_t flush_interval, K error_callback) :
+  avro_foreign_(avro_foreign), block_rows_(block_rows), flush_interval_(flush_interval), error_callback_(NULL),
+  next_id_(0), closed_(false), flush_requested_(false), closing_(false), writing_(false),
+  block_count_(0), block_bytes_(0), failed_(false), memory_(avro_foreign->memory, MEMORY_WRITER), rows_written_(0)
+{
+  // Blocks are only written when flushed so the sync interval is set to its
+  // maximum to stop the writer starting a new block itself
+  writer_.reset(new avro::DataFileWriterBase(filename.c_str(), *avro_foreign_->schema, 1 << 30, codec));
+  notifier_.reset(new MainThreadNotifier([this] { DeliverWritten(true); }));
+  if (error_callback)
+    error_callback_ = r1(error_callback);
+
+  thread_ = std::thread(&AsyncWriter::Run, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+  if (!closed_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    closed_ = true;
+  }
+  DeliverWritten(false);
+  notifier_.reset();
+
+  if (error_callback_)
+    r0(error_callback_);
+}
+
+void AsyncWriter::Run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (!queue_.empty()) {
+      auto batch = queue_.front();
+      queue_.pop_front();
+      writing_ = true;
+      lock.unlock();
+      Write(*batch);
+      lock.lock();
+      writing_ = false;
+      written_.push_back(batch);
+      notifier_->Notify();
+      continue;
+    }
+
+    // The final block is ended by closing the file
+    if (closing_)
+      break;
+
+    const auto timed_out = block_count_ && flush_interval_.count() && std::chrono::steady_clock::now() >= block_start_ + flush_interval_;
+    if (flush_requested_ || timed_out) {
+      lock.unlock();
+      EndBlock();
+      lock.lock();
+      flush_requested_ = false;
+      continue;
+    }
+
+    idle_.notify_all();
+    if (block_count_ && flush_interval_.count())
+      wake_.wait_until(lock, block_start_ + flush_interval_);
+    else
+      wake_.wait(lock);
+  }
+  lock.unlock();
+
+  try {
+    writer_->close();
+  } catch (const std::exception& e) {
+    Fail(nj, e.what());
+  }
+}
+
+void AsyncWriter::Write(const AsyncWriteBatch& batch)
+{
+  if (failed_)
+    return Fail(batch.id, "Writer has failed, rows discarded");
+
+  // All the rows are encoded before any are written so that a table which
+  // can't be encoded is rejected as a whole.  They are split at the points
+  // where the current block and then each later block will be full.
+  std::vector<std::pair<size_t, std::vector<uint8_t>>> slices;
+  size_t bytes = 0;
+  try {
+    const auto& schema = *avro_foreign_->schema;
+    auto space = block_rows_ - block_count_;
+    for (size_t row = 0; row < batch.rows; ) {
+      const auto count = std::min(batch.rows - row, space);
+      slices.emplace_back(count, EncodeRows(schema, batch.columns, row, row + count));
+      bytes += slices.back().second.size();
+      row += count;
+      space = block_rows_;
+    }
+    memory_.Add(bytes);
+  } catch (const std::exception& e) {
+    return Fail(batch.id, e.what());
+  }
+
+  // Each slice's bytes remain charged until the block holding it has ended
+  try {
+    for (const auto& slice : slices) {
+      if (!block_count_)
+        block_start_ = std::chrono::steady_clock::now();
+      writer_->encoder().encodeFixed(slice.second.data(), slice.second.size());
+      for (size_t i = 0; i < slice.first; ++i)
+        writer_->incr();
+      block_count_ += slice.first;
+      block_bytes_ += slice.second.size();
+      bytes -= slice.second.size();
+      rows_written_ += slice.first;
+      if (block_count_ == block_rows_)
+        EndBlock();
+    }
+  } catch (const std::exception& e) {
+    failed_ = true;
+    Fail(batch.id, e.what());
+  }
+  memory_.Remove(bytes);
+}
+
+void AsyncWriter::EndBlock()
+{
+  if (!block_count_ || failed_)
+    return;
+
+  block_count_ = 0;
+  memory_.Remove(block_bytes_);
+  block_bytes_ = 0;
+  try {
+    writer_->flush();
+  } catch (const std::exception& e) {
+    failed_ = true;
+    Fail(nj, e.what());
+  }
+}
+
+void AsyncWriter::Fail(int64_t id, const std::string& error)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    errors_.emplace_back(id, error);
+  }
+  notifier_->Notify();
+}
+
+void AsyncWriter::WaitIdle(std::unique_lock<std::mutex>& lock)
+{
+  idle_.wait(lock, [this] { return queue_.empty() && !writing_ && !flush_requested_; });
+}
+
+void AsyncWriter::DeliverWritten(bool call_callback)
+{
+  // A callback may release the last reference to the writer's foreign so keep
+  // it alive until every error has been delivered
+  std::shared_ptr<AsyncWriter> self;
+  if (call_callback)
+    self = shared_from_this();
+
+  std::deque<std::shared_ptr<AsyncWriteBatch>> written;
+  std::deque<std::pair<int64_t, std::string>> errors;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    written.swap(written_);
+    errors.swap(errors_);
+  }
+
+  for (auto& batch : written) {
+    r0(batch->table);
+    for (auto ref : batch->refs)
+      r0(ref);
+  }
+
+  for (const auto& error : errors) {
+    if (call_callback && error_callback_)
+      CallCallback("async writer", error_callback_, kj(error.first), kp((S)error.second.c_str()));
+    else
+      std::cerr << "avrokdb async writer " << error.first << ": " << error.second << std::endl;
+  }
+}
+
+int64_t AsyncWriter::Push(K table)
+{
+  if (closed_)
+    throw std::runtime_error("Writer is closed");
+
+  auto batch = std::make_shared<AsyncWriteBatch>();
+  batch->id = next_id_++;
+  try {
+    batch->columns = GetExportColumns(ResolveSymbolic(avro_foreign_->schema->root()), table, batch->refs);
+  } catch (...) {
+    for (auto ref : batch->refs)
+      r0(ref);
+    throw;
+  }
+  batch->table = r1(table);
+  batch->rows = batch->columns.empty() ? 0 : batch->columns.front().data->n;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(batch);
+  }
+  wake_.notify_one();
+
+  return batch->id;
+}
+
+int64_t AsyncWriter::Flush()
+{
+  if (!closed_) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    flush_requested_ = true;
+    wake_.notify_one();
+    WaitIdle(lock);
+  }
+  DeliverWritten(true);
+
+  return rows_written_;
+}
+
+int64_t AsyncWriter::Close()
+{
+  if (!closed_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    closed_ = true;
+  }
+  DeliverWritten(true);
+
+  return rows_written_;
+}
+
+K AsyncWriterCreate(K filename, K schema, K options)
+{
+  if (!IsKdbString(filename))
+    return krr(S("AsyncWriterCreate, filename expected -11|10h"));
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  int64_t block_rows = 10000;
+  options_parser.GetIntOption(Options::BLOCK_ROWS, block_rows);
+  if (block_rows <= 0)
+    return krr((S)"BLOCK_ROWS must be positive");
+
+  int64_t flush_interval = 1000;
+  options_parser.GetIntOption(Options::FLUSH_INTERVAL, flush_interval);
+  if (flush_interval < 0)
+    return krr((S)"FLUSH_INTERVAL must be non-negative");
+
+  std::string codec = "null";
+  options_parser.GetStringOption(Options::CODEC, codec);
+
+  K error_callback = NULL;
+  options_parser.GetObjectOption(Options::ERROR_CALLBACK, error_callback);
+  if (error_callback && !IsCallback(error_callback))
+    return krr((S)"ERROR_CALLBACK not -11|100-112h");
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  if (ResolveSymbolic(avro_foreign->schema->root())->type() != avro::AVRO_RECORD)
+    return krr((S)"AsyncWriterCreate requires a record schema");
+
+  return MakeForeign(std::make_shared<AsyncWriter>(avro_foreign, GetKdbFilename(filename), GetCodec(codec), block_rows, flush_interval, error_callback));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncWrite(K async_writer, K table)
+{
+  if (table->t != XT)
+    return krr((S)"table not 98h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto writer = GetForeign<AsyncWriter>(async_writer);
+
+  return kj(writer->Push(table));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncWriterFlush(K async_writer)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto writer = GetForeign<AsyncWriter>(async_writer);
+
+  return kj(writer->Flush());
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K AsyncWriterClose(K async_writer)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto writer = GetForeign<AsyncWriter>(async_writer);
+
+  return kj(writer->Close());
+
+  KDB_EXCEPTION_CATCH;
+}
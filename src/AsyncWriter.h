@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <avro/DataFile.hh>
+
+#include "Schema.h"
+#include "Encode.h"
+#include "Notifier.h"
+#include "MemoryStats.h"
+
+
+// A table queued for writing by an async writer
+struct AsyncWriteBatch
+{
+  int64_t id;
+  // Reference to the table, and to the domains of any enumerated columns,
+  // held until the rows have been written
+  K table;
+  std::vector<K> refs;
+  std::vector<ExportColumn> columns;
+  size_t rows;
+};
+
+// The structure that is stored in the async writer foreign.
+//
+// Tables pushed by q are queued and appended to the Object Container File by
+// a background thread, which encodes the rows and ends a block once it has
+// BLOCK_ROWS rows or its first row has waited FLUSH_INTERVAL milliseconds.
+//
+// The background thread never creates or releases kdb+ objects.  Once a
+// batch has been written it is handed back to the main q thread, woken by
+// the notifier, which releases the table and passes any errors to the
+// callback.
+//
+// The encoded rows of the block being built are charged to the schema's
+// memory account.  A table which would exceed the memory limit is rejected.
+class AsyncWriter : public std::enable_shared_from_this<AsyncWriter>
+{
+private:
+  std::shared_ptr<AvroForeign> avro_foreign_;
+  std::unique_ptr<avro::DataFileWriterBase> writer_;
+  size_t block_rows_;
+  std::chrono::milliseconds flush_interval_;
+  K error_callback_;
+
+  // Only accessed on the main thread
+  int64_t next_id_;
+  bool closed_;
+
+  // Shared with the background thread
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::deque<std::shared_ptr<AsyncWriteBatch>> queue_;
+  bool flush_requested_;
+  bool closing_;
+  bool writing_;
+  std::deque<std::shared_ptr<AsyncWriteBatch>> written_;
+  std::deque<std::pair<int64_t, std::string>> errors_;
+
+  // Only accessed on the background thread
+  size_t block_count_;
+  size_t block_bytes_;
+  std::chrono::steady_clock::time_point block_start_;
+  bool failed_;
+  MemoryCharge memory_;
+
+  std::atomic<int64_t> rows_written_;
+
+  std::unique_ptr<MainThreadNotifier> notifier_;
+  std::thread thread_;
+
+  void Run();
+
+  // Encode a batch's rows into the current block, ending blocks as they fill
+  void Write(const AsyncWriteBatch& batch);
+
+  void EndBlock();
+
+  // Queue an error for delivery on the main thread
+  void Fail(int64_t id, const std::string& error);
+
+  // Wait for the background thread to write everything queued so far
+  void WaitIdle(std::unique_lock<std::mutex>& lock);
+
+  // Release written batches and deliver errors.  If call_callback is false
+  // errors are written to stderr.
+  void DeliverWritten(bool call_callback);
+
+public:
+  // error_callback is referenced by the writer and may be NULL
+  AsyncWriter(std::shared_ptr<AvroForeign> avro_foreign, const std::string& filename, avro::Codec codec, size_t block_rows, int64_t flush_interval, K error_callback);
+
+  // Writes anything still queued and closes the file
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  // Queue a table for writing, returning the id passed to the error callback
+  int64_t Push(K table);
+
+  // Write everything queued and end the current block, returning the number
+  // of rows written to the file
+  int64_t Flush();
+
+  // Flush and close the file.  Further pushes are rejected.
+  int64_t Close();
+};
+
+extern "C"
+{
+  /// @brief Create a writer which appends tables to an Avro Object Container
+  /// File on a background thread
+  ///
+  /// AsyncWrite only queues the table so returns without waiting for it to be
+  /// encoded or written.  The background thread encodes the rows, compresses
+  /// and appends each block, ending a block when it is full or when its first
+  /// row has waited FLUSH_INTERVAL.
+  ///
+  /// Supported options:
+  ///
+  /// * BLOCK_ROWS (long).  Number of rows after which a block is ended.
+  /// Default 10000.
+  ///
+  /// * FLUSH_INTERVAL (long).  Milliseconds after which a block which is not
+  /// full is ended, so that rows reach the file promptly.  0 disables the
+  /// timer.  Default 1000.
+  ///
+  /// * CODEC (string).  Compression codec used for the blocks.  Valid options
+  /// "null" or "deflate", or "snappy" if avro-cpp was built with snappy
+  /// support.  Default "null".
+  ///
+  /// * ERROR_CALLBACK (function).  Called on the main q thread with (id; error
+  /// string) for a pushed table which could not be written.  By default the
+  /// error is written to stderr.
+  ///
+  /// @param filename.  String or symbol containing the filename to write.
+  ///
+  /// @param schema.  Foreign object containing the Avro record schema to use
+  /// for encoding.  Each field is encoded from the table column of the same
+  /// name.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return foreign containing the async writer.  The file is closed, after
+  /// writing any queued rows, when it is garbage collected.
+  EXP K AsyncWriterCreate(K filename, K schema, K options);
+
+  /// @brief Queue a table to be appended by an async writer
+  ///
+  /// The table is referenced by the writer until its rows have been written.
+  ///
+  /// @param async_writer.  Foreign object containing the async writer.
+  ///
+  /// @param table.  Table whose columns follow the record schema.
+  ///
+  /// @return Long id of the push, passed to the error callback.
+  EXP K AsyncWrite(K async_writer, K table);
+
+  /// @brief Wait for an async writer to write every queued table and end the
+  /// current block
+  ///
+  /// @param async_writer.  Foreign object containing the async writer.
+  ///
+  /// @return Long number of rows written to the file.
+  EXP K AsyncWriterFlush(K async_writer);
+
+  /// @brief Flush an async writer and close its file
+  ///
+  /// @param async_writer.  Foreign object containing the async writer.
+  ///
+  /// @return Long number of rows written to the file.
+  EXP K AsyncWriterClose(K async_writer);
+}
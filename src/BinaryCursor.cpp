@@ -0,0 +1,112 @@
+#include <avro/Schema.hh>
+#include <avro/Types.hh>
+#include <avro/GenericDatum.hh>
+
+#include "BinaryCursor.h"
+#include "TypeCheck.h"
+
+
+FieldPath::FieldPath(const avro::NodePtr& root, const std::string& path_) :
+  path(path_), schema(root)
+{
+  size_t start = 0;
+  while (start <= path.length()) {
+    auto end = path.find('.', start);
+    if (end == std::string::npos)
+      end = path.length();
+    const auto name = path.substr(start, end - start);
+
+    const auto record = ResolveSymbolic(schema);
+    if (record->type() != avro::AVRO_RECORD)
+      throw std::invalid_argument("Field path '" + path + "' does not descend through records");
+
+    size_t index;
+    if (!record->nameIndex(name, index))
+      throw std::invalid_argument("Field path not found: '" + path + "'");
+    indices.push_back(index);
+    schema = record->leafAt(index);
+
+    start = end + 1;
+  }
+}
+
+
+void BinaryCursor::SkipDatum(const avro::NodePtr& schema)
+{
+  const auto node = ResolveSymbolic(schema);
+
+  switch (node->type()) {
+  case avro::AVRO_NULL:
+    break;
+  case avro::AVRO_BOOL:
+    Skip(1);
+    break;
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_ENUM:
+    ReadLong();
+    break;
+  case avro::AVRO_FLOAT:
+    Skip(4);
+    break;
+  case avro::AVRO_DOUBLE:
+    Skip(8);
+    break;
+  case avro::AVRO_STRING:
+  case avro::AVRO_BYTES:
+    Skip(ReadLength());
+    break;
+  case avro::AVRO_FIXED:
+    Skip(node->fixedSize());
+    break;
+  case avro::AVRO_RECORD:
+    for (auto i = 0ull; i < node->leaves(); ++i)
+      SkipDatum(node->leafAt(i));
+    break;
+  case avro::AVRO_ARRAY:
+  case avro::AVRO_MAP:
+  {
+    // Arrays and maps are a series of blocks, each prefixed by its item count
+    // and terminated by an empty block.  A negative count indicates that the
+    // block's size in bytes follows, allowing the whole block to be skipped.
+    const bool is_map = node->type() == avro::AVRO_MAP;
+    const auto& item_schema = node->leafAt(is_map ? 1 : 0);
+    for (auto count = ReadLong(); count != 0; count = ReadLong()) {
+      if (count < 0) {
+        Skip(ReadLength());
+        continue;
+      }
+      for (auto i = 0ll; i < count; ++i) {
+        if (is_map)
+          Skip(ReadLength());
+        SkipDatum(item_schema);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_UNION:
+  {
+    const auto branch = ReadLong();
+    if (branch < 0 || (size_t)branch >= node->leaves())
+      throw InvalidData("BinaryCursor invalid union branch: " + std::to_string(branch));
+    SkipDatum(node->leafAt(branch));
+    break;
+  }
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED("", avro::toString(node->type()));
+  }
+}
+
+void BinaryCursor::SkipToField(const avro::NodePtr& root, const FieldPath& field_path)
+{
+  auto record = root;
+  for (auto index : field_path.indices) {
+    record = ResolveSymbolic(record);
+    for (auto i = 0ull; i < index; ++i)
+      SkipDatum(record->leafAt(i));
+    record = record->leafAt(index);
+  }
+}
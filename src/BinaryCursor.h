@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HelperFunctions.h"
+
+
+// Dot separated path to a field (e.g. a.b.c) descending through nested
+// records, resolved against the schema to the index of the field at each level
+struct FieldPath
+{
+  std::string path;
+  std::vector<size_t> indices;
+  avro::NodePtr schema;
+
+  FieldPath(const avro::NodePtr& root, const std::string& path_);
+};
+
+// Lightweight reader over Avro binary serialised data.
+//
+// Rather than decoding into an avro::GenericDatum this walks the binary data
+// directly, allowing datums to be skipped over without being materialised and
+// the offset of each datum to be tracked.
+class BinaryCursor
+{
+private:
+  const uint8_t* begin_;
+  const uint8_t* position_;
+  const uint8_t* end_;
+
+public:
+  // Thrown if the data ends part way through a datum or is otherwise malformed
+  class InvalidData : public std::invalid_argument
+  {
+  public:
+    InvalidData(const std::string& message) : std::invalid_argument(message.c_str())
+    {};
+  };
+
+  BinaryCursor(const uint8_t* data, size_t size) :
+    begin_(data), position_(data), end_(data + size)
+  {}
+
+  size_t Offset() const
+  {
+    return position_ - begin_;
+  }
+
+  size_t Remaining() const
+  {
+    return end_ - position_;
+  }
+
+  void Seek(size_t offset)
+  {
+    if (offset > (size_t)(end_ - begin_))
+      throw InvalidData("BinaryCursor seek beyond end of data");
+    position_ = begin_ + offset;
+  }
+
+  // Returns a pointer to the next n bytes and advances past them
+  const uint8_t* Read(size_t n)
+  {
+    if (n > Remaining())
+      throw InvalidData("BinaryCursor EOF reached");
+    const uint8_t* result = position_;
+    position_ += n;
+    return result;
+  }
+
+  void Skip(size_t n)
+  {
+    Read(n);
+  }
+
+  // Avro ints and longs are zig-zag encoded variable length integers
+  int64_t ReadLong()
+  {
+    uint64_t encoded = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      if (position_ == end_)
+        throw InvalidData("BinaryCursor EOF reached");
+      if (shift >= 64)
+        throw InvalidData("BinaryCursor invalid varint");
+      byte = *position_++;
+      encoded |= (uint64_t)(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+
+    return (int64_t)(encoded >> 1) ^ -(int64_t)(encoded & 1);
+  }
+
+  int32_t ReadInt()
+  {
+    return (int32_t)ReadLong();
+  }
+
+  // Strings and bytes are a long length followed by that many bytes
+  size_t ReadLength()
+  {
+    const auto length = ReadLong();
+    if (length < 0)
+      throw InvalidData("BinaryCursor negative length");
+    return (size_t)length;
+  }
+
+  // Advance past a complete datum of the specified schema
+  void SkipDatum(const avro::NodePtr& schema);
+
+  // Advance from the start of a record to the start of the field identified by
+  // the path, skipping over all the preceding fields
+  void SkipToField(const avro::NodePtr& root, const FieldPath& field_path);
+};
@@ -0,0 +1,339 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <limits>
+
+#include <avro/DataFile.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/LogicalType.hh>
+
+#include "HelperFunctions.h"
+#include "BlockIndex.h"
+#include "TypeCheck.h"
+#include "KdbOptions.h"
+
+
+// Running minimum and maximum of a field of the record within each block
+class FieldRange
+{
+private:
+  const std::string name_;
+  size_t index_;
+  avro::Type type_;
+  avro::LogicalType::Type logical_type_;
+
+  // Range within the current block
+  bool found_;
+  int64_t long_min_;
+  int64_t long_max_;
+  double double_min_;
+  double double_max_;
+
+  // Range of each completed block
+  std::vector<bool> blocks_found_;
+  std::vector<int64_t> long_mins_;
+  std::vector<int64_t> long_maxs_;
+  std::vector<double> double_mins_;
+  std::vector<double> double_maxs_;
+
+  bool IsLong() const
+  {
+    return type_ == avro::AVRO_INT || type_ == avro::AVRO_LONG;
+  }
+
+  K ToKdb(const std::vector<int64_t>& long_values, const std::vector<double>& double_values) const;
+
+public:
+  FieldRange(const avro::NodePtr& record, const std::string& name);
+
+  const std::string& Name() const
+  {
+    return name_;
+  }
+
+  void Update(const avro::GenericDatum& record_datum);
+
+  // Record the range of the current block and reset it for the next
+  void EndBlock();
+
+  K Mins() const
+  {
+    return ToKdb(long_mins_, double_mins_);
+  }
+
+  K Maxs() const
+  {
+    return ToKdb(long_maxs_, double_maxs_);
+  }
+};
+
+FieldRange::FieldRange(const avro::NodePtr& record, const std::string& name) :
+  name_(name), index_(0), found_(false), long_min_(0), long_max_(0), double_min_(0), double_max_(0)
+{
+  if (record->type() != avro::AVRO_RECORD || !record->nameIndex(name, index_))
+    throw TypeCheck("Index field '" + name + "' is not a field of the record");
+
+  // Optional fields are a union of null and the field's type
+  auto field = ResolveSymbolic(record->leafAt(index_));
+  if (field->type() == avro::AVRO_UNION && field->leaves() == 2) {
+    if (field->leafAt(0)->type() == avro::AVRO_NULL)
+      field = ResolveSymbolic(field->leafAt(1));
+    else if (field->leafAt(1)->type() == avro::AVRO_NULL)
+      field = ResolveSymbolic(field->leafAt(0));
+  }
+
+  type_ = field->type();
+  logical_type_ = field->logicalType().type();
+  if (type_ != avro::AVRO_INT && type_ != avro::AVRO_LONG && type_ != avro::AVRO_FLOAT && type_ != avro::AVRO_DOUBLE)
+    throw TypeCheck("Index field '" + name + "' must be int, long, float or double");
+}
+
+void FieldRange::Update(const avro::GenericDatum& record_datum)
+{
+  const auto& datum = record_datum.value<avro::GenericRecord>().fieldAt(index_);
+  if (datum.type() == avro::AVRO_NULL)
+    return;
+
+  if (IsLong()) {
+    const int64_t value = type_ == avro::AVRO_INT ? datum.value<int32_t>() : datum.value<int64_t>();
+    if (!found_ || value < long_min_)
+      long_min_ = value;
+    if (!found_ || value > long_max_)
+      long_max_ = value;
+  } else {
+    const double value = type_ == avro::AVRO_FLOAT ? datum.value<float>() : datum.value<double>();
+    if (std::isnan(value))
+      return;
+    if (!found_ || value < double_min_)
+      double_min_ = value;
+    if (!found_ || value > double_max_)
+      double_max_ = value;
+  }
+  found_ = true;
+}
+
+void FieldRange::EndBlock()
+{
+  blocks_found_.push_back(found_);
+  if (IsLong()) {
+    long_mins_.push_back(long_min_);
+    long_maxs_.push_back(long_max_);
+  } else {
+    double_mins_.push_back(double_min_);
+    double_maxs_.push_back(double_max_);
+  }
+  found_ = false;
+}
+
+K FieldRange::ToKdb(const std::vector<int64_t>& long_values, const std::vector<double>& double_values) const
+{
+  // Use the same kdb+ type as the field would be decoded to, with null for any
+  // block in which the field was always null
+  const auto count = blocks_found_.size();
+  K result = ktn(GetKdbArrayType(type_, logical_type_), count);
+  switch (type_) {
+  case avro::AVRO_INT:
+  {
+    for (auto i = 0ull; i < count; ++i)
+      kI(result)[i] = blocks_found_[i] ? (int32_t)long_values[i] : ni;
+    if (logical_type_ == avro::LogicalType::DATE || logical_type_ == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(name_, logical_type_);
+      for (auto i = 0ull; i < count; ++i) {
+        if (blocks_found_[i])
+          kI(result)[i] = tc.AvroToKdb(kI(result)[i]);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_LONG:
+  {
+    for (auto i = 0ull; i < count; ++i)
+      kJ(result)[i] = blocks_found_[i] ? long_values[i] : nj;
+    if (logical_type_ == avro::LogicalType::TIME_MICROS || logical_type_ == avro::LogicalType::TIMESTAMP_MILLIS || logical_type_ == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(name_, logical_type_);
+      for (auto i = 0ull; i < count; ++i) {
+        if (blocks_found_[i])
+          kJ(result)[i] = tc.AvroToKdb(kJ(result)[i]);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_FLOAT:
+  {
+    for (auto i = 0ull; i < count; ++i)
+      kE(result)[i] = blocks_found_[i] ? (float)double_values[i] : std::numeric_limits<float>::quiet_NaN();
+    break;
+  }
+  case avro::AVRO_DOUBLE:
+  default:
+  {
+    for (auto i = 0ull; i < count; ++i)
+      kF(result)[i] = blocks_found_[i] ? double_values[i] : std::numeric_limits<double>::quiet_NaN();
+    break;
+  }
+  }
+  return result;
+}
+
+K LongColumn(const std::vector<int64_t>& values)
+{
+  K result = ktn(KJ, values.size());
+  for (auto i = 0ull; i < values.size(); ++i)
+    kJ(result)[i] = values[i];
+  return result;
+}
+
+void SaveIndex(const std::string& index_filename, K index)
+{
+  K serialised = b9(3, index);
+  if (!serialised || serialised->t == -128) {
+    const std::string error = serialised ? serialised->s : "unknown error";
+    if (serialised)
+      r0(serialised);
+    throw std::runtime_error("Failed to serialise index: " + error);
+  }
+
+  std::ofstream file(index_filename, std::ios::binary | std::ios::trunc);
+  file.write((const char*)kG(serialised), serialised->n);
+  r0(serialised);
+  if (!file)
+    throw std::runtime_error("Cannot write file: " + index_filename);
+}
+
+K LoadIndex(const std::string& index_filename)
+{
+  std::ifstream file(index_filename, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Cannot open file: " + index_filename);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  const auto data = contents.str();
+
+  K serialised = ktn(KG, data.size());
+  std::memcpy(kG(serialised), data.data(), data.size());
+  if (!okx(serialised)) {
+    r0(serialised);
+    throw std::runtime_error("Invalid index file: " + index_filename);
+  }
+  K index = d9(serialised);
+  r0(serialised);
+  if (!index || index->t == -128) {
+    if (index)
+      r0(index);
+    throw std::runtime_error("Invalid index file: " + index_filename);
+  }
+  return index;
+}
+
+std::vector<BlockIndexEntry> GetIndexEntries(K index)
+{
+  if (index->t != XT)
+    throw TypeCheck("index not 98h");
+
+  K keys = kK(index->k)[0];
+  K values = kK(index->k)[1];
+  auto column = [keys, values](const std::string& name) -> K {
+    for (auto i = 0; i < keys->n; ++i) {
+      if (name == kS(keys)[i]) {
+        K result = kK(values)[i];
+        if (result->t != KJ)
+          throw TypeCheck("index column '" + name + "' not 7h");
+        return result;
+      }
+    }
+    throw TypeCheck("index missing column '" + name + "'");
+  };
+  K offsets = column("offset");
+  K first_rows = column("firstRow");
+  K rows = column("rows");
+
+  std::vector<BlockIndexEntry> result;
+  result.reserve(offsets->n);
+  for (auto i = 0; i < offsets->n; ++i)
+    result.push_back({ kJ(offsets)[i], kJ(first_rows)[i], kJ(rows)[i] });
+  return result;
+}
+
+K BuildIndex(K filename, K fields, K options)
+{
+  if (!IsKdbString(filename))
+    return krr(S("BuildIndex, filename expected -11|10h"));
+  if (fields->t != -KS && fields->t != KS && fields->t != 101)
+    return krr((S)"fields not -11|11|101h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  const auto filename_str = GetKdbFilename(filename);
+  auto index_filename = IndexFilename(filename_str);
+  options_parser.GetStringOption(Options::INDEX_FILE, index_filename);
+
+  avro::DataFileReader<avro::GenericDatum> reader(filename_str.c_str());
+  const auto& root = reader.readerSchema().root();
+
+  std::vector<FieldRange> ranges;
+  if (fields->t == -KS) {
+    ranges.emplace_back(root, fields->s);
+  } else if (fields->t == KS) {
+    for (auto i = 0; i < fields->n; ++i)
+      ranges.emplace_back(root, kS(fields)[i]);
+  }
+
+  // Each datum reports the start of the block it was read from so a change in
+  // that position marks the start of the next block
+  std::vector<int64_t> offsets;
+  std::vector<int64_t> first_rows;
+  std::vector<int64_t> rows;
+  int64_t row = 0;
+  avro::GenericDatum datum(reader.readerSchema());
+  while (reader.read(datum)) {
+    const auto offset = reader.previousSync();
+    if (offsets.empty() || offset != offsets.back()) {
+      if (!offsets.empty()) {
+        for (auto& range : ranges)
+          range.EndBlock();
+      }
+      offsets.push_back(offset);
+      first_rows.push_back(row);
+      rows.push_back(0);
+    }
+    ++rows.back();
+    ++row;
+    for (auto& range : ranges)
+      range.Update(datum);
+  }
+  if (!offsets.empty()) {
+    for (auto& range : ranges)
+      range.EndBlock();
+  }
+
+  const auto column_count = 3 + 2 * ranges.size();
+  K keys = ktn(KS, column_count);
+  K values = ktn(0, column_count);
+  kS(keys)[0] = ss((S)"offset");
+  kS(keys)[1] = ss((S)"firstRow");
+  kS(keys)[2] = ss((S)"rows");
+  kK(values)[0] = LongColumn(offsets);
+  kK(values)[1] = LongColumn(first_rows);
+  kK(values)[2] = LongColumn(rows);
+  for (auto i = 0ull; i < ranges.size(); ++i) {
+    kS(keys)[3 + 2 * i] = ss((S)(ranges[i].Name() + "Min").c_str());
+    kS(keys)[4 + 2 * i] = ss((S)(ranges[i].Name() + "Max").c_str());
+    kK(values)[3 + 2 * i] = ranges[i].Mins();
+    kK(values)[4 + 2 * i] = ranges[i].Maxs();
+  }
+  K index = xT(xD(keys, values));
+
+  try {
+    SaveIndex(index_filename, index);
+  } catch (...) {
+    r0(index);
+    throw;
+  }
+
+  return index;
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "HelperFunctions.h"
+
+
+// Location of a block within an Object Container File, as recorded in a block
+// index.  The offset is the position following the block's preceding sync
+// marker, which is where the reader seeks to in order to read the block.
+struct BlockIndexEntry
+{
+  int64_t offset;
+  int64_t first_row;
+  int64_t rows;
+};
+
+// Read the block locations from a block index table.  The table must contain
+// the long columns offset, firstRow and rows.
+std::vector<BlockIndexEntry> GetIndexEntries(K index);
+
+// Load a block index table from its sidecar file
+K LoadIndex(const std::string& index_filename);
+
+// The default sidecar file for an Object Container File
+inline std::string IndexFilename(const std::string& filename)
+{
+  return filename + ".idx";
+}
+
+extern "C"
+{
+  /// @brief Scan an Avro Object Container File to build a block index
+  ///
+  /// The index is a table with a row for each block in the file containing
+  /// its offset, the row number of its first datum and its number of rows.  If
+  /// fields are specified the index also contains the minimum and maximum
+  /// value of each of those fields within each block.  The index is saved to
+  /// a sidecar file which is used by OpenReader to seek directly to a row.
+  ///
+  /// Supported options:
+  ///
+  /// * INDEX_FILE (string).  Name of the sidecar file to save the index to.
+  /// Default is the filename with ".idx" appended.
+  ///
+  /// @param filename.  String or symbol containing the filename.
+  ///
+  /// @param fields.  Symbol or symbol list of top level fields of the record
+  /// to record the minimum and maximum values of, or generic null(::) for
+  /// none.  The fields must be int, long, float or double (including the
+  /// logical types based on them), or a union of null with one of these.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Block index table
+  EXP K BuildIndex(K filename, K fields, K options);
+}
@@ -0,0 +1,407 @@
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <avro/ValidSchema.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Compare.h"
+#include "BinaryCursor.h"
+#include "TypeCheck.h"
+#include "GenericForeign.h"
+
+
+// Iterates over the items of an array or map, reading the block headers as
+// required.  Arrays and maps may be split into any number of blocks so two
+// equal datums are not necessarily encoded identically.
+class BlockItems
+{
+private:
+  BinaryCursor& cursor_;
+  int64_t remaining_;
+  bool done_;
+
+public:
+  BlockItems(BinaryCursor& cursor) :
+    cursor_(cursor), remaining_(0), done_(false)
+  {}
+
+  bool Next()
+  {
+    while (remaining_ == 0 && !done_) {
+      const auto count = cursor_.ReadLong();
+      if (count == 0) {
+        done_ = true;
+      } else if (count < 0) {
+        cursor_.ReadLength();
+        remaining_ = -count;
+      } else {
+        remaining_ = count;
+      }
+    }
+    if (done_)
+      return false;
+    --remaining_;
+    return true;
+  }
+};
+
+template <typename T>
+int CompareValues(T x, T y)
+{
+  return x < y ? -1 : (y < x ? 1 : 0);
+}
+
+// Floats are totally ordered, as by Java's Double.compare which Avro's own
+// comparison uses, with every NaN equal and sorting after all numbers
+template <typename T>
+int CompareFloats(T x, T y)
+{
+  const bool x_nan = std::isnan(x);
+  const bool y_nan = std::isnan(y);
+  if (x_nan || y_nan)
+    return CompareValues(x_nan, y_nan);
+  return CompareValues(x, y);
+}
+
+int CompareBytes(BinaryCursor& x, BinaryCursor& y, size_t x_length, size_t y_length)
+{
+  const auto x_data = x.Read(x_length);
+  const auto y_data = y.Read(y_length);
+  const auto result = std::memcmp(x_data, y_data, std::min(x_length, y_length));
+  if (result != 0)
+    return result < 0 ? -1 : 1;
+  return CompareValues(x_length, y_length);
+}
+
+template <typename T>
+T ReadValue(BinaryCursor& cursor)
+{
+  T value;
+  std::memcpy(&value, cursor.Read(sizeof(T)), sizeof(T));
+  return value;
+}
+
+int CompareDatum(const avro::NodePtr& schema, BinaryCursor& x, BinaryCursor& y)
+{
+  const auto node = ResolveSymbolic(schema);
+
+  switch (node->type()) {
+  case avro::AVRO_NULL:
+    return 0;
+  case avro::AVRO_BOOL:
+    return CompareValues(*x.Read(1), *y.Read(1));
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_ENUM:
+  {
+    // Enums are ordered by the position of the symbol in the schema
+    const auto x_value = x.ReadLong();
+    return CompareValues(x_value, y.ReadLong());
+  }
+  case avro::AVRO_FLOAT:
+  {
+    const auto x_value = ReadValue<float>(x);
+    return CompareFloats(x_value, ReadValue<float>(y));
+  }
+  case avro::AVRO_DOUBLE:
+  {
+    const auto x_value = ReadValue<double>(x);
+    return CompareFloats(x_value, ReadValue<double>(y));
+  }
+  case avro::AVRO_STRING:
+  case avro::AVRO_BYTES:
+  {
+    const auto x_length = x.ReadLength();
+    return CompareBytes(x, y, x_length, y.ReadLength());
+  }
+  case avro::AVRO_FIXED:
+    return CompareBytes(x, y, node->fixedSize(), node->fixedSize());
+  case avro::AVRO_RECORD:
+  {
+    for (auto i = 0ull; i < node->leaves(); ++i) {
+      const auto result = CompareDatum(node->leafAt(i), x, y);
+      if (result != 0)
+        return result;
+    }
+    return 0;
+  }
+  case avro::AVRO_ARRAY:
+  {
+    // Compared item by item, with the shorter array ordered first if one is a
+    // prefix of the other
+    BlockItems x_items(x);
+    BlockItems y_items(y);
+    while (true) {
+      const auto x_more = x_items.Next();
+      const auto y_more = y_items.Next();
+      if (!x_more || !y_more)
+        return CompareValues(x_more, y_more);
+      const auto result = CompareDatum(node->leafAt(0), x, y);
+      if (result != 0)
+        return result;
+    }
+  }
+  case avro::AVRO_UNION:
+  {
+    // Ordered first by branch then by the value within that branch
+    const auto x_branch = x.ReadLong();
+    const auto y_branch = y.ReadLong();
+    if (x_branch < 0 || (size_t)x_branch >= node->leaves())
+      throw BinaryCursor::InvalidData("BinaryCursor invalid union branch: " + std::to_string(x_branch));
+    if (y_branch < 0 || (size_t)y_branch >= node->leaves())
+      throw BinaryCursor::InvalidData("BinaryCursor invalid union branch: " + std::to_string(y_branch));
+    if (x_branch != y_branch)
+      return CompareValues(x_branch, y_branch);
+    return CompareDatum(node->leafAt(x_branch), x, y);
+  }
+  case avro::AVRO_MAP:
+    throw TypeCheck("Avro maps have no sort order and cannot be compared");
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED("", avro::toString(node->type()));
+  }
+}
+
+// 64-bit FNV-1a
+const uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+const uint64_t kFnvPrime = 0x100000001b3ull;
+
+void HashBytes(uint64_t& hash, const uint8_t* data, size_t length)
+{
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= data[i];
+    hash *= kFnvPrime;
+  }
+}
+
+// Integers are hashed little endian regardless of platform so that hashes can
+// be shared between processes
+void HashLong(uint64_t& hash, int64_t value)
+{
+  uint8_t bytes[8];
+  for (auto i = 0; i < 8; ++i)
+    bytes[i] = (uint8_t)((uint64_t)value >> (i * 8));
+  HashBytes(hash, bytes, sizeof(bytes));
+}
+
+void HashDatum(const avro::NodePtr& schema, BinaryCursor& cursor, uint64_t& hash)
+{
+  const auto node = ResolveSymbolic(schema);
+
+  switch (node->type()) {
+  case avro::AVRO_NULL:
+    break;
+  case avro::AVRO_BOOL:
+    HashBytes(hash, cursor.Read(1), 1);
+    break;
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_ENUM:
+    HashLong(hash, cursor.ReadLong());
+    break;
+  case avro::AVRO_FLOAT:
+  {
+    // -0.0 and 0.0 compare equal, as do NaNs with any payload, so must hash
+    // equal
+    auto value = ReadValue<float>(cursor);
+    if (value == 0)
+      value = 0;
+    else if (std::isnan(value))
+      value = std::numeric_limits<float>::quiet_NaN();
+    HashBytes(hash, (const uint8_t*)&value, sizeof(value));
+    break;
+  }
+  case avro::AVRO_DOUBLE:
+  {
+    auto value = ReadValue<double>(cursor);
+    if (value == 0)
+      value = 0;
+    else if (std::isnan(value))
+      value = std::numeric_limits<double>::quiet_NaN();
+    HashBytes(hash, (const uint8_t*)&value, sizeof(value));
+    break;
+  }
+  case avro::AVRO_STRING:
+  case avro::AVRO_BYTES:
+  {
+    // Prefixed with the length so that adjacent fields can't run into each
+    // other
+    const auto length = cursor.ReadLength();
+    HashLong(hash, length);
+    HashBytes(hash, cursor.Read(length), length);
+    break;
+  }
+  case avro::AVRO_FIXED:
+    HashBytes(hash, cursor.Read(node->fixedSize()), node->fixedSize());
+    break;
+  case avro::AVRO_RECORD:
+    for (auto i = 0ull; i < node->leaves(); ++i)
+      HashDatum(node->leafAt(i), cursor, hash);
+    break;
+  case avro::AVRO_ARRAY:
+  {
+    BlockItems items(cursor);
+    int64_t count = 0;
+    while (items.Next()) {
+      HashDatum(node->leafAt(0), cursor, hash);
+      ++count;
+    }
+    HashLong(hash, count);
+    break;
+  }
+  case avro::AVRO_MAP:
+  {
+    // Map entries have no defined order, so each entry is hashed separately
+    // and combined with an order independent sum
+    BlockItems items(cursor);
+    uint64_t entries = 0;
+    int64_t count = 0;
+    while (items.Next()) {
+      uint64_t entry = kFnvOffsetBasis;
+      const auto length = cursor.ReadLength();
+      HashLong(entry, length);
+      HashBytes(entry, cursor.Read(length), length);
+      HashDatum(node->leafAt(1), cursor, entry);
+      entries += entry;
+      ++count;
+    }
+    HashLong(hash, entries);
+    HashLong(hash, count);
+    break;
+  }
+  case avro::AVRO_UNION:
+  {
+    const auto branch = cursor.ReadLong();
+    if (branch < 0 || (size_t)branch >= node->leaves())
+      throw BinaryCursor::InvalidData("BinaryCursor invalid union branch: " + std::to_string(branch));
+    HashLong(hash, branch);
+    HashDatum(node->leafAt(branch), cursor, hash);
+    break;
+  }
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED("", avro::toString(node->type()));
+  }
+}
+
+std::vector<FieldPath> GetFieldPaths(const avro::NodePtr& root, K fields)
+{
+  std::vector<FieldPath> result;
+  if (fields->t == -KS) {
+    result.emplace_back(root, fields->s);
+  } else if (fields->t == KS) {
+    for (auto i = 0; i < fields->n; ++i)
+      result.emplace_back(root, kS(fields)[i]);
+  } else if (fields->t != 101) {
+    throw TypeCheck("fields not -11|11|101h");
+  }
+  return result;
+}
+
+BinaryCursor MessageCursor(K message)
+{
+  TYPE_CHECK_ARRAY("", "message", KG, message->t);
+  return BinaryCursor((const uint8_t*)kG(message), message->n);
+}
+
+int CompareMessages(const avro::NodePtr& root, const std::vector<FieldPath>& field_paths, K x, K y)
+{
+  if (field_paths.empty()) {
+    auto x_cursor = MessageCursor(x);
+    auto y_cursor = MessageCursor(y);
+    return CompareDatum(root, x_cursor, y_cursor);
+  }
+
+  for (const auto& field_path : field_paths) {
+    auto x_cursor = MessageCursor(x);
+    auto y_cursor = MessageCursor(y);
+    x_cursor.SkipToField(root, field_path);
+    y_cursor.SkipToField(root, field_path);
+    const auto result = CompareDatum(field_path.schema, x_cursor, y_cursor);
+    if (result != 0)
+      return result;
+  }
+  return 0;
+}
+
+int64_t HashMessage(const avro::NodePtr& root, const std::vector<FieldPath>& field_paths, K message)
+{
+  uint64_t hash = kFnvOffsetBasis;
+  if (field_paths.empty()) {
+    auto cursor = MessageCursor(message);
+    HashDatum(root, cursor, hash);
+  } else {
+    for (const auto& field_path : field_paths) {
+      auto cursor = MessageCursor(message);
+      cursor.SkipToField(root, field_path);
+      HashDatum(field_path.schema, cursor, hash);
+    }
+  }
+  return (int64_t)hash;
+}
+
+K Compare(K schema, K x, K y, K fields)
+{
+  if (x->t != KG && x->t != 0)
+    return krr((S)"x not 4|0h");
+  if (y->t != KG && y->t != 0)
+    return krr((S)"y not 4|0h");
+  if (x->t == 0 && y->t == 0 && x->n != y->n)
+    return krr((S)"length");
+
+  KDB_EXCEPTION_TRY;
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto& root = avro_foreign->schema->root();
+  const auto field_paths = GetFieldPaths(root, fields);
+
+  if (x->t == KG && y->t == KG)
+    return ki(CompareMessages(root, field_paths, x, y));
+
+  const auto count = x->t == 0 ? x->n : y->n;
+  K result = ktn(KI, count);
+  try {
+    for (auto i = 0; i < count; ++i)
+      kI(result)[i] = CompareMessages(root, field_paths, x->t == 0 ? kK(x)[i] : x, y->t == 0 ? kK(y)[i] : y);
+  } catch (...) {
+    r0(result);
+    throw;
+  }
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K Hash(K schema, K data, K fields)
+{
+  if (data->t != KG && data->t != 0)
+    return krr((S)"data not 4|0h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto& root = avro_foreign->schema->root();
+  const auto field_paths = GetFieldPaths(root, fields);
+
+  if (data->t == KG)
+    return kj(HashMessage(root, field_paths, data));
+
+  K result = ktn(KJ, data->n);
+  try {
+    for (auto i = 0; i < data->n; ++i)
+      kJ(result)[i] = HashMessage(root, field_paths, kK(data)[i]);
+  } catch (...) {
+    r0(result);
+    throw;
+  }
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
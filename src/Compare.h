@@ -0,0 +1,47 @@
+#pragma once
+
+extern "C"
+{
+  /// @brief Compare Avro binary serialised datums using the Avro sort order,
+  /// without decoding them
+  ///
+  /// Datums are compared following the sort order defined by the Avro
+  /// specification, evaluated directly on the binary data.  Maps have no
+  /// defined sort order so cannot be compared.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema.
+  ///
+  /// @param x.  4h list containing a single Avro binary serialised datum or a
+  /// mixed list of them.
+  ///
+  /// @param y.  4h list containing a single Avro binary serialised datum or a
+  /// mixed list of them.  If both x and y are lists they must be the same
+  /// length, otherwise a single datum is compared against every item of the
+  /// other list.
+  ///
+  /// @param fields.  Symbol or symbol list of dot separated field paths to
+  /// compare on, in order of precedence, or generic null(::) to compare the
+  /// whole datum.
+  ///
+  /// @return -1, 0 or 1 as an int atom if x and y are both single datums,
+  /// otherwise an int list.
+  EXP K Compare(K schema, K x, K y, K fields);
+
+  /// @brief Hash Avro binary serialised datums without decoding them
+  ///
+  /// The 64-bit FNV-1a hash is calculated from the values in the binary data
+  /// rather than its encoding, so datums which compare equal hash equal even
+  /// if their arrays or maps were blocked differently.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema.
+  ///
+  /// @param data.  4h list containing a single Avro binary serialised datum or
+  /// a mixed list of them.
+  ///
+  /// @param fields.  Symbol or symbol list of dot separated field paths to
+  /// hash on or generic null(::) to hash the whole datum.
+  ///
+  /// @return Hash as a long atom if data is a single datum, otherwise a long
+  /// list.
+  EXP K Hash(K schema, K data, K fields);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <avro/GenericDatum.hh>
+
+#include "MemoryStats.h"
+
+
+// Pool of datums for a single schema which are reused from one encode or
+// decode to the next.
+//
+// Building a GenericDatum tree allocates every record, array element and
+// string in it.  A datum which is returned to the pool keeps that storage so
+// the next encode or decode of a similarly shaped value overwrites it in place
+// rather than reallocating it.
+//
+// Each caller leases its own datum so the pool can be used from several
+// threads at once.  The number of idle datums kept is bounded by the number of
+// hardware threads, any beyond that are freed when returned.
+//
+// The pool's datums are charged to the schema's memory account as they were
+// when last returned.  A datum which would take avrokdb over its memory limit
+// is freed rather than kept.
+class DatumPool
+{
+private:
+  struct Entry
+  {
+    std::unique_ptr<avro::GenericDatum> datum;
+    // Bytes charged for the datum
+    size_t bytes;
+  };
+
+  avro::NodePtr schema_;
+  size_t max_idle_;
+  MemoryCharge charge_;
+  std::mutex mutex_;
+  std::vector<Entry> idle_;
+
+  void Release(Entry entry)
+  {
+    const auto bytes = DatumBytes(*entry.datum);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < max_idle_ && (bytes <= entry.bytes || charge_.TryAdd(bytes - entry.bytes))) {
+      charge_.Remove(bytes < entry.bytes ? entry.bytes - bytes : 0);
+      entry.bytes = bytes;
+      idle_.push_back(std::move(entry));
+    } else {
+      charge_.Remove(entry.bytes);
+    }
+  }
+
+public:
+  // A datum leased from the pool, which is returned to it on destruction
+  class Lease
+  {
+  private:
+    DatumPool* pool_;
+    Entry entry_;
+
+  public:
+    Lease(DatumPool* pool, Entry entry) :
+      pool_(pool), entry_(std::move(entry))
+    {}
+
+    Lease(Lease&& other) :
+      pool_(other.pool_), entry_(std::move(other.entry_))
+    {}
+
+    ~Lease()
+    {
+      if (entry_.datum)
+        pool_->Release(std::move(entry_));
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    avro::GenericDatum& operator*() const
+    {
+      return *entry_.datum;
+    }
+
+    avro::GenericDatum* operator->() const
+    {
+      return entry_.datum.get();
+    }
+  };
+
+  DatumPool(const avro::NodePtr& schema, MemoryAccount* memory) :
+    schema_(schema), max_idle_(std::max<size_t>(std::thread::hardware_concurrency(), 1)), charge_(memory, MEMORY_POOL)
+  {}
+
+  DatumPool(const DatumPool&) = delete;
+  DatumPool& operator=(const DatumPool&) = delete;
+
+  // Lease an idle datum, or a new one if there are none.  The datum holds
+  // whatever value it was last used for so must be completely overwritten.
+  Lease Acquire()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!idle_.empty()) {
+        auto entry = std::move(idle_.back());
+        idle_.pop_back();
+        return Lease(this, std::move(entry));
+      }
+    }
+    return Lease(this, { std::unique_ptr<avro::GenericDatum>(new avro::GenericDatum(schema_)), 0 });
+  }
+};
@@ -1,3 +1,4 @@
+#include <atomic>
 #include <sstream>
 
 #include <avro/ValidSchema.hh>
@@ -11,9 +12,14 @@
 #include "HelperFunctions.h"
 #include "Schema.h"
 #include "Decode.h"
+#include "RecordView.h"
+#include "SingleObject.h"
+#include "JsonDecode.h"
 #include "TypeCheck.h"
 #include "KdbOptions.h"
+#include "RowFilter.h"
 #include "GenericForeign.h"
+#include "ThreadPool.h"
 
 
 K DecodeArray(const std::string& field, const avro::GenericArray& array_datum);
@@ -150,16 +156,14 @@ K DecodeDatum(const std::string& field, const avro::GenericDatum& datum, bool de
   }
 }
 
-K DecodeArray(const std::string& field, const avro::GenericArray& array_datum)
+K DecodeList(const std::string& field, const avro::NodePtr& list_schema, const std::vector<avro::GenericDatum>& array_data, bool null_prefix)
 {
-  auto array_schema = array_datum.schema();
-  assert(array_schema->leaves() == 1);
-  auto array_type = array_schema->leafAt(0)->type();
-  auto array_logical_type = array_schema->leafAt(0)->logicalType();
-  const auto& array_data = array_datum.value();
+  const auto item_schema = ResolveSymbolic(list_schema);
+  auto array_type = item_schema->type();
+  auto array_logical_type = item_schema->logicalType();
 
   size_t result_len = array_data.size();
-  if (array_type == avro::AVRO_RECORD || array_type == avro::AVRO_MAP) {
+  if (null_prefix && (array_type == avro::AVRO_RECORD || array_type == avro::AVRO_MAP)) {
     // We put a (::) at the start of an array of records/maps so need one more item
     ++result_len;
   }
@@ -281,7 +285,8 @@ K DecodeArray(const std::string& field, const avro::GenericArray& array_datum)
   }
   case avro::AVRO_RECORD:
   {
-    kK(result)[index++] = Identity();
+    if (null_prefix)
+      kK(result)[index++] = Identity();
     for (const auto& i : array_data)
       kK(result)[index++] = DecodeRecord(field, i.value<avro::GenericRecord>());
     break;
@@ -300,7 +305,8 @@ K DecodeArray(const std::string& field, const avro::GenericArray& array_datum)
   }
   case avro::AVRO_MAP:
   {
-    kK(result)[index++] = Identity();
+    if (null_prefix)
+      kK(result)[index++] = Identity();
     for (const auto& i : array_data)
       kK(result)[index++] = DecodeMap(field, i.value<avro::GenericMap>());
     break;
@@ -315,6 +321,13 @@ K DecodeArray(const std::string& field, const avro::GenericArray& array_datum)
   return result;
 }
 
+K DecodeArray(const std::string& field, const avro::GenericArray& array_datum)
+{
+  auto array_schema = array_datum.schema();
+  assert(array_schema->leaves() == 1);
+  return DecodeList(field, array_schema->leafAt(0), array_datum.value(), true);
+}
+
 K DecodeMap(const std::string& field, const avro::GenericMap& map_datum)
 {
   auto map_schema = map_datum.schema();
@@ -551,6 +564,108 @@ K DecodeUnion(const std::string& field, const avro::GenericDatum& avro_union)
   return result;
 }
 
+K DecodeTable(const avro::NodePtr& record_schema, std::vector<avro::GenericDatum>& records)
+{
+  const auto field_count = record_schema->leaves();
+  K keys = ktn(KS, field_count);
+  K values = ktn(0, field_count);
+
+  // Each column is built by gathering that field from every record and then
+  // converting it using the same type mapping as an array of the field's type
+  std::vector<avro::GenericDatum> column;
+  column.reserve(records.size());
+  for (auto i = 0ull; i < field_count; ++i) {
+    column.clear();
+    for (auto& record : records)
+      column.emplace_back(std::move(record.value<avro::GenericRecord>().fieldAt(i)));
+
+    const auto& name = record_schema->nameAt(i);
+    kS(keys)[i] = ss((S)name.c_str());
+    kK(values)[i] = DecodeList(name, record_schema->leafAt(i), column, false);
+  }
+
+  return xT(xD(keys, values));
+}
+
+// Find the decoder to use.  Decoders don't support multithreaded use so if
+// running in this mode the decoder is created on the fly.  If running single
+// threaded we use the already created decoder in the foreign which is less
+// expensive.
+//
+// JSON is decoded by JsonAvroDecoder without an avro decoder, so only BINARY
+// needs one.
+avro::DecoderPtr GetDecoder(AvroForeign& avro_foreign, const std::string& avro_format, bool multithreaded)
+{
+  if (avro_format != "BINARY")
+    throw std::invalid_argument("Unsupported avro decoding type (should be BINARY or JSON)");
+
+  if (multithreaded)
+    return avro::validatingDecoder(*avro_foreign.schema.get(), avro::binaryDecoder());
+  else
+    return avro_foreign.BinaryDecoder();
+}
+
+avro::DecoderPtr ResetDecoder(AvroForeign& avro_foreign, const std::string& avro_format, bool multithreaded)
+{
+  auto decoder = GetDecoder(avro_foreign, avro_format, true);
+  if (!multithreaded)
+    avro_foreign.SetBinaryDecoder(decoder);
+  return decoder;
+}
+
+K DecodeForeign(std::shared_ptr<AvroForeign> avro_foreign, K data, const KdbOptions& options_parser, bool single_object)
+{
+  auto avro_schema = avro_foreign->schema;
+
+  std::string avro_format = "BINARY";
+  options_parser.GetStringOption(Options::AVRO_FORMAT, avro_format);
+
+  int64_t decode_offset = 0;
+  options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
+  if (decode_offset > data->n)
+    return krr((S)"Decode offset is greater than length of data");
+
+  int64_t multithreaded = 0;
+  options_parser.GetIntOption(Options::MULTITHREADED, multithreaded);
+
+  if (single_object) {
+    if (avro_format != "BINARY")
+      return krr((S)"SINGLE_OBJECT requires BINARY avro format");
+    const auto fingerprint = ReadSingleObjectHeader((const uint8_t*)kG(data) + decode_offset, data->n - decode_offset);
+    if (fingerprint != avro_foreign->fingerprint)
+      return krr((S)"Single object fingerprint does not match schema");
+    decode_offset += kSingleObjectHeaderSize;
+  }
+
+  int64_t lazy_decode = 0;
+  options_parser.GetIntOption(Options::LAZY_DECODE, lazy_decode);
+  if (lazy_decode) {
+    if (avro_format != "BINARY")
+      return krr((S)"LAZY_DECODE requires BINARY avro format");
+    return CreateRecordView(avro_foreign, data, decode_offset);
+  }
+
+  if (avro_format == "JSON") {
+    JsonAvroDecoder json_decoder((const char*)kG(data) + decode_offset, data->n - decode_offset);
+    return json_decoder.Decode("", avro_schema->root());
+  }
+
+  avro::DecoderPtr decoder = GetDecoder(*avro_foreign.get(), avro_format, multithreaded);
+
+  auto istream = avro::memoryInputStream((const uint8_t*)kG(data) + decode_offset, data->n - decode_offset);
+  decoder->init(*istream);
+
+  auto datum = avro_foreign->datums.Acquire();
+  avro::GenericReader::read(*decoder, *datum);
+  decoder->drain();
+
+  K result = DecodeDatum("", *datum, false);
+
+  return result;
+}
+
 K Decode(K schema, K data, K options)
 {
   if (data->t != KG && data->t != KC)
@@ -560,6 +675,64 @@ K Decode(K schema, K data, K options)
 
   auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
 
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+
+  int64_t single_object = 0;
+  options_parser.GetIntOption(Options::SINGLE_OBJECT, single_object);
+
+  return DecodeForeign(avro_foreign, data, options_parser, single_object);
+
+  KDB_EXCEPTION_CATCH;
+}
+
+// JSON datums are parsed directly from the text, see JsonAvroDecoder
+K DecodeMultiJson(const avro::NodePtr& root, K data, int64_t decode_offset, int64_t max_items, bool continue_on_error)
+{
+  const size_t length = data->n - decode_offset;
+  JsonAvroDecoder json_decoder((const char*)kG(data) + decode_offset, length);
+
+  // JSON datums are usually separated by whitespace which must not be mistaken
+  // for the start of another datum
+  K results = ktn(0, 0);
+  json_decoder.SkipWhitespace();
+  size_t consumed = json_decoder.Offset();
+  DecodeErrors errors;
+  try {
+    while (consumed < length && (max_items <= 0 || results->n < max_items)) {
+      K item;
+      try {
+        item = json_decoder.Decode("", root);
+      } catch (const std::exception& e) {
+        if (!continue_on_error)
+          throw;
+
+        errors.Add(results->n, decode_offset + consumed, e.what());
+        break;
+      }
+      jk(&results, item);
+      json_decoder.SkipWhitespace();
+      consumed = json_decoder.Offset();
+    }
+  } catch (...) {
+    r0(results);
+    throw;
+  }
+
+  if (continue_on_error)
+    return knk(3, results, kj(decode_offset + consumed), errors.ToKdb());
+
+  return knk(2, results, kj(decode_offset + consumed));
+}
+
+K DecodeMulti(K schema, K data, K options)
+{
+  if (data->t != KG && data->t != KC)
+    return krr((S)"data not 4|10h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
   auto avro_foreign = GetForeign<AvroForeign>(schema);
   auto avro_schema = avro_foreign->schema;
 
@@ -568,47 +741,310 @@ K Decode(K schema, K data, K options)
 
   int64_t decode_offset = 0;
   options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
   if (decode_offset > data->n)
     return krr((S)"Decode offset is greater than length of data");
 
+  int64_t max_items = 0;
+  options_parser.GetIntOption(Options::DECODE_MAX_ITEMS, max_items);
+
   int64_t multithreaded = 0;
   options_parser.GetIntOption(Options::MULTITHREADED, multithreaded);
 
-  // Find the decoder to use.  Decoders don't support multithreaded use so if
-  // running in this mode the decoder is created on the fly.  If running single
-  // threaded we use the already created decoder in the foreign which is less
-  // expensive.
-  avro::DecoderPtr decoder;
-  if (multithreaded) {
-    avro::DecoderPtr base_decoder;
-    if (avro_format == "BINARY")
-      base_decoder = avro::binaryDecoder();
-    else if (avro_format == "JSON")
-      base_decoder = avro::jsonDecoder(*avro_schema.get());
-    else
-      return krr((S)"Unsupported avro decoding type (should be BINARY or JSON)");
-
-    decoder = avro::validatingDecoder(*avro_schema.get(), base_decoder);
-  } else {
-    if (avro_format == "BINARY")
-      decoder = avro_foreign->binary_decoder;
-    else if (avro_format == "JSON")
-      decoder = avro_foreign->json_decoder;
-    else
-      return krr((S)"Unsupported avro decoding type (should be BINARY or JSON)");
+  int64_t continue_on_error = 0;
+  options_parser.GetIntOption(Options::CONTINUE_ON_ERROR, continue_on_error);
+
+  if (avro_format == "JSON")
+    return DecodeMultiJson(avro_schema->root(), data, decode_offset, max_items, continue_on_error);
+
+  avro::DecoderPtr decoder = GetDecoder(*avro_foreign.get(), avro_format, multithreaded);
+
+  // The decoder is only initialised once for the whole buffer.  After each
+  // datum the decoder is drained so that the stream's byte count reflects
+  // exactly how much of the buffer has been consumed.
+  const uint8_t* begin = (const uint8_t*)kG(data) + decode_offset;
+  const size_t length = data->n - decode_offset;
+  auto istream = avro::memoryInputStream(begin, length);
+  decoder->init(*istream);
+
+  auto datum = avro_foreign->datums.Acquire();
+
+  K results = ktn(0, 0);
+  size_t consumed = 0;
+  DecodeErrors errors;
+  try {
+    while (consumed < length && (max_items <= 0 || results->n < max_items)) {
+      K item;
+      try {
+        avro::GenericReader::read(*decoder, *datum);
+        decoder->drain();
+
+        // Datums of schemas such as "null" occupy no bytes so the rest of the
+        // buffer can never be consumed
+        if (istream->byteCount() == consumed)
+          throw std::runtime_error("Datum occupies no bytes, " + std::to_string(length - consumed) + " bytes of data remaining");
+        item = DecodeDatum("", *datum, false);
+      } catch (const std::exception& e) {
+        if (!continue_on_error)
+          throw;
+
+        // Without a length prefix there is no way to find the start of the
+        // next datum so decoding stops here
+        ResetDecoder(*avro_foreign.get(), avro_format, multithreaded);
+        errors.Add(results->n, decode_offset + consumed, e.what());
+        break;
+      }
+      consumed = istream->byteCount();
+      jk(&results, item);
+    }
+  } catch (...) {
+    r0(results);
+    throw;
   }
 
-  auto istream = avro::memoryInputStream((const uint8_t*)kG(data) + decode_offset, data->n - decode_offset);
+  if (continue_on_error)
+    return knk(3, results, kj(decode_offset + consumed), errors.ToKdb());
+
+  return knk(2, results, kj(decode_offset + consumed));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+// JSON records are parsed straight into the table columns, see
+// JsonAvroDecoder
+K DecodeBatchJson(const avro::NodePtr& root, K data, int64_t decode_offset, bool continue_on_error)
+{
+  const bool as_table = root->type() == avro::AVRO_RECORD;
+  K results = as_table ? JsonAvroDecoder::CreateColumns(root) : ktn(0, 0);
+
+  DecodeErrors errors;
+  for (auto i = 0; i < data->n; ++i) {
+    K message = kK(data)[i];
+    try {
+      if (message->t != KG && message->t != KC)
+        throw std::invalid_argument("data item not 4|10h");
+      if (decode_offset > message->n)
+        throw std::invalid_argument("Decode offset is greater than length of data");
+
+      JsonAvroDecoder json_decoder((const char*)kG(message) + decode_offset, message->n - decode_offset);
+      if (as_table)
+        json_decoder.DecodeColumns(root, results);
+      else
+        jk(&results, json_decoder.Decode("", root));
+    } catch (const std::exception& e) {
+      if (!continue_on_error) {
+        r0(results);
+        throw std::runtime_error("message " + std::to_string(i) + ": " + e.what());
+      }
+      errors.Add(i, decode_offset, e.what());
+    }
+  }
+
+  if (as_table) {
+    K keys = ktn(KS, root->leaves());
+    for (auto i = 0ull; i < root->leaves(); ++i)
+      kS(keys)[i] = ss((S)root->nameAt(i).c_str());
+    results = xT(xD(keys, results));
+  }
+
+  if (continue_on_error)
+    return knk(2, results, errors.ToKdb());
+
+  return results;
+}
+
+void DecodeBatchItem(BatchDecode& batch, size_t i, avro::DecoderPtr& decoder)
+{
+  K message = batch.Message(i);
+  if (message->t != KG && message->t != KC)
+    throw std::invalid_argument("data item not 4|10h");
+  if (batch.decode_offset > message->n)
+    throw std::invalid_argument("Decode offset is greater than length of data");
+
+  const uint8_t* begin = (const uint8_t*)kG(message) + batch.decode_offset;
+  const size_t length = message->n - batch.decode_offset;
+
+  // Rejected messages are only read as far as the filter's fields
+  auto& item = batch.items[i];
+  if (batch.filter && !batch.filter->Matches(begin, length)) {
+    item.state = BatchItem::FILTERED;
+    return;
+  }
+
+  auto istream = avro::memoryInputStream(begin, length);
   decoder->init(*istream);
 
-  avro::GenericReader reader(*avro_schema.get(), decoder);
-  avro::GenericDatum datum;
-  reader.read(datum);
+  avro::GenericReader reader(batch.schema, decoder);
+  reader.read(item.datum);
   reader.drain();
+  batch.memory.Add(DatumBytes(item.datum));
+  item.state = BatchItem::DECODED;
+}
 
-  K result = DecodeDatum("", datum, false);
+// Decode chunks of the batch until there are none left.  Once a message has
+// failed without CONTINUE_ON_ERROR no more chunks are claimed, but as chunks
+// are claimed in order every message before the failure has been decoded.
+void DecodeBatchChunks(BatchDecode& batch, avro::DecoderPtr decoder, const std::function<avro::DecoderPtr()>& reset_decoder)
+{
+  const auto chunk_count = batch.ChunkCount();
+  while (!batch.stop) {
+    const auto chunk = batch.next_chunk++;
+    if (chunk >= chunk_count)
+      return;
 
-  return result;
+    const auto end = std::min(batch.items.size(), (chunk + 1) * kBatchChunkSize);
+    for (auto i = chunk * kBatchChunkSize; i < end; ++i) {
+      try {
+        DecodeBatchItem(batch, i, decoder);
+      } catch (const MemoryLimitExceeded& e) {
+        bool first = false;
+        if (batch.over_limit.compare_exchange_strong(first, true))
+          batch.limit_error = e.what();
+        batch.stop = true;
+        return;
+      } catch (const std::exception& e) {
+        batch.items[i].state = BatchItem::FAILED;
+        batch.items[i].error = e.what();
+
+        // The decoder may have been left part way through the bad datum
+        decoder = reset_decoder();
+        if (!batch.continue_on_error) {
+          batch.stop = true;
+          return;
+        }
+      }
+    }
+  }
+}
+
+K BatchToKdb(BatchDecode& batch, const avro::NodePtr& root)
+{
+  if (batch.over_limit)
+    throw MemoryLimitExceeded(batch.limit_error);
+
+  // A single message is converted as by Decode
+  if (batch.data->t != 0) {
+    auto& item = batch.items.front();
+    if (item.state == BatchItem::FAILED)
+      throw std::runtime_error(item.error);
+    if (item.state != BatchItem::DECODED)
+      return Identity();
+    return DecodeDatum("", item.datum, false);
+  }
+
+  // Records are collected and converted column by column at the end, anything
+  // else is converted in message order
+  const bool as_table = root->type() == avro::AVRO_RECORD;
+  std::vector<avro::GenericDatum> records;
+  if (as_table)
+    records.reserve(batch.items.size());
+  K results = as_table ? NULL : ktn(0, 0);
+
+  DecodeErrors errors;
+  for (auto i = 0ull; i < batch.items.size(); ++i) {
+    auto& item = batch.items[i];
+    if (item.state == BatchItem::FAILED) {
+      if (!batch.continue_on_error) {
+        if (results)
+          r0(results);
+        throw std::runtime_error("message " + std::to_string(i) + ": " + item.error);
+      }
+      errors.Add(i, batch.decode_offset, item.error);
+    } else if (item.state == BatchItem::DECODED) {
+      if (as_table) {
+        records.emplace_back(std::move(item.datum));
+      } else {
+        try {
+          jk(&results, DecodeDatum("", item.datum, false));
+        } catch (const std::exception& e) {
+          if (!batch.continue_on_error) {
+            r0(results);
+            throw std::runtime_error("message " + std::to_string(i) + ": " + e.what());
+          }
+          errors.Add(i, batch.decode_offset, e.what());
+        }
+      }
+    }
+  }
+
+  if (as_table)
+    results = DecodeTable(root, records);
+
+  if (batch.continue_on_error)
+    return knk(2, results, errors.ToKdb());
+
+  return results;
+}
+
+K DecodeBatch(K schema, K data, K options)
+{
+  if (data->t != 0)
+    return krr((S)"data not 0h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  auto avro_schema = avro_foreign->schema;
+
+  std::string avro_format = "BINARY";
+  options_parser.GetStringOption(Options::AVRO_FORMAT, avro_format);
+
+  int64_t decode_offset = 0;
+  options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
+
+  int64_t multithreaded = 0;
+  options_parser.GetIntOption(Options::MULTITHREADED, multithreaded);
+
+  int64_t continue_on_error = 0;
+  options_parser.GetIntOption(Options::CONTINUE_ON_ERROR, continue_on_error);
+
+  int64_t threads = 0;
+  options_parser.GetIntOption(Options::THREADS, threads);
+  if (threads < 0)
+    return krr((S)"THREADS must be non-negative");
+
+  const auto& root = avro_schema->root();
+  const auto filter = GetRowFilter(root, options_parser);
+  if (avro_format == "JSON") {
+    if (filter)
+      return krr((S)"FILTER requires BINARY format");
+    return DecodeBatchJson(root, data, decode_offset, continue_on_error);
+  }
+
+  avro::DecoderPtr decoder = GetDecoder(*avro_foreign.get(), avro_format, multithreaded);
+
+  BatchDecode batch(*avro_schema.get(), data, decode_offset, filter.get(), continue_on_error, avro_foreign->memory);
+
+  // Use one decoder per pool thread, or as many as requested, but no more
+  // than there are chunks to decode
+  auto& pool = ThreadPool::Shared();
+  const auto workers = std::min<size_t>(threads ? (size_t)threads : pool.Size(), batch.ChunkCount());
+  if (workers <= 1) {
+    DecodeBatchChunks(batch, decoder, [&] { return ResetDecoder(*avro_foreign.get(), avro_format, multithreaded); });
+  } else {
+    // The calling thread is one of the workers.  Each has its own decoder
+    // since they don't support concurrent use.
+    const auto new_decoder = [&avro_foreign, &avro_format] { return GetDecoder(*avro_foreign.get(), avro_format, true); };
+    std::deque<std::future<void>> pending;
+    try {
+      for (auto i = 1ull; i < workers; ++i)
+        pending.push_back(pool.Submit([&batch, new_decoder] { DecodeBatchChunks(batch, new_decoder(), new_decoder); }));
+      DecodeBatchChunks(batch, new_decoder(), new_decoder);
+      for (auto& future : pending)
+        future.get();
+    } catch (...) {
+      batch.stop = true;
+      WaitAll(pending);
+      throw;
+    }
+  }
+
+  return BatchToKdb(batch, root);
 
   KDB_EXCEPTION_CATCH;
 }
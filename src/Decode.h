@@ -1,5 +1,169 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "Schema.h"
+#include "KdbOptions.h"
+#include "RowFilter.h"
+#include "MemoryStats.h"
+
+
+// Convert the bytes of a decimal logical type to (precision; scale; bytes)
+K DecimalFromBytes(const std::string& field, avro::LogicalType logical_type, const std::vector<uint8_t>& bytes);
+
+// Convert the bytes of a duration logical type to (months; days; millis)
+K DurationFromBytes(const std::string& field, const std::vector<uint8_t>& bytes);
+
+// Convert a decoded avro datum to the equivalent kdb+ object
+K DecodeDatum(const std::string& field, const avro::GenericDatum& datum, bool decompose_union);
+
+// Convert a list of decoded avro datums with the same schema to a kdb+ list,
+// following the type mapping used for arrays.  If null_prefix is set a (::) is
+// placed at the start of a list of records or maps.
+K DecodeList(const std::string& field, const avro::NodePtr& list_schema, const std::vector<avro::GenericDatum>& array_data, bool null_prefix);
+
+// Convert a set of decoded avro records to a kdb+ table.  The fields are moved
+// out of the records as each column is built.
+K DecodeTable(const avro::NodePtr& record_schema, std::vector<avro::GenericDatum>& records);
+
+// Return the decoder to use for this schema and AVRO_FORMAT
+avro::DecoderPtr GetDecoder(AvroForeign& avro_foreign, const std::string& avro_format, bool multithreaded);
+
+// Replace a decoder which has been left part way through a datum by a decoding
+// error, returning the new decoder
+avro::DecoderPtr ResetDecoder(AvroForeign& avro_foreign, const std::string& avro_format, bool multithreaded);
+
+// Decode a single datum from data using the specified schema, applying the
+// options supported by Decode.  If single_object is set the data must start
+// with a single object header matching the schema's fingerprint.
+K DecodeForeign(std::shared_ptr<AvroForeign> avro_foreign, K data, const KdbOptions& options_parser, bool single_object);
+
+
+// Collects the details of messages which failed to decode so that a batch can
+// continue past them when CONTINUE_ON_ERROR is set
+class DecodeErrors
+{
+private:
+  K index;
+  K offset;
+  K message;
+
+public:
+  DecodeErrors() :
+    index(ktn(KJ, 0)), offset(ktn(KJ, 0)), message(ktn(0, 0))
+  {}
+
+  ~DecodeErrors()
+  {
+    if (index) {
+      r0(index);
+      r0(offset);
+      r0(message);
+    }
+  }
+
+  void Add(int64_t index_, int64_t offset_, const std::string& message_)
+  {
+    J i = index_;
+    J o = offset_;
+    ja(&index, &i);
+    ja(&offset, &o);
+    K k_message = ktn(KC, message_.length());
+    std::memcpy(kG(k_message), message_.data(), message_.length());
+    jk(&message, k_message);
+  }
+
+  // Returns a ([] index; offset; message) table, passing ownership of the
+  // columns to the caller
+  K ToKdb()
+  {
+    K keys = ktn(KS, 3);
+    kS(keys)[0] = ss((S)"index");
+    kS(keys)[1] = ss((S)"offset");
+    kS(keys)[2] = ss((S)"message");
+    K result = xT(xD(keys, knk(3, index, offset, message)));
+    index = offset = message = NULL;
+    return result;
+  }
+};
+
+// Messages are handed out to the batch decoders in chunks of this many
+const size_t kBatchChunkSize = 64;
+
+// Outcome of decoding one message of a batch
+struct BatchItem
+{
+  enum State { PENDING, DECODED, FILTERED, FAILED };
+
+  State state;
+  avro::GenericDatum datum;
+  std::string error;
+
+  BatchItem() :
+    state(PENDING)
+  {
+  }
+};
+
+// A batch of messages shared between the decoders.  Each decoder claims the
+// next unclaimed chunk of messages until none are left, so a decoder which
+// is held up by large messages simply claims fewer chunks.
+//
+// The data is either a mixed list of messages or a single 4|10h message.  The
+// decoders only read the kdb+ messages, the kdb+ objects are created from the
+// decoded datums by BatchToKdb once all the decoders have finished.
+//
+// The decoded datums are charged to the schema's memory account until the
+// batch is destroyed.  Reaching the memory limit fails the whole batch, even
+// with CONTINUE_ON_ERROR.
+struct BatchDecode
+{
+  const avro::ValidSchema& schema;
+  K data;
+  int64_t decode_offset;
+  const RowFilter* filter;
+  bool continue_on_error;
+
+  std::vector<BatchItem> items;
+  std::atomic<size_t> next_chunk;
+  std::atomic<bool> stop;
+
+  MemoryCharge memory;
+  std::atomic<bool> over_limit;
+  // Set by the decoder which first reached the limit
+  std::string limit_error;
+
+  BatchDecode(const avro::ValidSchema& schema, K data, int64_t decode_offset, const RowFilter* filter, bool continue_on_error, MemoryAccount* memory_account) :
+    schema(schema), data(data), decode_offset(decode_offset), filter(filter), continue_on_error(continue_on_error), items(data->t == 0 ? data->n : 1), next_chunk(0), stop(false),
+    memory(memory_account, MEMORY_DECODE), over_limit(false)
+  {
+  }
+
+  K Message(size_t i) const
+  {
+    return data->t == 0 ? kK(data)[i] : data;
+  }
+
+  size_t ChunkCount() const
+  {
+    return (items.size() + kBatchChunkSize - 1) / kBatchChunkSize;
+  }
+};
+
+// Decode chunks of the batch until there are none left.  Can be run
+// concurrently on several threads, each with its own decoder.  reset_decoder
+// returns a replacement for a decoder left part way through a bad datum.
+void DecodeBatchChunks(BatchDecode& batch, avro::DecoderPtr decoder, const std::function<avro::DecoderPtr()>& reset_decoder);
+
+// Convert the decoded batch to kdb+ on the main thread, as returned by
+// DecodeBatch for a list of messages or Decode for a single message.  Throws
+// for a failed message unless CONTINUE_ON_ERROR was set.
+K BatchToKdb(BatchDecode& batch, const avro::NodePtr& root);
+
 extern "C"
 {
   /// @brief Decode Avro serialised data to a kdb+ object
@@ -14,11 +178,22 @@ extern "C"
   /// should begin from.  Can be used to skip over a header in the buffer.
   /// Default 0. 
   ///
+  /// * LAZY_DECODE (long).  If non-zero a record view foreign is returned
+  /// instead of the decoded kdb+ object.  The record view holds a reference to
+  /// `data` and the offset of each field, with individual fields only decoded
+  /// when requested by RecordViewGet.  Requires a record schema and BINARY
+  /// format.  Default 0.
+  ///
   /// * MULTITHREADED (long).  By default avrokdb is optimised to reuse the
   /// existing decoder for this schema.  However, Avro decoders do not support
   /// concurrent access and therefore if running decode with peach this option
   /// must be set to non-zero to disable this optimisation.  Default 0.
   ///
+  /// * SINGLE_OBJECT (long).  If non-zero the data is expected to use Avro
+  /// single object encoding, with the datum prefixed by the C3 01 marker and
+  /// the 8 byte CRC-64-AVRO fingerprint of the schema.  The fingerprint must
+  /// match that of `schema`.  Requires BINARY format.  Default 0.
+  ///
   /// @param schema.  Foreign object containing the Avro schema to use for
   /// decoding. 
   ///
@@ -31,4 +206,97 @@ extern "C"
   /// @return kdb+ object representing the Avro data having applied the
   /// appropriate type mappings
   EXP K Decode(K schema, K data, K options);
+
+  /// @brief Decode a buffer containing several Avro serialised datums packed
+  /// back to back
+  ///
+  /// The decoder is initialised once for the whole buffer.  Decoding stops at
+  /// the end of the buffer or once DECODE_MAX_ITEMS datums have been decoded.
+  ///
+  /// Supported options:
+  ///
+  /// * AVRO_FORMAT (string).  Describes whether the Avro serialised data is in
+  /// binary or JSON format.  Valid options "BINARY" or "JSON", default
+  /// "BINARY".
+  ///
+  /// * DECODE_OFFSET (long).  Offset into the `data` buffer that decoding
+  /// should begin from.  Default 0. 
+  ///
+  /// * DECODE_MAX_ITEMS (long).  Maximum number of datums to decode.  Zero
+  /// decodes all the datums in the buffer.  Default 0.
+  ///
+  /// * CONTINUE_ON_ERROR (long).  If non-zero a datum which fails to decode
+  /// ends decoding but the datums already decoded are still returned.  Default
+  /// 0.
+  ///
+  /// * MULTITHREADED (long).  By default avrokdb is optimised to reuse the
+  /// existing decoder for this schema.  However, Avro decoders do not support
+  /// concurrent access and therefore if running decode with peach this option
+  /// must be set to non-zero to disable this optimisation.  Default 0.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema to use for
+  /// decoding. 
+  ///
+  /// @param data.  4h or 10h list of Avro serialised data.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Two item mixed list of (decoded kdb+ objects; end offset).  The
+  /// end offset is the offset into `data` following the last decoded datum
+  /// and can be used as the DECODE_OFFSET of a subsequent call.  If
+  /// CONTINUE_ON_ERROR is set and a datum fails to decode, decoding stops at
+  /// that datum and a third item is added containing a ([] index; offset;
+  /// message) table describing the failure.
+  EXP K DecodeMulti(K schema, K data, K options);
+
+  /// @brief Decode a list of individually Avro serialised messages
+  ///
+  /// If the schema is a record the messages are decoded to a kdb+ table with
+  /// one column per field, otherwise a mixed list of the decoded kdb+ objects
+  /// is returned.
+  ///
+  /// Supported options:
+  ///
+  /// * AVRO_FORMAT (string).  Describes whether the Avro serialised data is in
+  /// binary or JSON format.  Valid options "BINARY" or "JSON", default
+  /// "BINARY".
+  ///
+  /// * DECODE_OFFSET (long).  Offset into each message that decoding should
+  /// begin from.  Default 0. 
+  ///
+  /// * CONTINUE_ON_ERROR (long).  If non-zero messages which fail to decode are
+  /// skipped rather than causing the whole call to fail and the result is
+  /// returned together with a table detailing the failures.  Default 0.
+  ///
+  /// * MULTITHREADED (long).  By default avrokdb is optimised to reuse the
+  /// existing decoder for this schema.  However, Avro decoders do not support
+  /// concurrent access and therefore if running decode with peach this option
+  /// must be set to non-zero to disable this optimisation.  Default 0.
+  ///
+  /// * FILTER (list).  A (op; field; value) predicate on a top level field of
+  /// the record, or a list of them which must all be satisfied.  Only
+  /// messages matching the filter are decoded, with each message read only as
+  /// far as the fields needed to evaluate it.  Requires a record schema and
+  /// BINARY format.
+  ///
+  /// * THREADS (long).  Maximum number of threads used to decode BINARY
+  /// messages, 1 decodes every message on the calling thread.  Default 0, use
+  /// every thread of the pool.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema to use for
+  /// decoding. 
+  ///
+  /// @param data.  Mixed list of 4h or 10h lists, each containing one Avro
+  /// serialised datum.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Table or mixed list of the decoded messages.  If CONTINUE_ON_ERROR
+  /// is set, a two item mixed list of (decoded messages; errors) where errors
+  /// is a ([] index; offset; message) table of the messages which failed.
+  EXP K DecodeBatch(K schema, K data, K options);
 }
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <sstream>
 
 #include <avro/ValidSchema.hh>
@@ -11,9 +14,13 @@
 #include "HelperFunctions.h"
 #include "Schema.h"
 #include "Encode.h"
+#include "JsonEncode.h"
+#include "SingleObject.h"
 #include "TypeCheck.h"
 #include "KdbOptions.h"
 #include "GenericForeign.h"
+#include "ThreadPool.h"
+#include "MemoryStats.h"
 
 
 void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K data);
@@ -71,11 +78,8 @@ void EncodeDatum(const std::string& field, avro::GenericDatum& avro_datum, K dat
   {
     if (logical_type.type() == avro::LogicalType::DECIMAL)
       avro_datum.value<std::vector<uint8_t>>() = DecimalToBytes(field, avro_type, logical_type, data);
-    else {
-      std::vector<uint8_t> bytes(data->n);
-      std::memcpy(bytes.data(), kG(data), data->n);
-      avro_datum.value<std::vector<uint8_t>>() = bytes;
-    }
+    else
+      avro_datum.value<std::vector<uint8_t>>().assign(kG(data), kG(data) + data->n);
     break;
   }
   case avro::AVRO_DOUBLE:
@@ -96,10 +100,7 @@ void EncodeDatum(const std::string& field, avro::GenericDatum& avro_datum, K dat
     else {
       TYPE_CHECK_FIXED(field, fixed_size, (size_t)data->n);
 
-      std::vector<uint8_t> fixed;
-      fixed.resize(data->n);
-      std::memcpy(fixed.data(), kG(data), data->n);
-      avro_fixed.value() = fixed;
+      avro_fixed.value().assign(kG(data), kG(data) + data->n);
     }
     break;
   }
@@ -133,7 +134,7 @@ void EncodeDatum(const std::string& field, avro::GenericDatum& avro_datum, K dat
     if (logical_type.type() == avro::LogicalType::UUID)
       avro_datum.value<std::string>() = GuidToString(*(U*)kG(data));
     else
-      avro_datum.value<std::string>() = std::string((char*)kG(data), data->n);
+      avro_datum.value<std::string>().assign((char*)kG(data), data->n);
     break;
   }
   case avro::AVRO_RECORD:
@@ -167,6 +168,195 @@ void EncodeDatum(const std::string& field, avro::GenericDatum& avro_datum, K dat
   }
 }
 
+// Whether the item at the specified row of a simple column is a kdb+ null
+bool IsKdbNull(K column, size_t row)
+{
+  switch (column->t) {
+  case KF:
+    return std::isnan(kF(column)[row]);
+  case KE:
+    return std::isnan(kE(column)[row]);
+  case KS:
+    return kS(column)[row][0] == '\0';
+  case UU:
+  {
+    const auto& guid = kU(column)[row].g;
+    return std::all_of(guid, guid + sizeof(kU(column)[row].g), [](G g) { return g == 0; });
+  }
+  case KJ:
+  case KP:
+  case KN:
+    return kJ(column)[row] == nj;
+  case KI:
+  case KM:
+  case KD:
+  case KU:
+  case KV:
+  case KT:
+    return kI(column)[row] == ni;
+  default:
+    return false;
+  }
+}
+
+void EncodeColumnItem(const ExportColumn& column, avro::GenericDatum& avro_datum, size_t row)
+{
+  K data = column.data;
+  if (data->t == 0)
+    return EncodeDatum(column.name, avro_datum, kK(data)[row], false);
+
+  if (column.value_branch >= 0) {
+    if (IsKdbNull(data, row)) {
+      avro_datum.selectBranch(column.null_branch);
+      return;
+    }
+    avro_datum.selectBranch(column.value_branch);
+  }
+
+  switch (column.type) {
+  case avro::AVRO_BOOL:
+    avro_datum.value<bool>() = (bool)kG(data)[row];
+    break;
+  case avro::AVRO_DOUBLE:
+    avro_datum.value<double>() = kF(data)[row];
+    break;
+  case avro::AVRO_ENUM:
+    avro_datum.value<avro::GenericEnum>().set(kS(data)[row]);
+    break;
+  case avro::AVRO_FLOAT:
+    avro_datum.value<float>() = kE(data)[row];
+    break;
+  case avro::AVRO_INT:
+    avro_datum.value<int32_t>() = column.temporal ? column.temporal->KdbToAvro(kI(data)[row]) : kI(data)[row];
+    break;
+  case avro::AVRO_LONG:
+    avro_datum.value<int64_t>() = column.temporal ? column.temporal->KdbToAvro(kJ(data)[row]) : kJ(data)[row];
+    break;
+  case avro::AVRO_STRING:
+    if (data->t == KS)
+      avro_datum.value<std::string>() = kS(data)[row];
+    else
+      avro_datum.value<std::string>() = GuidToString(kU(data)[row]);
+    break;
+
+  default:
+    TYPE_CHECK_UNSUPPORTED(column.name, avro::toString(column.type));
+  }
+}
+
+// Resolve how a simple column's items are encoded, checking the column's type
+// against the field's once rather than for each item
+void SetColumnType(ExportColumn& column, const avro::NodePtr& field_schema)
+{
+  auto node = ResolveSymbolic(field_schema);
+  if (node->type() == avro::AVRO_UNION) {
+    if (node->leaves() != 2 || (node->leafAt(0)->type() != avro::AVRO_NULL && node->leafAt(1)->type() != avro::AVRO_NULL))
+      throw TypeCheck("Simple column '" + column.name + "' requires a union of null and one other type, otherwise use a mixed list of (branch; value)");
+    column.null_branch = node->leafAt(0)->type() == avro::AVRO_NULL ? 0 : 1;
+    column.value_branch = 1 - column.null_branch;
+    node = ResolveSymbolic(node->leafAt(column.value_branch));
+  }
+
+  column.type = node->type();
+  const auto logical_type = node->logicalType().type();
+  if (column.type != avro::AVRO_STRING || logical_type != avro::LogicalType::NONE || column.data->t != KS)
+    TYPE_CHECK_ARRAY(column.name, avro::toString(column.type), GetKdbArrayType(column.type, logical_type), column.data->t);
+
+  if ((column.type == avro::AVRO_INT && (logical_type == avro::LogicalType::DATE || logical_type == avro::LogicalType::TIME_MILLIS)) ||
+    (column.type == avro::AVRO_LONG && (logical_type == avro::LogicalType::TIME_MICROS || logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS)))
+    column.temporal = std::make_shared<TemporalConversion>(column.name, logical_type);
+}
+
+std::vector<ExportColumn> GetExportColumns(const avro::NodePtr& record, K table, std::vector<K>& refs)
+{
+  K keys = kK(table->k)[0];
+  K values = kK(table->k)[1];
+
+  std::vector<ExportColumn> columns;
+  for (size_t i = 0; i < record->leaves(); ++i) {
+    const auto& name = record->nameAt(i);
+    K data = NULL;
+    for (auto j = 0; j < keys->n; ++j) {
+      if (name == kS(keys)[j])
+        data = kK(values)[j];
+    }
+    if (!data)
+      throw TypeCheck("Table has no column for field '" + name + "'");
+
+    ExportColumn column = { name, data, NULL, avro::AVRO_UNKNOWN, -1, -1, nullptr };
+    if (data->t >= 20 && data->t <= 76) {
+      if (ResolveSymbolic(record->leafAt(i))->type() != avro::AVRO_ENUM)
+        throw TypeCheck("Enumerated column '" + name + "' requires an enum field");
+      column.domain = Evaluate("Cannot resolve domain of column '" + name + "'", "{value key x}", r1(data));
+      refs.push_back(column.domain);
+      if (column.domain->t != KS)
+        throw TypeCheck("Domain of column '" + name + "' not 11h");
+    } else if (data->t > 0) {
+      SetColumnType(column, record->leafAt(i));
+    }
+    columns.push_back(column);
+  }
+  return columns;
+}
+
+std::vector<uint8_t> EncodeRows(const avro::ValidSchema& schema, const std::vector<ExportColumn>& columns, size_t begin, size_t end, std::vector<size_t>* row_ends)
+{
+  VectorOutputStream ostream(64 * 1024);
+  auto encoder = avro::binaryEncoder();
+  encoder->init(ostream);
+
+  avro::GenericDatum datum(schema);
+  auto& record = datum.value<avro::GenericRecord>();
+  for (auto row = begin; row < end; ++row) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      const auto& column = columns[i];
+      auto& field = record.fieldAt(i);
+      if (column.domain) {
+        const auto index = kJ(column.data)[row];
+        if (index < 0 || index >= column.domain->n)
+          throw TypeCheck("Column '" + column.name + "' enumeration index out of range of its domain");
+        field.value<avro::GenericEnum>().set(kS(column.domain)[index]);
+      } else {
+        EncodeColumnItem(column, field, row);
+      }
+    }
+    avro::encode(*encoder, datum);
+    if (row_ends) {
+      // The encoder buffers its output so must be flushed for the stream's
+      // byte count to include this row
+      encoder->flush();
+      row_ends->push_back(ostream.byteCount());
+    }
+  }
+  encoder->flush();
+
+  return ostream.Release();
+}
+
+// Resize the elements of an array to n.  Existing elements are kept so that,
+// when a pooled datum is encoded again, their storage is overwritten in place.
+void ResizeElements(std::vector<avro::GenericDatum>& elements, const avro::NodePtr& schema, size_t n)
+{
+  if (elements.size() > n) {
+    elements.erase(elements.begin() + n, elements.end());
+  } else {
+    elements.reserve(n);
+    while (elements.size() < n)
+      elements.emplace_back(schema);
+  }
+}
+
+void ResizeElements(std::vector<std::pair<std::string, avro::GenericDatum>>& entries, const avro::NodePtr& schema, size_t n)
+{
+  if (entries.size() > n) {
+    entries.erase(entries.begin() + n, entries.end());
+  } else {
+    entries.reserve(n);
+    while (entries.size() < n)
+      entries.emplace_back(std::string(), avro::GenericDatum(schema));
+  }
+}
+
 void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K data)
 {
   assert(avro_array.schema()->leaves() == 1);
@@ -175,11 +365,13 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
   auto array_logical_type = array_schema->logicalType();
   auto& array_data = avro_array.value();
 
+  ResizeElements(array_data, array_schema, data->n);
+
   switch (array_type) {
   case avro::AVRO_BOOL:
   {
     for (auto i = 0; i < data->n; ++i)
-      array_data.emplace_back(std::move(avro::GenericDatum((bool)kG(data)[i])));
+      array_data[i].value<bool>() = (bool)kG(data)[i];
     break;
   }
   case avro::AVRO_BYTES:
@@ -188,15 +380,13 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
       for (auto i = 0; i < data->n; ++i) {
         K k_bytes = kK(data)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(array_type), 0, k_bytes->t);
-        array_data.emplace_back(std::move(avro::GenericDatum(DecimalToBytes(field, array_type, array_logical_type, k_bytes))));
+        array_data[i].value<std::vector<uint8_t>>() = DecimalToBytes(field, array_type, array_logical_type, k_bytes);
       }
     } else {
       for (auto i = 0; i < data->n; ++i) {
         K k_bytes = kK(data)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(array_type), KG, k_bytes->t);
-        std::vector<uint8_t> bytes(k_bytes->n);
-        std::memcpy(bytes.data(), kG(k_bytes), k_bytes->n);
-        array_data.emplace_back(std::move(avro::GenericDatum(bytes)));
+        array_data[i].value<std::vector<uint8_t>>().assign(kG(k_bytes), kG(k_bytes) + k_bytes->n);
       }
     }
     break;
@@ -204,13 +394,13 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
   case avro::AVRO_DOUBLE:
   {
     for (auto i = 0; i < data->n; ++i)
-      array_data.emplace_back(std::move(avro::GenericDatum(kF(data)[i])));
+      array_data[i].value<double>() = kF(data)[i];
     break;
   }
   case avro::AVRO_ENUM:
   {
     for (auto i = 0; i < data->n; ++i)
-      array_data.emplace_back(std::move(avro::GenericDatum(array_schema, avro::GenericEnum(array_schema, kS(data)[i]))));
+      array_data[i].value<avro::GenericEnum>().set(kS(data)[i]);
     break;
   }
   case avro::AVRO_FIXED:
@@ -219,13 +409,13 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
       for (auto i = 0; i < data->n; ++i) {
         K k_bytes = kK(data)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(array_type), 0, k_bytes->t);
-        array_data.emplace_back(std::move(avro::GenericDatum(array_schema, avro::GenericFixed(array_schema, DecimalToBytes(field, array_type, array_logical_type, k_bytes)))));
+        array_data[i].value<avro::GenericFixed>().value() = DecimalToBytes(field, array_type, array_logical_type, k_bytes);
       }
     } else if (array_logical_type.type() == avro::LogicalType::DURATION) {
       for (auto i = 0; i < data->n; ++i) {
         K k_bytes = kK(data)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(array_type), KI, k_bytes->t);
-        array_data.emplace_back(std::move(avro::GenericDatum(array_schema, avro::GenericFixed(array_schema, DurationToBytes(field, array_type, k_bytes)))));
+        array_data[i].value<avro::GenericFixed>().value() = DurationToBytes(field, array_type, k_bytes);
       }
     } else {
       for (auto i = 0; i < data->n; ++i) {
@@ -233,10 +423,7 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
         const auto fixed_size = array_schema->fixedSize();
         TYPE_CHECK_FIXED(field, fixed_size, (size_t)k_bytes->n);
 
-        std::vector<uint8_t> fixed;
-        fixed.resize(k_bytes->n);
-        std::memcpy(fixed.data(), kG(k_bytes), k_bytes->n);
-        array_data.emplace_back(std::move(avro::GenericDatum(array_schema, avro::GenericFixed(array_schema, fixed))));
+        array_data[i].value<avro::GenericFixed>().value().assign(kG(k_bytes), kG(k_bytes) + k_bytes->n);
       }
     }
     break;
@@ -244,7 +431,7 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
   case avro::AVRO_FLOAT:
   {
     for (auto i = 0; i < data->n; ++i)
-      array_data.emplace_back(std::move(avro::GenericDatum(kE(data)[i])));
+      array_data[i].value<float>() = kE(data)[i];
     break;
   }
   case avro::AVRO_INT:
@@ -252,10 +439,10 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
     if (array_logical_type.type() == avro::LogicalType::DATE || array_logical_type.type() == avro::LogicalType::TIME_MILLIS) {
       TemporalConversion tc(field, array_logical_type.type());
       for (auto i = 0; i < data->n; ++i)
-        array_data.emplace_back(std::move(avro::GenericDatum(tc.KdbToAvro(kI(data)[i]))));
+        array_data[i].value<int32_t>() = tc.KdbToAvro(kI(data)[i]);
     } else {
       for (auto i = 0; i < data->n; ++i)
-        array_data.emplace_back(std::move(avro::GenericDatum(kI(data)[i])));
+        array_data[i].value<int32_t>() = kI(data)[i];
     }
     break;
   }
@@ -264,10 +451,10 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
     if (array_logical_type.type() == avro::LogicalType::TIME_MICROS || array_logical_type.type() == avro::LogicalType::TIMESTAMP_MILLIS || array_logical_type.type() == avro::LogicalType::TIMESTAMP_MICROS) {
        TemporalConversion tc(field, array_logical_type.type());
       for (auto i = 0; i < data->n; ++i)
-        array_data.emplace_back(std::move(avro::GenericDatum(tc.KdbToAvro<int64_t>(kJ(data)[i]))));
+        array_data[i].value<int64_t>() = tc.KdbToAvro<int64_t>(kJ(data)[i]);
     } else {
       for (auto i = 0; i < data->n; ++i)
-        array_data.emplace_back(std::move(avro::GenericDatum((int64_t)kJ(data)[i])));
+        array_data[i].value<int64_t>() = (int64_t)kJ(data)[i];
     }
     break;
   }
@@ -276,7 +463,6 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
     for (auto i = 0; i < data->n; ++i) {
       K k_value = kK(data)[i];
       TYPE_CHECK_ARRAY(field, avro::toString(array_type), 101, k_value->t);
-      array_data.emplace_back(std::move(avro::GenericDatum()));
     }
     break;
   }
@@ -285,13 +471,13 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
     if (array_logical_type.type() == avro::LogicalType::UUID) {
       for (auto i = 0; i < data->n; ++i) {
         U k_uuid = kU(data)[i];
-        array_data.emplace_back(std::move(avro::GenericDatum(GuidToString(k_uuid))));
+        array_data[i].value<std::string>() = GuidToString(k_uuid);
       }
     } else {
       for (auto i = 0; i < data->n; ++i) {
         K k_string = kK(data)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(array_type), KC, k_string->t);
-        array_data.emplace_back(std::move(avro::GenericDatum(std::string((char*)kG(k_string), k_string->n))));
+        array_data[i].value<std::string>().assign((char*)kG(k_string), k_string->n);
       }
     }
     break;
@@ -306,24 +492,22 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
       auto sub_array_type = GetKdbArrayType(sub_array->leafAt(0)->type(), sub_array->leafAt(0)->logicalType().type());
       TYPE_CHECK_ARRAY(field, avro::toString(sub_array->type()), sub_array_type, k_array->t);
 
-      auto array_datum = avro::GenericArray(sub_array);
-      EncodeArray(field, array_datum, k_array);
-      array_data.emplace_back(std::move(avro::GenericDatum(sub_array, array_datum)));
+      EncodeArray(field, array_data[i].value<avro::GenericArray>(), k_array);
     }
     break;
   }
   case avro::AVRO_RECORD:
   {
+    size_t count = 0;
     for (auto i = 0; i < data->n; ++i) {
       K k_record = kK(data)[i];
       if (k_record->t == 101)
         continue;
       TYPE_CHECK_ARRAY(field, avro::toString(array_type), 99, k_record->t);
 
-      auto record_datum = avro::GenericRecord(array_schema);
-      EncodeRecord(field,  record_datum, k_record);
-      array_data.emplace_back(std::move(avro::GenericDatum(array_schema, record_datum)));
+      EncodeRecord(field, array_data[count++].value<avro::GenericRecord>(), k_record);
     }
+    ResizeElements(array_data, array_schema, count);
     break;
   }
   case avro::AVRO_UNION:
@@ -332,24 +516,22 @@ void EncodeArray(const std::string& field, avro::GenericArray& avro_array, K dat
       K k_union = kK(data)[i];
       TYPE_CHECK_ARRAY(field, avro::toString(array_type), 0, k_union->t);
 
-      auto union_datum = avro::GenericDatum(array_schema);
-      EncodeUnion(field, union_datum, k_union);
-      array_data.emplace_back(std::move(union_datum));
+      EncodeUnion(field, array_data[i], k_union);
     }
     break;
   }
   case avro::AVRO_MAP:
   {
+    size_t count = 0;
     for (auto i = 0; i < data->n; ++i) {
       K k_map = kK(data)[i];
       if (k_map->t == 101)
         continue;
       TYPE_CHECK_ARRAY(field, avro::toString(array_type), 99, k_map->t);
 
-      auto map_datum = avro::GenericMap(array_schema);
-      EncodeMap(field, map_datum, k_map);
-      array_data.emplace_back(std::move(avro::GenericDatum(array_schema, map_datum)));
+      EncodeMap(field, array_data[count++].value<avro::GenericMap>(), k_map);
     }
+    ResizeElements(array_data, array_schema, count);
     break;
   }
 
@@ -368,14 +550,23 @@ void EncodeRecord(const std::string& field, avro::GenericRecord& record, K data)
   TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_RECORD), "dict values", 0, values->t);
   assert(keys->n == values->n);
 
+  std::vector<bool> assigned(record.fieldCount());
   for (auto i = 0; i < keys->n; ++i) {
     const std::string key = kS(keys)[i];
     K value = kK(values)[i];
     if (key == "" && value->t == 101)
       continue;
 
-    auto& next = record.field(key);
-    EncodeDatum(key, next, value, false);
+    const auto index = record.fieldIndex(key);
+    assigned[index] = true;
+    EncodeDatum(key, record.fieldAt(index), value, false);
+  }
+
+  // A pooled record still holds the values from its last use so any fields
+  // missing from the dictionary are reset to their initial values
+  for (size_t i = 0; i < assigned.size(); ++i) {
+    if (!assigned[i])
+      record.fieldAt(i) = avro::GenericDatum(record.schema()->leafAt(i));
   }
 }
 
@@ -392,11 +583,15 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
   auto map_logical_type = map_schema->logicalType();
   auto& map_data = avro_map.value();
 
+  ResizeElements(map_data, map_schema, values->n);
+  for (auto i = 0; i < keys->n; ++i)
+    map_data[i].first = kS(keys)[i];
+
   switch (map_type) {
   case avro::AVRO_BOOL:
   {
     for (auto i = 0; i < values->n; ++i)
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum((bool)kG(values)[i]))));
+      map_data[i].second.value<bool>() = (bool)kG(values)[i];
     break;
   }
   case avro::AVRO_BYTES:
@@ -405,15 +600,13 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
       for (auto i = 0; i < values->n; ++i) {
         K k_bytes = kK(values)[i];
         TYPE_CHECK_MAP(field, avro::toString(map_type), 0, k_bytes->t);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(DecimalToBytes(field, map_type, map_logical_type, k_bytes)))));
+        map_data[i].second.value<std::vector<uint8_t>>() = DecimalToBytes(field, map_type, map_logical_type, k_bytes);
       }
     } else {
       for (auto i = 0; i < values->n; ++i) {
         K k_bytes = kK(values)[i];
         TYPE_CHECK_MAP(field, avro::toString(map_type), KG, k_bytes->t);
-        std::vector<uint8_t> bytes(k_bytes->n);
-        std::memcpy(bytes.data(), kG(k_bytes), k_bytes->n);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(bytes))));
+        map_data[i].second.value<std::vector<uint8_t>>().assign(kG(k_bytes), kG(k_bytes) + k_bytes->n);
       }
     }
     break;
@@ -421,13 +614,13 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
   case avro::AVRO_DOUBLE:
   {
     for (auto i = 0; i < values->n; ++i)
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(kF(values)[i]))));
+      map_data[i].second.value<double>() = kF(values)[i];
     break;
   }
   case avro::AVRO_ENUM:
   {
     for (auto i = 0; i < values->n; ++i)
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, avro::GenericEnum(map_schema, kS(values)[i])))));
+      map_data[i].second.value<avro::GenericEnum>().set(kS(values)[i]);
     break;
   }
   case avro::AVRO_FIXED:
@@ -436,13 +629,13 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
       for (auto i = 0; i < values->n; ++i) {
         K k_bytes = kK(values)[i];
         TYPE_CHECK_MAP(field, avro::toString(map_type), 0, k_bytes->t);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, avro::GenericFixed(map_schema, DecimalToBytes(field, map_type, map_logical_type, k_bytes))))));
+        map_data[i].second.value<avro::GenericFixed>().value() = DecimalToBytes(field, map_type, map_logical_type, k_bytes);
       }
     } else if (map_logical_type.type() == avro::LogicalType::DURATION) {
       for (auto i = 0; i < values->n; ++i) {
         K k_bytes = kK(values)[i];
         TYPE_CHECK_MAP(field, avro::toString(map_type), KI, k_bytes->t);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, avro::GenericFixed(map_schema, DurationToBytes(field, map_type, k_bytes))))));
+        map_data[i].second.value<avro::GenericFixed>().value() = DurationToBytes(field, map_type, k_bytes);
       }
     } else {
       for (auto i = 0; i < values->n; ++i) {
@@ -450,10 +643,7 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
         const auto fixed_size = map_schema->fixedSize();
         TYPE_CHECK_FIXED(field, fixed_size, (size_t)k_bytes->n);
 
-        std::vector<uint8_t> fixed;
-        fixed.resize(k_bytes->n);
-        std::memcpy(fixed.data(), kG(k_bytes), k_bytes->n);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, avro::GenericFixed(map_schema, fixed)))));
+        map_data[i].second.value<avro::GenericFixed>().value().assign(kG(k_bytes), kG(k_bytes) + k_bytes->n);
       }
     }
     break;
@@ -461,7 +651,7 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
   case avro::AVRO_FLOAT:
   {
     for (auto i = 0; i < values->n; ++i)
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(kE(values)[i]))));
+      map_data[i].second.value<float>() = kE(values)[i];
     break;
   }
   case avro::AVRO_INT:
@@ -469,10 +659,10 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
     if (map_logical_type.type() == avro::LogicalType::DATE || map_logical_type.type() == avro::LogicalType::TIME_MILLIS) {
       TemporalConversion tc(field, map_logical_type.type());
       for (auto i = 0; i < values->n; ++i)
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(tc.KdbToAvro(kI(values)[i])))));
+        map_data[i].second.value<int32_t>() = tc.KdbToAvro(kI(values)[i]);
     } else {
       for (auto i = 0; i < values->n; ++i)
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(kI(values)[i]))));
+        map_data[i].second.value<int32_t>() = kI(values)[i];
     }
     break;
   }
@@ -481,10 +671,10 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
     if (map_logical_type.type() == avro::LogicalType::TIME_MICROS || map_logical_type.type() == avro::LogicalType::TIMESTAMP_MILLIS || map_logical_type.type() == avro::LogicalType::TIMESTAMP_MICROS) {
       TemporalConversion tc(field, map_logical_type.type());
       for (auto i = 0; i < values->n; ++i)
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(tc.KdbToAvro<int64_t>(kJ(values)[i])))));
+        map_data[i].second.value<int64_t>() = tc.KdbToAvro<int64_t>(kJ(values)[i]);
     } else {
       for (auto i = 0; i < values->n; ++i)
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum((int64_t)kJ(values)[i]))));
+        map_data[i].second.value<int64_t>() = (int64_t)kJ(values)[i];
     }
     break;
   }
@@ -493,7 +683,6 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
     for (auto i = 0; i < values->n; ++i) {
       K k_value = kK(values)[i];
       TYPE_CHECK_MAP(field, avro::toString(map_type), 101, k_value->t);
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum())));
     }
     break;
   }
@@ -502,13 +691,13 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
     if (map_logical_type.type() == avro::LogicalType::UUID) {
       for (auto i = 0; i < values->n; ++i) {
         U k_uuid = kU(values)[i];
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(GuidToString(k_uuid)))));
+        map_data[i].second.value<std::string>() = GuidToString(k_uuid);
       }
     } else {
       for (auto i = 0; i < values->n; ++i) {
         K k_string = kK(values)[i];
         TYPE_CHECK_ARRAY(field, avro::toString(map_type), KC, k_string->t);
-        map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(std::string((char*)kG(k_string), k_string->n)))));
+        map_data[i].second.value<std::string>().assign((char*)kG(k_string), k_string->n);
       }
     }
     break;
@@ -523,24 +712,23 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
       auto sub_map_type = GetKdbArrayType(sub_array->leafAt(0)->type(), sub_array->leafAt(0)->logicalType().type());
       TYPE_CHECK_MAP(field, avro::toString(sub_array->type()), sub_map_type, k_array->t);
 
-      auto array_datum = avro::GenericArray(sub_array);
-      EncodeArray(field, array_datum, k_array);
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(sub_array, array_datum))));
+      EncodeArray(field, map_data[i].second.value<avro::GenericArray>(), k_array);
     }
     break;
   }
   case avro::AVRO_RECORD:
   {
+    size_t count = 0;
     for (auto i = 0; i < values->n; ++i) {
       K k_record = kK(values)[i];
       if (k_record->t == 101)
         continue;
       TYPE_CHECK_MAP(field, avro::toString(map_type), 99, k_record->t);
 
-      auto record_datum = avro::GenericRecord(map_schema);
-      EncodeRecord(field, record_datum, k_record);
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, record_datum))));
+      map_data[count].first = kS(keys)[i];
+      EncodeRecord(field, map_data[count++].second.value<avro::GenericRecord>(), k_record);
     }
+    ResizeElements(map_data, map_schema, count);
     break;
   }
   case avro::AVRO_UNION:
@@ -549,24 +737,23 @@ void EncodeMap(const std::string& field, avro::GenericMap& avro_map, K data)
       K k_union = kK(values)[i];
       TYPE_CHECK_MAP(field, avro::toString(map_type), 0, k_union->t);
 
-      auto union_datum = avro::GenericDatum(map_schema);
-      EncodeUnion(field, union_datum, k_union);
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], union_datum)));
+      EncodeUnion(field, map_data[i].second, k_union);
     }
     break;
   }
   case avro::AVRO_MAP:
   {
+    size_t count = 0;
     for (auto i = 0; i < values->n; ++i) {
       K k_map = kK(values)[i];
       if (k_map->t == 101)
         continue;
       TYPE_CHECK_MAP(field, avro::toString(map_type), 99, k_map->t);
 
-      auto map_datum = avro::GenericMap(map_schema);
-      EncodeMap(field, map_datum, k_map);
-      map_data.emplace_back(std::move(std::pair<std::string, avro::GenericDatum>(kS(keys)[i], avro::GenericDatum(map_schema, map_datum))));
+      map_data[count].first = kS(keys)[i];
+      EncodeMap(field, map_data[count++].second.value<avro::GenericMap>(), k_map);
     }
+    ResizeElements(map_data, map_schema, count);
     break;
   }
 
@@ -601,9 +788,10 @@ public:
   std::vector<uint8_t*> data_;
   size_t available_;
   size_t byteCount_;
+  MemoryCharge charge_;
 
-  explicit KdbMemoryOutputStream(size_t chunkSize = 4 * 1024) : chunkSize_(chunkSize),
-    available_(0), byteCount_(0) {}
+  explicit KdbMemoryOutputStream(MemoryAccount* memory, size_t chunkSize = 4 * 1024) : chunkSize_(chunkSize),
+    available_(0), byteCount_(0), charge_(memory, MEMORY_ENCODE) {}
   ~KdbMemoryOutputStream() final {
     for (std::vector<uint8_t*>::const_iterator it = data_.begin();
       it != data_.end(); ++it) {
@@ -613,6 +801,7 @@ public:
 
   bool next(uint8_t** data, size_t* len) final {
     if (available_ == 0) {
+      charge_.Add(chunkSize_);
       data_.emplace_back(std::move(new uint8_t[chunkSize_]));
       available_ = chunkSize_;
     }
@@ -650,6 +839,66 @@ public:
   }
 };
 
+// Output stream which writes directly into a caller supplied kdb+ vector
+// rather than allocating its own chunks.  If the encoded datum doesn't fit in
+// the remaining space the excess is written to a scratch chunk and the overflow
+// is reported once encoding has completed, so that the encoder is always left
+// in a consistent state.
+class KdbBufferOutputStream : public avro::OutputStream {
+public:
+  uint8_t* buffer_;
+  const size_t capacity_;
+  size_t byteCount_;
+  uint8_t scratch_[4 * 1024];
+
+  KdbBufferOutputStream(uint8_t* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity),
+    byteCount_(0) {}
+
+  bool next(uint8_t** data, size_t* len) final {
+    if (byteCount_ < capacity_) {
+      *data = buffer_ + byteCount_;
+      *len = capacity_ - byteCount_;
+    } else {
+      *data = scratch_;
+      *len = sizeof(scratch_);
+    }
+    byteCount_ += *len;
+    return true;
+  }
+
+  void backup(size_t len) final {
+    byteCount_ -= len;
+  }
+
+  uint64_t byteCount() const final {
+    return byteCount_;
+  }
+
+  void flush() final {}
+
+  bool Overflow() const {
+    return byteCount_ > capacity_;
+  }
+};
+
+// Find the encoder to use.  Encoders don't support multithreaded use so if
+// running in this mode the encoder is created on the fly.  If running single
+// threaded we use the already created encoder in the foreign which is less
+// expensive.
+//
+// JSON is written by JsonAvroEncoder without an avro encoder, so only BINARY
+// needs one.
+avro::EncoderPtr GetEncoder(AvroForeign& avro_foreign, const std::string& avro_format, bool multithreaded)
+{
+  if (avro_format != "BINARY")
+    throw std::invalid_argument("Unsupported avro encoding type (should be BINARY, JSON or JSON_PRETTY)");
+
+  if (multithreaded)
+    return avro::validatingEncoder(*avro_foreign.schema.get(), avro::binaryEncoder());
+  else
+    return avro_foreign.BinaryEncoder();
+}
+
 K Encode(K schema, K data, K options)
 {
   KDB_EXCEPTION_TRY;
@@ -665,42 +914,33 @@ K Encode(K schema, K data, K options)
   int64_t multithreaded = 0;
   options_parser.GetIntOption(Options::MULTITHREADED, multithreaded);
 
-  // Find the encoder to use.  Encoders don't support multithreaded use so if
-  // running in this mode the encoder is created on the fly.  If running single
-  // threaded we use the already created encoder in the foreign which is less
-  // expensive.
-  avro::EncoderPtr encoder;
-  if (multithreaded) {
-    avro::EncoderPtr base_encoder;
-    if (avro_format == "BINARY")
-      base_encoder = avro::binaryEncoder();
-    else if (avro_format == "JSON")
-      base_encoder = avro::jsonEncoder(*avro_schema.get());
-    else if (avro_format == "JSON_PRETTY")
-      base_encoder = avro::jsonPrettyEncoder(*avro_schema.get());
-    else
-      return krr((S)"Unsupported avro encoding type (should be BINARY, JSON or JSON_PRETTY)");
+  int64_t single_object = 0;
+  options_parser.GetIntOption(Options::SINGLE_OBJECT, single_object);
+  if (single_object && avro_format != "BINARY")
+    return krr((S)"SINGLE_OBJECT requires BINARY avro format");
 
-    encoder = avro::validatingEncoder(*avro_schema.get(), base_encoder);
-  } else {
-    if (avro_format == "BINARY")
-      encoder = avro_foreign->binary_encoder;
-    else if (avro_format == "JSON")
-      encoder = avro_foreign->json_encoder;
-    else if (avro_format == "JSON_PRETTY")
-      encoder = avro_foreign->json_pretty_encoder;
-    else
-      return krr((S)"Unsupported avro encoding type (should be BINARY, JSON or JSON_PRETTY)");
+  // JSON is written directly from the kdb+ object without an intermediate
+  // datum
+  if (avro_format == "JSON" || avro_format == "JSON_PRETTY") {
+    KdbVectorOutputStream ostream(KC);
+    JsonAvroEncoder json_encoder(ostream, avro_format == "JSON_PRETTY");
+    json_encoder.Encode("", avro_schema->root(), data);
+    json_encoder.Flush();
+    return ostream.Release();
   }
 
-  auto datum = avro::GenericDatum(*avro_schema.get());
-  EncodeDatum("", datum, data, false);
+  avro::EncoderPtr encoder = GetEncoder(*avro_foreign.get(), avro_format, multithreaded);
 
-  KdbMemoryOutputStream ostream;
+  auto datum = avro_foreign->datums.Acquire();
+  EncodeDatum("", *datum, data, false);
+
+  KdbMemoryOutputStream ostream(avro_foreign->memory);
+  if (single_object)
+    WriteSingleObjectHeader(ostream, avro_foreign->fingerprint);
   encoder->init(ostream);
 
   avro::GenericWriter writer(*avro_schema.get(), encoder);
-  writer.write(datum);
+  writer.write(*datum);
 
   encoder->flush();
 
@@ -708,3 +948,173 @@ K Encode(K schema, K data, K options)
 
   KDB_EXCEPTION_CATCH;
 }
+
+K EncodeInto(K schema, K data, K buffer, K options)
+{
+  if (buffer->t != KG && buffer->t != KC)
+    return krr((S)"buffer not 4|10h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  auto avro_schema = avro_foreign->schema;
+
+  std::string avro_format = "BINARY";
+  options_parser.GetStringOption(Options::AVRO_FORMAT, avro_format);
+  if (buffer->t != (avro_format == "BINARY" ? KG : KC))
+    return krr((S)"buffer type does not match AVRO_FORMAT (should be 4h for BINARY, 10h for JSON)");
+
+  int64_t encode_offset = 0;
+  options_parser.GetIntOption(Options::ENCODE_OFFSET, encode_offset);
+  if (encode_offset < 0 || encode_offset > buffer->n)
+    return krr((S)"Encode offset is outside the bounds of the buffer");
+
+  int64_t multithreaded = 0;
+  options_parser.GetIntOption(Options::MULTITHREADED, multithreaded);
+
+  int64_t single_object = 0;
+  options_parser.GetIntOption(Options::SINGLE_OBJECT, single_object);
+  if (single_object && avro_format != "BINARY")
+    return krr((S)"SINGLE_OBJECT requires BINARY avro format");
+
+  const size_t available = buffer->n - encode_offset;
+  KdbBufferOutputStream ostream(kG(buffer) + encode_offset, available);
+  if (avro_format == "JSON" || avro_format == "JSON_PRETTY") {
+    JsonAvroEncoder json_encoder(ostream, avro_format == "JSON_PRETTY");
+    json_encoder.Encode("", avro_schema->root(), data);
+    json_encoder.Flush();
+  } else {
+    avro::EncoderPtr encoder = GetEncoder(*avro_foreign.get(), avro_format, multithreaded);
+
+    auto datum = avro_foreign->datums.Acquire();
+    EncodeDatum("", *datum, data, false);
+
+    if (single_object)
+      WriteSingleObjectHeader(ostream, avro_foreign->fingerprint);
+    encoder->init(ostream);
+
+    avro::GenericWriter writer(*avro_schema.get(), encoder);
+    writer.write(*datum);
+
+    encoder->flush();
+  }
+
+  if (ostream.Overflow())
+    throw std::length_error("Encode buffer too small, required: " + std::to_string(ostream.byteCount()) + ", available: " + std::to_string(available));
+
+  return kj(ostream.byteCount());
+
+  KDB_EXCEPTION_CATCH;
+}
+
+// Rows are handed out to the batch encoders in chunks of this many
+const size_t kBatchChunkSize = 256;
+
+// Encoded data of one chunk of rows, with the offset of the end of each row
+struct EncodedChunk
+{
+  std::vector<uint8_t> data;
+  std::vector<size_t> row_ends;
+};
+
+// Encode chunks of rows until there are none left, claiming the next chunk
+// from the shared counter.  The encoded chunks are charged to memory.
+void EncodeBatchChunks(const avro::ValidSchema& schema, const std::vector<ExportColumn>& columns, size_t rows, std::vector<EncodedChunk>& chunks, std::atomic<size_t>& next_chunk, std::atomic<bool>& stop, MemoryCharge& memory)
+{
+  while (!stop) {
+    const auto chunk = next_chunk++;
+    if (chunk >= chunks.size())
+      return;
+
+    const auto begin = chunk * kBatchChunkSize;
+    const auto end = std::min(rows, begin + kBatchChunkSize);
+    auto& result = chunks[chunk];
+    result.row_ends.reserve(end - begin);
+    try {
+      result.data = EncodeRows(schema, columns, begin, end, &result.row_ends);
+      memory.Add(result.data.capacity() + result.row_ends.capacity() * sizeof(size_t));
+    } catch (...) {
+      stop = true;
+      throw;
+    }
+  }
+}
+
+K EncodeBatch(K schema, K data, K options)
+{
+  if (data->t != XT)
+    return krr((S)"data not 98h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto& avro_schema = *avro_foreign->schema;
+  const auto root = ResolveSymbolic(avro_schema.root());
+  if (root->type() != avro::AVRO_RECORD)
+    return krr((S)"EncodeBatch requires a record schema");
+
+  int64_t single_object = 0;
+  options_parser.GetIntOption(Options::SINGLE_OBJECT, single_object);
+
+  int64_t threads = 0;
+  options_parser.GetIntOption(Options::THREADS, threads);
+  if (threads < 0)
+    return krr((S)"THREADS must be non-negative");
+
+  std::vector<K> refs;
+  std::vector<ExportColumn> columns;
+  std::vector<EncodedChunk> chunks;
+  MemoryCharge memory(avro_foreign->memory, MEMORY_ENCODE);
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<bool> stop(false);
+  std::deque<std::future<void>> pending;
+  try {
+    columns = GetExportColumns(root, data, refs);
+    const size_t rows = columns.empty() ? 0 : columns.front().data->n;
+    chunks.resize((rows + kBatchChunkSize - 1) / kBatchChunkSize);
+
+    // The calling thread is one of the encoders
+    auto& pool = ThreadPool::Shared();
+    const auto workers = std::min<size_t>(threads ? (size_t)threads : pool.Size(), chunks.size());
+    for (auto i = 1ull; i < workers; ++i)
+      pending.push_back(pool.Submit([&] { EncodeBatchChunks(avro_schema, columns, rows, chunks, next_chunk, stop, memory); }));
+    EncodeBatchChunks(avro_schema, columns, rows, chunks, next_chunk, stop, memory);
+    for (auto& future : pending)
+      future.get();
+    pending.clear();
+
+    VectorOutputStream header(kSingleObjectHeaderSize);
+    if (single_object)
+      WriteSingleObjectHeader(header, avro_foreign->fingerprint);
+    const auto prefix = header.Release();
+
+    K result = ktn(0, rows);
+    size_t row = 0;
+    for (const auto& chunk : chunks) {
+      size_t begin = 0;
+      for (const auto end : chunk.row_ends) {
+        K message = ktn(KG, prefix.size() + end - begin);
+        std::memcpy(kG(message), prefix.data(), prefix.size());
+        std::memcpy(kG(message) + prefix.size(), chunk.data.data() + begin, end - begin);
+        kK(result)[row++] = message;
+        begin = end;
+      }
+    }
+
+    for (auto ref : refs)
+      r0(ref);
+    return result;
+  } catch (...) {
+    stop = true;
+    WaitAll(pending);
+    for (auto ref : refs)
+      r0(ref);
+    throw;
+  }
+
+  KDB_EXCEPTION_CATCH;
+}
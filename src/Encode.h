@@ -1,5 +1,143 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <avro/GenericDatum.hh>
+#include <avro/Stream.hh>
+#include <avro/ValidSchema.hh>
+
+#include "HelperFunctions.h"
+
+
+// Convert a kdb+ decimal (precision; scale; bin_data) to its Avro bytes
+std::vector<uint8_t> DecimalToBytes(const std::string& field, avro::Type avro_type, const avro::LogicalType& logical_type, K data);
+
+// Convert a kdb+ duration (month day milli) to its Avro fixed
+std::vector<uint8_t> DurationToBytes(const std::string& field, avro::Type avro_type, K data);
+
+// Output stream which writes into a std::vector rather than kdb+ memory, so
+// can be used outside the main q thread
+class VectorOutputStream : public avro::OutputStream {
+public:
+  std::vector<uint8_t> data_;
+  size_t byteCount_;
+
+  explicit VectorOutputStream(size_t capacity = 4 * 1024) : data_(capacity), byteCount_(0) {}
+
+  bool next(uint8_t** data, size_t* len) final {
+    if (byteCount_ == data_.size())
+      data_.resize(data_.size() * 2);
+    *data = data_.data() + byteCount_;
+    *len = data_.size() - byteCount_;
+    byteCount_ = data_.size();
+    return true;
+  }
+
+  void backup(size_t len) final {
+    byteCount_ -= len;
+  }
+
+  uint64_t byteCount() const final {
+    return byteCount_;
+  }
+
+  void flush() final {}
+
+  // Discard the spare capacity beyond the bytes written and return them
+  std::vector<uint8_t> Release() {
+    data_.resize(byteCount_);
+    byteCount_ = 0;
+    return std::move(data_);
+  }
+};
+
+// Output stream which writes into a kdb+ vector, doubling its capacity when it
+// is full, so that the result doesn't have to be copied out of separate chunks
+class KdbVectorOutputStream : public avro::OutputStream {
+public:
+  K data_;
+  size_t byteCount_;
+
+  explicit KdbVectorOutputStream(int type, size_t capacity = 256) : data_(ktn(type, std::max<size_t>(capacity, 1))), byteCount_(0) {}
+  ~KdbVectorOutputStream() final {
+    if (data_)
+      r0(data_);
+  }
+
+  bool next(uint8_t** data, size_t* len) final {
+    if (byteCount_ == (size_t)data_->n) {
+      K grown = ktn(data_->t, data_->n * 2);
+      std::memcpy(kG(grown), kG(data_), byteCount_);
+      r0(data_);
+      data_ = grown;
+    }
+    *data = kG(data_) + byteCount_;
+    *len = data_->n - byteCount_;
+    byteCount_ = data_->n;
+    return true;
+  }
+
+  void backup(size_t len) final {
+    byteCount_ -= len;
+  }
+
+  uint64_t byteCount() const final {
+    return byteCount_;
+  }
+
+  void flush() final {}
+
+  // Return the vector, trimmed to the bytes written, transferring its ownership
+  // to the caller.  The stream must not be used afterwards.
+  K Release() {
+    K result = data_;
+    result->n = byteCount_;
+    data_ = nullptr;
+    return result;
+  }
+};
+
+// Table column used to encode a field of the record
+struct ExportColumn
+{
+  std::string name;
+  K data;
+  // Symbols of an enumerated column's domain, otherwise NULL
+  K domain;
+  // Datatype of a simple column's items, for an optional field that of its
+  // non-null branch
+  avro::Type type;
+  // For a simple column of an optional field, a union of null and one other
+  // type, the branches selected for null and non-null items.  Otherwise -1.
+  int null_branch;
+  int value_branch;
+  // Conversion of a temporal column's items, created once for the column
+  std::shared_ptr<TemporalConversion> temporal;
+};
+
+// Match the table's columns to the fields of the record, resolving the domain
+// of any enumerated columns.  The domains are added to refs.
+//
+// A simple column may also be used for an optional field, a union of null and
+// one other type, with its kdb+ nulls encoded as the null branch.  A string
+// field may be encoded from a symbol column.
+std::vector<ExportColumn> GetExportColumns(const avro::NodePtr& record, K table, std::vector<K>& refs);
+
+// Set a datum from the item at the specified row of a table column.  Simple
+// columns are read directly, avoiding the creation of a kdb+ atom for each
+// item, so this can be used outside the main q thread.
+void EncodeColumnItem(const ExportColumn& column, avro::GenericDatum& avro_datum, size_t row);
+
+// Encode a range of rows from the table's columns, returning their Avro
+// binary data back to back.  If row_ends is set the offset of the end of each
+// row's data is appended to it.  Only reads the columns so can be used outside
+// the main q thread.
+std::vector<uint8_t> EncodeRows(const avro::ValidSchema& schema, const std::vector<ExportColumn>& columns, size_t begin, size_t end, std::vector<size_t>* row_ends = nullptr);
+
 extern "C"
 {
   /// @brief Encode kdb+ object to Avro serialised data
@@ -14,6 +152,11 @@ extern "C"
   /// existing encoder for this schema.  However, Avro encoders do not support
   /// concurrent access and therefore if running encode with peach this option
   /// must be set to non-zero to disable this optimisation.  Default 0.
+  ///
+  /// * SINGLE_OBJECT (long).  If non-zero the datum is written using Avro
+  /// single object encoding, prefixed by the C3 01 marker and the 8 byte
+  /// CRC-64-AVRO fingerprint of the schema.  Requires BINARY format.  Default
+  /// 0.
   /// 
   /// @param schema.  Foreign object containing the Avro schema to use for
   /// encoding. 
@@ -28,4 +171,76 @@ extern "C"
   /// @return Avro serialised data, either 4h for binary encoding or 10h for
   /// JSON encoding.
   EXP K Encode(K schema, K data, K options);
+
+  /// @brief Encode kdb+ object to Avro serialised data, writing it into a
+  /// preallocated buffer rather than allocating a new one
+  ///
+  /// The buffer is modified in place.  Several datums can be written back to
+  /// back into the same buffer by setting ENCODE_OFFSET to the running total of
+  /// the bytes written so far.  If the buffer is too small an error is returned
+  /// and the contents of the buffer after ENCODE_OFFSET are undefined.
+  ///
+  /// Supported options:
+  ///
+  /// * AVRO_FORMAT (string).  Describes whether the kdb+ object should be
+  /// encoded into Avro binary or JSON format.  Valid options "BINARY", "JSON"
+  /// or "JSON_PRETTY", default "BINARY".
+  ///
+  /// * ENCODE_OFFSET (long).  Offset into the `buffer` that encoding should
+  /// begin from.  Default 0.
+  ///
+  /// * MULTITHREADED (long).  By default avrokdb is optimised to reuse the
+  /// existing encoder for this schema.  However, Avro encoders do not support
+  /// concurrent access and therefore if running encode with peach this option
+  /// must be set to non-zero to disable this optimisation.  Default 0.
+  ///
+  /// * SINGLE_OBJECT (long).  If non-zero the datum is written using Avro
+  /// single object encoding, as for Encode.  Default 0.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema to use for
+  /// encoding. 
+  ///
+  /// @param data.  Kdb+ object to encode.  Must adhere to the appropriate type
+  /// mapping for the schema.
+  ///
+  /// @param buffer.  Preallocated 4h (binary encoding) or 10h (JSON encoding)
+  /// list to write the Avro serialised data into.  The list is written in
+  /// place, bypassing q's copy on write, so the caller must own a unique copy
+  /// of it.  Any other variable sharing the same list sees the new contents.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Number of bytes written into the buffer.
+  EXP K EncodeInto(K schema, K data, K buffer, K options);
+
+  /// @brief Encode each row of a kdb+ table to Avro binary data
+  ///
+  /// Rows are encoded in parallel on avrokdb's thread pool.  Each thread has
+  /// its own encoder and output buffer and repeatedly claims the next chunk of
+  /// rows until none are left.  The kdb+ messages are created on the calling
+  /// thread once every row has been encoded.
+  ///
+  /// Supported options:
+  ///
+  /// * SINGLE_OBJECT (long).  If non-zero each message is written using Avro
+  /// single object encoding, as for Encode.  Default 0.
+  ///
+  /// * THREADS (long).  Maximum number of threads used to encode the rows, 1
+  /// encodes every row on the calling thread.  Default 0, use every thread of
+  /// the pool.
+  ///
+  /// @param schema.  Foreign object containing the Avro record schema to use
+  /// for encoding.  Each field is encoded from the table column of the same
+  /// name.
+  ///
+  /// @param data.  Kdb+ table to encode.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Mixed list of 4h lists, one for each row in row order
+  EXP K EncodeBatch(K schema, K data, K options);
 }
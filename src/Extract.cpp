@@ -0,0 +1,168 @@
+#include <avro/ValidSchema.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/Decoder.hh>
+#include <avro/Stream.hh>
+#include <avro/LogicalType.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Decode.h"
+#include "Extract.h"
+#include "BinaryCursor.h"
+#include "TypeCheck.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+// Scalar types which are read straight from the binary data into the result
+// vector.  Anything else is decoded via an avro::GenericDatum.
+bool IsDirectExtract(avro::Type type)
+{
+  switch (type) {
+  case avro::AVRO_BOOL:
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_FLOAT:
+  case avro::AVRO_DOUBLE:
+  case avro::AVRO_ENUM:
+  case avro::AVRO_STRING:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void ExtractDirect(const std::string& field, const avro::NodePtr& node, BinaryCursor& cursor, K result, size_t index)
+{
+  const auto logical_type = node->logicalType().type();
+
+  switch (node->type()) {
+  case avro::AVRO_BOOL:
+    kG(result)[index] = *cursor.Read(1) != 0;
+    break;
+  case avro::AVRO_INT:
+  {
+    const auto value = cursor.ReadInt();
+    if (logical_type == avro::LogicalType::DATE || logical_type == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(field, logical_type);
+      kI(result)[index] = tc.AvroToKdb(value);
+    } else {
+      kI(result)[index] = value;
+    }
+    break;
+  }
+  case avro::AVRO_LONG:
+  {
+    const auto value = cursor.ReadLong();
+    if (logical_type == avro::LogicalType::TIME_MICROS || logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(field, logical_type);
+      kJ(result)[index] = tc.AvroToKdb(value);
+    } else {
+      kJ(result)[index] = value;
+    }
+    break;
+  }
+  case avro::AVRO_FLOAT:
+    std::memcpy(&kE(result)[index], cursor.Read(sizeof(float)), sizeof(float));
+    break;
+  case avro::AVRO_DOUBLE:
+    std::memcpy(&kF(result)[index], cursor.Read(sizeof(double)), sizeof(double));
+    break;
+  case avro::AVRO_ENUM:
+  {
+    const auto symbol = cursor.ReadLong();
+    if (symbol < 0 || (size_t)symbol >= node->names())
+      throw BinaryCursor::InvalidData("Invalid enum symbol index: " + std::to_string(symbol));
+    kS(result)[index] = ss((S)node->nameAt(symbol).c_str());
+    break;
+  }
+  case avro::AVRO_STRING:
+  {
+    const auto length = cursor.ReadLength();
+    const auto string = cursor.Read(length);
+    if (logical_type == avro::LogicalType::UUID) {
+      TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_STRING), "avro uuid length", 36, length);
+      kU(result)[index] = StringToGuid(std::string((const char*)string, length));
+    } else {
+      K k_string = ktn(KC, length);
+      std::memcpy(kG(k_string), string, length);
+      kK(result)[index] = k_string;
+    }
+    break;
+  }
+
+  default:
+    TYPE_CHECK_UNSUPPORTED(field, avro::toString(node->type()));
+  }
+}
+
+K Extract(K schema, K data, K path, K options)
+{
+  if (data->t != 0)
+    return krr((S)"data not 0h");
+  if (path->t != -KS)
+    return krr((S)"path not -11h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto& root = avro_foreign->schema->root();
+
+  int64_t decode_offset = 0;
+  options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
+
+  const FieldPath field_path(root, path->s);
+  const auto node = ResolveSymbolic(field_path.schema);
+
+  if (IsDirectExtract(node->type())) {
+    K result = ktn(GetKdbArrayType(node->type(), node->logicalType().type()), data->n);
+    if (result->t == 0) {
+      for (auto i = 0; i < data->n; ++i)
+        kK(result)[i] = Identity();
+    }
+    try {
+      for (auto i = 0; i < data->n; ++i) {
+        K message = kK(data)[i];
+        TYPE_CHECK_ARRAY(field_path.path, "message", KG, message->t);
+        BinaryCursor cursor((const uint8_t*)kG(message), message->n);
+        cursor.Seek(decode_offset);
+        cursor.SkipToField(root, field_path);
+        if (result->t == 0)
+          r0(kK(result)[i]);
+        ExtractDirect(field_path.path, node, cursor, result, i);
+      }
+    } catch (...) {
+      r0(result);
+      throw;
+    }
+    return result;
+  }
+
+  // Complex types are decoded using the avro decoder, but only from the start
+  // of the field
+  std::vector<avro::GenericDatum> values;
+  values.reserve(data->n);
+  auto decoder = avro::binaryDecoder();
+  for (auto i = 0; i < data->n; ++i) {
+    K message = kK(data)[i];
+    TYPE_CHECK_ARRAY(field_path.path, "message", KG, message->t);
+    BinaryCursor cursor((const uint8_t*)kG(message), message->n);
+    cursor.Seek(decode_offset);
+    cursor.SkipToField(root, field_path);
+
+    auto istream = avro::memoryInputStream((const uint8_t*)kG(message) + cursor.Offset(), cursor.Remaining());
+    decoder->init(*istream);
+    avro::GenericDatum datum(field_path.schema);
+    avro::GenericReader::read(*decoder, datum);
+    values.emplace_back(std::move(datum));
+  }
+
+  return DecodeList(field_path.path, field_path.schema, values, false);
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+extern "C"
+{
+  /// @brief Extract a single field from each of a list of Avro binary
+  /// serialised records without decoding the rest of the record
+  ///
+  /// The binary data of each message is skipped over up to the requested
+  /// field, which is then decoded directly into the result.  Fields which
+  /// follow it are never read.
+  ///
+  /// Supported options:
+  ///
+  /// * DECODE_OFFSET (long).  Offset into each message that decoding should
+  /// begin from.  Default 0.
+  ///
+  /// @param schema.  Foreign object containing the Avro record schema.
+  ///
+  /// @param data.  Mixed list of 4h lists, each containing one Avro binary
+  /// serialised record.
+  ///
+  /// @param path.  Symbol containing the dot separated path to the field,
+  /// descending through nested records (e.g. `a.b.c).
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return kdb+ list of the field's values, following the type mapping used
+  /// for an array of the field's datatype.
+  EXP K Extract(K schema, K data, K path, K options);
+}
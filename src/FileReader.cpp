@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+
+#include <avro/DataFile.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/Exception.hh>
+
+#include "HelperFunctions.h"
+#include "Decode.h"
+#include "FileReader.h"
+#include "BlockIndex.h"
+#include "KdbOptions.h"
+#include "ThreadPool.h"
+#include "Schema.h"
+#include "GenericForeign.h"
+#include "Fingerprint.h"
+#include "MemoryStats.h"
+
+
+FileReader::FileReader(std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader, size_t batch_size, size_t read_ahead, int64_t start_offset, int64_t end_offset, std::shared_ptr<RowFilter> filter) :
+  reader_(std::move(reader)),
+  schema_(reader_->readerSchema()),
+  batch_size_(batch_size),
+  read_ahead_(read_ahead),
+  start_offset_(start_offset),
+  end_offset_(end_offset),
+  segments_(1, ReadSegment{ -1, 0, -1 }),
+  filter_(filter),
+  finished_(false),
+  stop_(false),
+  current_offset_(0),
+  thread_(&FileReader::ReadAhead, this)
+{}
+
+FileReader::FileReader(std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader, size_t batch_size, size_t read_ahead, const std::vector<ReadSegment>& segments, std::shared_ptr<RowFilter> filter) :
+  reader_(std::move(reader)),
+  schema_(reader_->readerSchema()),
+  batch_size_(batch_size),
+  read_ahead_(read_ahead),
+  start_offset_(0),
+  end_offset_(-1),
+  segments_(segments),
+  filter_(filter),
+  finished_(false),
+  stop_(false),
+  current_offset_(0),
+  thread_(&FileReader::ReadAhead, this)
+{}
+
+FileReader::~FileReader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  not_full_.notify_all();
+  thread_.join();
+}
+
+bool FileReader::ReadDatum(avro::GenericDatum& datum, size_t& segment, bool& started)
+{
+  while (segment < segments_.size()) {
+    auto& current = segments_[segment];
+    if (!started) {
+      if (current.offset >= 0)
+        reader_->seek(current.offset);
+      for (int64_t i = 0; i < current.skip; ++i) {
+        if (!reader_->read(datum))
+          break;
+      }
+      started = true;
+    }
+
+    if (current.count != 0 && !(end_offset_ >= 0 && reader_->pastSync(end_offset_)) && reader_->read(datum)) {
+      if (current.count > 0)
+        --current.count;
+      return true;
+    }
+
+    ++segment;
+    started = false;
+  }
+  return false;
+}
+
+void FileReader::ReadAhead()
+{
+  try {
+    if (start_offset_ > 0)
+      reader_->sync(start_offset_);
+
+    size_t segment = 0;
+    bool started = false;
+    bool end = false;
+    while (!end) {
+      Batch batch;
+      batch.reserve(batch_size_);
+      while (batch.size() < batch_size_) {
+        avro::GenericDatum datum(schema_);
+        if (!ReadDatum(datum, segment, started)) {
+          end = true;
+          break;
+        }
+        if (filter_ && !filter_->Matches(datum))
+          continue;
+        batch.emplace_back(std::move(datum));
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this] { return stop_ || batches_.size() < read_ahead_; });
+      if (stop_)
+        return;
+      if (!batch.empty())
+        batches_.emplace_back(std::move(batch));
+      finished_ = end;
+      not_empty_.notify_all();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = std::current_exception();
+    finished_ = true;
+    not_empty_.notify_all();
+  }
+}
+
+void FileReader::Next(size_t count, std::vector<avro::GenericDatum>& rows)
+{
+  while (rows.size() < count) {
+    if (current_offset_ == current_.size()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this] { return finished_ || !batches_.empty(); });
+      if (batches_.empty()) {
+        if (error_)
+          std::rethrow_exception(error_);
+        break;
+      }
+      current_ = std::move(batches_.front());
+      current_offset_ = 0;
+      batches_.pop_front();
+      not_full_.notify_all();
+    }
+
+    const auto available = std::min(count - rows.size(), current_.size() - current_offset_);
+    for (auto i = current_offset_; i < current_offset_ + available; ++i)
+      rows.emplace_back(std::move(current_[i]));
+    current_offset_ += available;
+  }
+}
+
+// Convert the blocks of an index to the segments to read, limited to the rows
+// from start_row up to end_row (or the end of the index if negative) and the
+// blocks which could contain rows matching the filter.  Blocks which follow on
+// from each other are read as one segment, avoiding a seek.
+std::vector<ReadSegment> GetReadSegments(K index, int64_t start_row, int64_t end_row, const RowFilter* filter)
+{
+  std::vector<ReadSegment> segments;
+  int64_t segment_end = -1;
+  const auto entries = GetIndexEntries(index);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    auto first = std::max(entry.first_row, start_row);
+    auto last = entry.first_row + entry.rows;
+    if (end_row >= 0)
+      last = std::min(last, end_row);
+    if (first >= last || (filter && !filter->MayMatch(index, i)))
+      continue;
+
+    if (!segments.empty() && segment_end == entry.first_row && first == entry.first_row)
+      segments.back().count += last - first;
+    else
+      segments.push_back({ entry.offset, first - entry.first_row, last - first });
+    segment_end = last;
+  }
+  return segments;
+}
+
+std::vector<ReadSegment> LoadReadSegments(const std::string& index_filename, int64_t start_row, int64_t end_row, const RowFilter* filter)
+{
+  K index = LoadIndex(index_filename);
+  std::vector<ReadSegment> segments;
+  try {
+    segments = GetReadSegments(index, start_row, end_row, filter);
+  } catch (...) {
+    r0(index);
+    throw;
+  }
+  r0(index);
+  return segments;
+}
+
+std::shared_ptr<FileReader> CreateFileReader(const std::string& filename, const KdbOptions& options_parser)
+{
+  int64_t batch_size = 4096;
+  options_parser.GetIntOption(Options::READ_BATCH_SIZE, batch_size);
+  if (batch_size <= 0)
+    throw std::invalid_argument("READ_BATCH_SIZE must be positive");
+
+  int64_t read_ahead = 4;
+  options_parser.GetIntOption(Options::READ_AHEAD, read_ahead);
+  if (read_ahead <= 0)
+    throw std::invalid_argument("READ_AHEAD must be positive");
+
+  int64_t start_offset = 0;
+  options_parser.GetIntOption(Options::START_OFFSET, start_offset);
+  if (start_offset < 0)
+    throw std::invalid_argument("START_OFFSET must not be negative");
+
+  int64_t end_offset = -1;
+  const bool has_end_offset = options_parser.GetIntOption(Options::END_OFFSET, end_offset);
+  if (has_end_offset && end_offset < start_offset)
+    throw std::invalid_argument("END_OFFSET must not be less than START_OFFSET");
+
+  int64_t start_row = 0;
+  const bool has_start_row = options_parser.GetIntOption(Options::START_ROW, start_row);
+  if (start_row < 0)
+    throw std::invalid_argument("START_ROW must not be negative");
+
+  int64_t end_row = -1;
+  const bool has_end_row = options_parser.GetIntOption(Options::END_ROW, end_row);
+  if (has_end_row && end_row < start_row)
+    throw std::invalid_argument("END_ROW must not be less than START_ROW");
+
+  const bool by_offset = start_offset != 0 || has_end_offset;
+  const bool by_row = has_start_row || has_end_row;
+  if (by_offset && by_row)
+    throw std::invalid_argument("START_ROW and END_ROW cannot be combined with START_OFFSET or END_OFFSET");
+
+  std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader(new avro::DataFileReader<avro::GenericDatum>(filename.c_str()));
+  const auto filter = GetRowFilter(reader->readerSchema().root(), options_parser);
+
+  // The block index is needed to find a row range and is used if available to
+  // skip blocks which can't match the filter
+  auto index_filename = IndexFilename(filename);
+  const bool has_index_file = options_parser.GetStringOption(Options::INDEX_FILE, index_filename);
+  const bool use_index = by_row || (filter && !by_offset && (has_index_file || std::ifstream(index_filename).good()));
+  if (!use_index)
+    return std::make_shared<FileReader>(std::move(reader), batch_size, read_ahead, start_offset, end_offset, filter);
+
+  const auto segments = LoadReadSegments(index_filename, start_row, end_row, filter.get());
+
+  return std::make_shared<FileReader>(std::move(reader), batch_size, read_ahead, segments, filter);
+}
+
+K OpenReader(K filename, K options)
+{
+  if (!IsKdbString(filename))
+    return krr(S("OpenReader, filename expected -11|10h"));
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  return MakeForeign(CreateFileReader(GetKdbFilename(filename), options_parser));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K OpenBlockReader(K filename, K index, K options)
+{
+  if (!IsKdbString(filename))
+    return krr(S("OpenBlockReader, filename expected -11|10h"));
+  if (index->t != XT)
+    return krr((S)"index not 98h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  int64_t batch_size = 4096;
+  options_parser.GetIntOption(Options::READ_BATCH_SIZE, batch_size);
+  if (batch_size <= 0)
+    return krr((S)"READ_BATCH_SIZE must be positive");
+
+  int64_t read_ahead = 4;
+  options_parser.GetIntOption(Options::READ_AHEAD, read_ahead);
+  if (read_ahead <= 0)
+    return krr((S)"READ_AHEAD must be positive");
+
+  const auto filename_str = GetKdbFilename(filename);
+  std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader(new avro::DataFileReader<avro::GenericDatum>(filename_str.c_str()));
+  const auto filter = GetRowFilter(reader->readerSchema().root(), options_parser);
+
+  const auto segments = GetReadSegments(index, 0, -1, filter.get());
+
+  return MakeForeign(std::make_shared<FileReader>(std::move(reader), batch_size, read_ahead, segments, filter));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K ReaderNext(K reader, K count)
+{
+  if (count->t != -KJ && count->t != -KI)
+    return krr((S)"count not -6|-7h");
+  const int64_t count_value = count->t == -KJ ? count->j : count->i;
+  if (count_value < 0)
+    return krr((S)"count must not be negative");
+
+  KDB_EXCEPTION_TRY;
+
+  auto file_reader = GetForeign<FileReader>(reader);
+  const auto& root = file_reader->Schema().root();
+
+  std::vector<avro::GenericDatum> rows;
+  file_reader->Next(count_value, rows);
+
+  if (root->type() == avro::AVRO_RECORD)
+    return DecodeTable(root, rows);
+
+  K results = ktn(0, 0);
+  for (const auto& row : rows)
+    jk(&results, DecodeDatum("", row, false));
+  return results;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+// Thrown by a file read which was abandoned because another file failed
+class ReadStopped : public std::runtime_error
+{
+public:
+  ReadStopped() :
+    std::runtime_error("Read stopped")
+  {}
+};
+
+// Read all the datums of a file, resolved to the reader schema, charging them
+// to memory.  Runs on a worker thread.
+//
+// A failure sets stop, which makes the reads of the other files give up with
+// ReadStopped rather than reading to the end of files which will be discarded.
+std::vector<avro::GenericDatum> ReadFile(const std::string& filename, const avro::ValidSchema& schema, const RowFilter* filter, MemoryCharge& memory, std::atomic<bool>& stop)
+{
+  try {
+    if (stop)
+      throw ReadStopped();
+    avro::DataFileReader<avro::GenericDatum> reader(filename.c_str(), schema);
+    std::vector<avro::GenericDatum> records;
+    while (true) {
+      if (stop)
+        throw ReadStopped();
+      avro::GenericDatum datum(schema);
+      if (!reader.read(datum))
+        break;
+      if (filter && !filter->Matches(datum))
+        continue;
+      memory.Add(DatumBytes(datum));
+      records.emplace_back(std::move(datum));
+    }
+    return records;
+  } catch (const ReadStopped&) {
+    throw;
+  } catch (...) {
+    stop = true;
+    throw;
+  }
+}
+
+K ReadFiles(K filenames, K options)
+{
+  if (filenames->t != KS && filenames->t != 0)
+    return krr((S)"filenames not 0|11h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  std::vector<std::string> filenames_str;
+  for (auto i = 0; i < filenames->n; ++i) {
+    if (filenames->t == KS) {
+      const std::string filename = kS(filenames)[i];
+      filenames_str.push_back(!filename.empty() && filename[0] == ':' ? filename.substr(1) : filename);
+    } else {
+      K filename = kK(filenames)[i];
+      if (!IsKdbString(filename))
+        return krr((S)"filename not -11|10h");
+      filenames_str.push_back(GetKdbFilename(filename));
+    }
+  }
+
+  // Without a reader schema every file is resolved to the schema of the first
+  std::shared_ptr<avro::ValidSchema> schema;
+  MemoryAccount* memory_account;
+  K reader_schema;
+  if (options_parser.GetObjectOption(Options::READER_SCHEMA, reader_schema)) {
+    const auto avro_foreign = GetForeign<AvroForeign>(reader_schema);
+    schema = avro_foreign->schema;
+    memory_account = avro_foreign->memory;
+  } else if (!filenames_str.empty()) {
+    schema = std::make_shared<avro::ValidSchema>(avro::DataFileReader<avro::GenericDatum>(filenames_str.front().c_str()).readerSchema());
+    memory_account = MemoryStats::Instance().Schema(Crc64Fingerprint(schema->root()));
+  } else {
+    return krr((S)"READER_SCHEMA required if there are no filenames");
+  }
+
+  const auto& root = schema->root();
+  const auto filter = GetRowFilter(root, options_parser);
+
+  // The files are converted to kdb+ in order as they complete, while the later
+  // files are still being read.  The datums read remain charged until every
+  // file has been converted.
+  auto& pool = ThreadPool::Shared();
+  MemoryCharge memory(memory_account, MEMORY_FILE);
+  std::atomic<bool> stop(false);
+  std::deque<std::future<std::vector<avro::GenericDatum>>> pending;
+  K results = ktn(0, 0);
+  try {
+    for (const auto& filename : filenames_str)
+      pending.push_back(pool.Submit([filename, schema, filter, &memory, &stop] { return ReadFile(filename, *schema, filter.get(), memory, stop); }));
+
+    for (const auto& filename : filenames_str) {
+      std::vector<avro::GenericDatum> records;
+      try {
+        records = pending.front().get();
+      } catch (const ReadStopped&) {
+        // The file which failed comes later and its error is reported when
+        // it is reached
+        pending.pop_front();
+        continue;
+      } catch (const std::exception& e) {
+        throw std::runtime_error(filename + ": " + e.what());
+      }
+      pending.pop_front();
+
+      if (root->type() == avro::AVRO_RECORD) {
+        jk(&results, DecodeTable(root, records));
+      } else {
+        K list = ktn(0, 0);
+        for (const auto& record : records)
+          jk(&list, DecodeDatum("", record, false));
+        jk(&results, list);
+      }
+    }
+  } catch (...) {
+    stop = true;
+    WaitAll(pending);
+    r0(results);
+    throw;
+  }
+
+  if (results->n == 0 && root->type() == avro::AVRO_RECORD) {
+    r0(results);
+    std::vector<avro::GenericDatum> empty;
+    return DecodeTable(root, empty);
+  }
+
+  return Evaluate("Cannot join results", "raze", results);
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+
+#include <avro/DataFile.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/ValidSchema.hh>
+
+#include "HelperFunctions.h"
+#include "RowFilter.h"
+
+
+// The structure that is stored in the file reader foreign.
+//
+// A background thread reads the Object Container File block by block,
+// decoding the datums into batches of avro::GenericDatum.  At most
+// `read_ahead` batches are queued at any time so memory use is bounded
+// regardless of the size of the file.  The conversion of the datums to kdb+
+// objects is left to the main thread since the kdb+ memory allocator is not
+// available to other threads.
+//
+// The reader can be limited to a byte range of the file, as with Hadoop input
+// splits.  Reading starts from the first sync marker after the start offset
+// and continues with each block whose preceding sync marker begins before the
+// end offset, so splitting a file into contiguous ranges reads every block
+// exactly once.
+//
+// Alternatively the reader can be given a list of segments, each of which
+// seeks to the start of a block recorded in a block index, skips a number of
+// rows and then reads a number of rows.  This allows a row range or a
+// selection of blocks to be read without scanning the rest of the file.
+//
+// If a row filter is set, records which fail it are discarded by the
+// background thread before they are queued.
+struct ReadSegment
+{
+  // Offset of the block to seek to, or negative to continue from the current
+  // position
+  int64_t offset;
+  // Number of rows to skip after seeking
+  int64_t skip;
+  // Number of rows to read, or negative to read to the end of the file
+  int64_t count;
+};
+
+class FileReader
+{
+private:
+  typedef std::vector<avro::GenericDatum> Batch;
+
+  std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader_;
+  const avro::ValidSchema schema_;
+  const size_t batch_size_;
+  const size_t read_ahead_;
+  const int64_t start_offset_;
+  const int64_t end_offset_;
+  std::vector<ReadSegment> segments_;
+  const std::shared_ptr<RowFilter> filter_;
+
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<Batch> batches_;
+  bool finished_;
+  bool stop_;
+  std::exception_ptr error_;
+
+  // Batch currently being returned by Next
+  Batch current_;
+  size_t current_offset_;
+
+  std::thread thread_;
+
+  // Body of the background thread
+  void ReadAhead();
+
+  // Read the next datum from the segments, returning false once they are all
+  // exhausted
+  bool ReadDatum(avro::GenericDatum& datum, size_t& segment, bool& started);
+
+public:
+  // A negative end offset reads to the end of the file
+  FileReader(std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader, size_t batch_size, size_t read_ahead, int64_t start_offset, int64_t end_offset, std::shared_ptr<RowFilter> filter);
+  FileReader(std::unique_ptr<avro::DataFileReader<avro::GenericDatum>> reader, size_t batch_size, size_t read_ahead, const std::vector<ReadSegment>& segments, std::shared_ptr<RowFilter> filter);
+  ~FileReader();
+
+  FileReader(const FileReader&) = delete;
+  FileReader& operator=(const FileReader&) = delete;
+
+  const avro::ValidSchema& Schema() const
+  {
+    return schema_;
+  }
+
+  // Move up to count datums into rows, waiting for the background thread if
+  // necessary.  Fewer datums are returned only once the end of the file has
+  // been reached.  An error raised by the background thread is rethrown once
+  // the datums read before it have been returned.
+  void Next(size_t count, std::vector<avro::GenericDatum>& rows);
+};
+
+// Create a file reader using the options supported by OpenReader
+std::shared_ptr<FileReader> CreateFileReader(const std::string& filename, const KdbOptions& options);
+
+extern "C"
+{
+  /// @brief Open an Avro Object Container File for reading in batches
+  ///
+  /// Supported options:
+  ///
+  /// * READ_BATCH_SIZE (long).  Number of datums decoded by the background
+  /// thread in each batch.  Default 4096.
+  ///
+  /// * READ_AHEAD (long).  Maximum number of decoded batches which are held
+  /// waiting to be returned by ReaderNext.  Default 4.
+  ///
+  /// * START_OFFSET (long).  Byte offset in the file to start reading from.
+  /// Reading begins with the block following the first sync marker after
+  /// this offset.  Default 0.
+  ///
+  /// * END_OFFSET (long).  Byte offset in the file to stop reading at.  Only
+  /// blocks whose preceding sync marker begins before this offset are read.
+  /// Default is the end of the file.
+  ///
+  /// * START_ROW (long).  Row number to start reading from, found using the
+  /// file's block index.  Cannot be combined with START_OFFSET or END_OFFSET.
+  /// Default 0.
+  ///
+  /// * END_ROW (long).  Row number to stop reading before, found using the
+  /// file's block index.  Default is the end of the file.
+  ///
+  /// * INDEX_FILE (string).  Name of the block index sidecar file used by
+  /// START_ROW, END_ROW and FILTER.  Default is the filename with ".idx"
+  /// appended.
+  ///
+  /// * FILTER (list).  A (op; field; value) predicate on a top level field of
+  /// the record, or a list of them which must all be satisfied.  Only records
+  /// matching the filter are returned.  If a block index is available, blocks
+  /// whose range of a field cannot satisfy the filter are skipped.
+  ///
+  /// @param filename.  String or symbol containing the filename.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return foreign containing the file reader.  This will be garbage
+  /// collected when its refcount drops to zero, which also stops the
+  /// background thread and closes the file.
+  EXP K OpenReader(K filename, K options);
+
+  /// @brief Open selected blocks of an Avro Object Container File for reading
+  /// in batches
+  ///
+  /// Only the blocks in the index are read, in the order given, seeking
+  /// directly to each block.  Filtering the index built by BuildIndex on the
+  /// per-block minimum and maximum of a field allows blocks which cannot
+  /// contain matching rows to be skipped.
+  ///
+  /// Supported options:
+  ///
+  /// * READ_BATCH_SIZE (long).  Number of datums decoded by the background
+  /// thread in each batch.  Default 4096.
+  ///
+  /// * READ_AHEAD (long).  Maximum number of decoded batches which are held
+  /// waiting to be returned by ReaderNext.  Default 4.
+  ///
+  /// * FILTER (list).  A (op; field; value) predicate on a top level field of
+  /// the record, or a list of them which must all be satisfied.  Only records
+  /// matching the filter are returned and blocks whose range of a field in
+  /// the index cannot satisfy the filter are skipped.
+  ///
+  /// @param filename.  String or symbol containing the filename.
+  ///
+  /// @param index.  Block index table, or a selection of its rows, containing
+  /// the long columns offset, firstRow and rows.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return foreign containing the file reader
+  EXP K OpenBlockReader(K filename, K index, K options);
+
+  /// @brief Return the next datums from an Avro Object Container File
+  ///
+  /// @param reader.  Foreign object created by OpenReader.
+  ///
+  /// @param count.  Long or int containing the maximum number of datums to
+  /// return.
+  ///
+  /// @return Table if the file's schema is a record, otherwise a mixed list of
+  /// kdb+ objects.  Fewer than count datums are returned only once the end of
+  /// the file is reached, after which the result is empty.
+  EXP K ReaderNext(K reader, K count);
+
+  /// @brief Read several Avro Object Container Files into a single table
+  ///
+  /// The files are read concurrently on avrokdb's thread pool, each being
+  /// resolved against the same reader schema, and the results are joined in
+  /// the order of the filenames.
+  ///
+  /// Supported options:
+  ///
+  /// * READER_SCHEMA (foreign).  Schema which the data of each file is
+  /// resolved to.  Default is the schema of the first file.
+  ///
+  /// * FILTER (list).  A (op; field; value) predicate on a top level field of
+  /// the record, or a list of them which must all be satisfied.  Only records
+  /// matching the filter are returned.
+  ///
+  /// @param filenames.  Symbol list or mixed list of strings or symbols
+  /// containing the filenames.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Table if the reader schema is a record, otherwise a mixed list of
+  /// kdb+ objects.
+  EXP K ReadFiles(K filenames, K options);
+}
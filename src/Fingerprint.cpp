@@ -0,0 +1,283 @@
+#include <set>
+#include <sstream>
+
+#include <avro/Schema.hh>
+#include <avro/ValidSchema.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Fingerprint.h"
+#include "TypeCheck.h"
+#include "GenericForeign.h"
+
+
+// Names and enum symbols are restricted to [A-Za-z0-9_.] so the only escaping
+// required is for the quotes themselves
+void AppendQuoted(std::ostringstream& os, const std::string& value)
+{
+  os << '"' << value << '"';
+}
+
+void AppendCanonical(std::ostringstream& os, const avro::NodePtr& schema, std::set<std::string>& named_types)
+{
+  const auto type = schema->type();
+
+  // A named type is only defined on its first occurrence, after which it is
+  // referred to by its fullname
+  if (type == avro::AVRO_SYMBOLIC || type == avro::AVRO_RECORD || type == avro::AVRO_ENUM || type == avro::AVRO_FIXED) {
+    const auto fullname = schema->name().fullname();
+    if (!named_types.insert(fullname).second) {
+      AppendQuoted(os, fullname);
+      return;
+    }
+    if (type == avro::AVRO_SYMBOLIC) {
+      named_types.erase(fullname);
+      AppendCanonical(os, ResolveSymbolic(schema), named_types);
+      return;
+    }
+  }
+
+  switch (type) {
+  case avro::AVRO_NULL:
+  case avro::AVRO_BOOL:
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_FLOAT:
+  case avro::AVRO_DOUBLE:
+  case avro::AVRO_STRING:
+  case avro::AVRO_BYTES:
+    AppendQuoted(os, avro::toString(type));
+    break;
+  case avro::AVRO_RECORD:
+  {
+    os << "{\"name\":";
+    AppendQuoted(os, schema->name().fullname());
+    os << ",\"type\":\"record\",\"fields\":[";
+    for (auto i = 0ull; i < schema->leaves(); ++i) {
+      if (i)
+        os << ',';
+      os << "{\"name\":";
+      AppendQuoted(os, schema->nameAt(i));
+      os << ",\"type\":";
+      AppendCanonical(os, schema->leafAt(i), named_types);
+      os << '}';
+    }
+    os << "]}";
+    break;
+  }
+  case avro::AVRO_ENUM:
+  {
+    os << "{\"name\":";
+    AppendQuoted(os, schema->name().fullname());
+    os << ",\"type\":\"enum\",\"symbols\":[";
+    for (auto i = 0ull; i < schema->names(); ++i) {
+      if (i)
+        os << ',';
+      AppendQuoted(os, schema->nameAt(i));
+    }
+    os << "]}";
+    break;
+  }
+  case avro::AVRO_FIXED:
+    os << "{\"name\":";
+    AppendQuoted(os, schema->name().fullname());
+    os << ",\"type\":\"fixed\",\"size\":" << schema->fixedSize() << '}';
+    break;
+  case avro::AVRO_ARRAY:
+    os << "{\"type\":\"array\",\"items\":";
+    AppendCanonical(os, schema->leafAt(0), named_types);
+    os << '}';
+    break;
+  case avro::AVRO_MAP:
+    os << "{\"type\":\"map\",\"values\":";
+    AppendCanonical(os, schema->leafAt(1), named_types);
+    os << '}';
+    break;
+  case avro::AVRO_UNION:
+  {
+    os << '[';
+    for (auto i = 0ull; i < schema->leaves(); ++i) {
+      if (i)
+        os << ',';
+      AppendCanonical(os, schema->leafAt(i), named_types);
+    }
+    os << ']';
+    break;
+  }
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED("", avro::toString(type));
+  }
+}
+
+std::string CanonicalForm(const avro::NodePtr& schema)
+{
+  std::ostringstream os;
+  std::set<std::string> named_types;
+  AppendCanonical(os, schema, named_types);
+  return os.str();
+}
+
+uint64_t Crc64Avro(const void* data, size_t length)
+{
+  static const uint64_t kEmpty = 0xc15d213aa4d7a795ull;
+
+  struct Table
+  {
+    uint64_t entries[256];
+
+    Table()
+    {
+      for (auto i = 0; i < 256; ++i) {
+        uint64_t fp = i;
+        for (auto j = 0; j < 8; ++j)
+          fp = (fp >> 1) ^ (kEmpty & (0 - (fp & 1)));
+        entries[i] = fp;
+      }
+    }
+  };
+  static const Table table;
+
+  uint64_t fp = kEmpty;
+  const auto bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < length; ++i)
+    fp = (fp >> 8) ^ table.entries[(fp ^ bytes[i]) & 0xff];
+
+  return fp;
+}
+
+uint64_t Crc64Fingerprint(const avro::NodePtr& schema)
+{
+  const auto canonical = CanonicalForm(schema);
+  return Crc64Avro(canonical.data(), canonical.length());
+}
+
+namespace sha256
+{
+  const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  inline uint32_t Rotr(uint32_t x, int n)
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void Transform(uint32_t state[8], const uint8_t block[64])
+  {
+    uint32_t w[64];
+    for (auto i = 0; i < 16; ++i)
+      w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    for (auto i = 16; i < 64; ++i) {
+      const auto s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const auto s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (auto i = 0; i < 64; ++i) {
+      const auto s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+      const auto ch = (e & f) ^ (~e & g);
+      const auto t1 = h + s1 + ch + k[i] + w[i];
+      const auto s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+      const auto maj = (a & b) ^ (a & c) ^ (b & c);
+      const auto t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+  }
+}
+
+Sha256Digest Sha256(const void* data, size_t length)
+{
+  uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+  const auto bytes = (const uint8_t*)data;
+  size_t offset = 0;
+  for (; offset + 64 <= length; offset += 64)
+    sha256::Transform(state, bytes + offset);
+
+  // Final block(s) are padded with a single 1 bit then zeros up to the 64-bit
+  // big endian message length in bits
+  uint8_t tail[128] = {};
+  const auto remaining = length - offset;
+  std::memcpy(tail, bytes + offset, remaining);
+  tail[remaining] = 0x80;
+  const size_t tail_length = remaining < 56 ? 64 : 128;
+  const uint64_t bit_length = (uint64_t)length * 8;
+  for (auto i = 0; i < 8; ++i)
+    tail[tail_length - 1 - i] = (uint8_t)(bit_length >> (i * 8));
+  for (size_t i = 0; i < tail_length; i += 64)
+    sha256::Transform(state, tail + i);
+
+  Sha256Digest digest;
+  for (auto i = 0; i < 8; ++i) {
+    digest[i * 4] = (uint8_t)(state[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t)state[i];
+  }
+  return digest;
+}
+
+K CanonicalSchema(K schema)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto canonical = CanonicalForm(avro_foreign->schema->root());
+  K result = ktn(KC, canonical.length());
+  std::memcpy(kG(result), canonical.data(), canonical.length());
+
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K SchemaFingerprint(K schema, K algorithm)
+{
+  if (!IsKdbString(algorithm))
+    return krr((S)"algorithm not -11|10h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto canonical = CanonicalForm(avro_foreign->schema->root());
+
+  const auto algorithm_str = GetKdbString(algorithm);
+  if (algorithm_str == "CRC64") {
+    const auto fingerprint = avro_foreign->fingerprint;
+    K result = ktn(KG, 8);
+    for (auto i = 0; i < 8; ++i)
+      kG(result)[i] = (G)(fingerprint >> (i * 8));
+    return result;
+  } else if (algorithm_str == "SHA256") {
+    const auto digest = Sha256(canonical.data(), canonical.length());
+    K result = ktn(KG, digest.size());
+    std::memcpy(kG(result), digest.data(), digest.size());
+    return result;
+  } else {
+    throw std::invalid_argument("Unsupported fingerprint algorithm: '" + algorithm_str + "'");
+  }
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "HelperFunctions.h"
+
+
+// Returns the Parsing Canonical Form of the schema, as defined by the Avro
+// specification.  Two schemas with the same canonical form are equivalent for
+// the purposes of reading and writing binary data.
+std::string CanonicalForm(const avro::NodePtr& schema);
+
+// 64-bit Rabin fingerprint as defined by the Avro specification (CRC-64-AVRO)
+uint64_t Crc64Avro(const void* data, size_t length);
+
+// CRC-64-AVRO fingerprint of the schema's Parsing Canonical Form
+uint64_t Crc64Fingerprint(const avro::NodePtr& schema);
+
+typedef std::array<uint8_t, 32> Sha256Digest;
+
+// SHA-256 digest as defined by FIPS 180-4
+Sha256Digest Sha256(const void* data, size_t length);
+
+extern "C"
+{
+  /// @brief Return the Parsing Canonical Form of an Avro compiled schema
+  ///
+  /// The canonical form strips attributes which do not affect the binary
+  /// encoding (doc, aliases, defaults, logical types etc), replaces names with
+  /// their fullnames and removes all whitespace.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema.
+  ///
+  /// @return String containing the canonical JSON schema
+  EXP K CanonicalSchema(K schema);
+
+  /// @brief Return the fingerprint of the Parsing Canonical Form of an Avro
+  /// compiled schema
+  ///
+  /// Supported algorithms:
+  ///
+  /// * CRC64.  64-bit Rabin fingerprint (CRC-64-AVRO), returned as 8 bytes in
+  /// little endian order as used by Avro single object encoding.
+  ///
+  /// * SHA256.  SHA-256 digest, returned as 32 bytes.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema.
+  ///
+  /// @param algorithm.  Symbol or string containing the fingerprint algorithm.
+  ///
+  /// @return 4h list containing the fingerprint
+  EXP K SchemaFingerprint(K schema, K algorithm);
+}
@@ -0,0 +1,408 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include "FloatFormat.h"
+
+
+// The shortest representation is found in a single pass using the Ryu
+// algorithm (Ulf Adams, "Ryu: fast float-to-string conversion", PLDI 2018).
+// The value's mantissa and the bounds of the interval which rounds to it are
+// scaled by a power of 10 using fixed point multipliers, then digits are
+// removed while the bounds still differ.
+//
+// The same 128-bit multipliers are used for floats and doubles, a float simply
+// being treated as a double with a shorter mantissa.
+
+// Bits in the multipliers for 5^i and 2^j/5^i
+const int kPow5BitCount = 125;
+const int kPow5InvBitCount = 125;
+
+// Number of multipliers required to cover the exponent range of a double
+const int kPow5TableSize = 326;
+const int kPow5InvTableSize = 342;
+
+struct Multiplier
+{
+  uint64_t low;
+  uint64_t high;
+};
+
+// Little endian arbitrary precision unsigned integer, only used to build the
+// multiplier tables
+typedef std::vector<uint32_t> BigInt;
+
+int BitLength(const BigInt& value)
+{
+  for (auto i = value.size(); i > 0; --i) {
+    if (value[i - 1]) {
+      int bits = 0;
+      for (auto word = value[i - 1]; word; word >>= 1)
+        ++bits;
+      return (int)(i - 1) * 32 + bits;
+    }
+  }
+  return 0;
+}
+
+// Return the 128 bits of the value starting at bit shift, which may be
+// negative to shift the value left
+Multiplier ExtractBits(const BigInt& value, int shift)
+{
+  uint64_t words[2] = {};
+  for (auto bit = 0; bit < 128; ++bit) {
+    const auto source = bit + shift;
+    if (source >= 0 && source / 32 < (int)value.size() && (value[source / 32] >> (source % 32)) & 1)
+      words[bit / 64] |= 1ull << (bit % 64);
+  }
+  return { words[0], words[1] };
+}
+
+// Multipliers for 5^i, being the top kPow5BitCount bits of 5^i, and for
+// 2^j/5^i, being floor(2^(bits(5^i) - 1 + kPow5InvBitCount) / 5^i) + 1
+struct Pow5Tables
+{
+  Multiplier pow5[kPow5TableSize];
+  Multiplier pow5_inv[kPow5InvTableSize];
+
+  Pow5Tables()
+  {
+    BigInt power(1, 1);
+    for (auto i = 0; i < kPow5TableSize; ++i) {
+      pow5[i] = ExtractBits(power, BitLength(power) - kPow5BitCount);
+      uint64_t carry = 0;
+      for (auto& word : power) {
+        carry += (uint64_t)word * 5;
+        word = (uint32_t)carry;
+        carry >>= 32;
+      }
+      if (carry)
+        power.push_back((uint32_t)carry);
+    }
+
+    // floor(2^kNumeratorBits / 5^i) is built by repeated division by 5, the
+    // numerator being large enough that the bits required are always present
+    const int kNumeratorBits = 1024;
+    BigInt quotient(kNumeratorBits / 32 + 1, 0);
+    quotient.back() = 1;
+    int bits = 1;
+    for (auto i = 0; i < kPow5InvTableSize; ++i) {
+      pow5_inv[i] = ExtractBits(quotient, kNumeratorBits - (bits - 1 + kPow5InvBitCount));
+      if (++pow5_inv[i].low == 0)
+        ++pow5_inv[i].high;
+
+      uint64_t remainder = 0;
+      for (auto j = quotient.size(); j > 0; --j) {
+        remainder = (remainder << 32) | quotient[j - 1];
+        quotient[j - 1] = (uint32_t)(remainder / 5);
+        remainder %= 5;
+      }
+      // Number of bits in 5^(i + 1)
+      bits = (int)(((uint32_t)(i + 1) * 1217359) >> 19) + 1;
+    }
+  }
+};
+
+const Pow5Tables& GetPow5Tables()
+{
+  static const Pow5Tables tables;
+  return tables;
+}
+
+inline uint64_t Multiply128(uint64_t a, uint64_t b, uint64_t* high)
+{
+#if defined(__SIZEOF_INT128__)
+  const unsigned __int128 product = (unsigned __int128)a * b;
+  *high = (uint64_t)(product >> 64);
+  return (uint64_t)product;
+#elif defined(_MSC_VER) && defined(_M_X64)
+  return _umul128(a, b, high);
+#else
+  const uint64_t a_low = (uint32_t)a;
+  const uint64_t a_high = a >> 32;
+  const uint64_t b_low = (uint32_t)b;
+  const uint64_t b_high = b >> 32;
+  const uint64_t low_low = a_low * b_low;
+  const uint64_t low_high = a_low * b_high;
+  const uint64_t high_low = a_high * b_low;
+  const uint64_t middle = (low_low >> 32) + (uint32_t)low_high + (uint32_t)high_low;
+  *high = a_high * b_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+  return (middle << 32) | (uint32_t)low_low;
+#endif
+}
+
+// (m * multiplier) >> shift, where shift is between 64 and 128
+inline uint64_t MultiplyShift(uint64_t m, const Multiplier& multiplier, int shift)
+{
+  uint64_t high1;
+  const uint64_t low1 = Multiply128(m, multiplier.high, &high1);
+  uint64_t high0;
+  Multiply128(m, multiplier.low, &high0);
+  const uint64_t sum = high0 + low1;
+  if (sum < high0)
+    ++high1;
+  const auto distance = shift - 64;
+  return (high1 << (64 - distance)) | (sum >> distance);
+}
+
+// floor(log10(2^e))
+inline int Log10Pow2(int e)
+{
+  return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+// floor(log10(5^e))
+inline int Log10Pow5(int e)
+{
+  return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+// Number of bits in 5^e
+inline int Pow5Bits(int e)
+{
+  return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+inline bool MultipleOfPowerOf5(uint64_t value, int p)
+{
+  int count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    ++count;
+  }
+  return count >= p;
+}
+
+inline bool MultipleOfPowerOf2(uint64_t value, int p)
+{
+  return (value & ((1ull << p) - 1)) == 0;
+}
+
+// Shortest decimal digits and exponent, value = digits * 10^exponent
+struct Decimal
+{
+  uint64_t digits;
+  int exponent;
+};
+
+// Convert a finite non-zero IEEE 754 value, split into its mantissa and biased
+// exponent fields, to its shortest decimal representation.  Where there is
+// more than one shortest representation the one closest to the value is
+// chosen.
+Decimal ToDecimal(uint64_t ieee_mantissa, int ieee_exponent, int mantissa_bits, int exponent_bias)
+{
+  const auto& tables = GetPow5Tables();
+
+  // The value is m2 * 2^e2, with two extra bits so that the half way points to
+  // the neighbouring values are integers
+  int e2;
+  uint64_t m2;
+  if (ieee_exponent == 0) {
+    e2 = 1 - exponent_bias - mantissa_bits - 2;
+    m2 = ieee_mantissa;
+  } else {
+    e2 = ieee_exponent - exponent_bias - mantissa_bits - 2;
+    m2 = (1ull << mantissa_bits) | ieee_mantissa;
+  }
+  const bool accept_bounds = (m2 & 1) == 0;
+
+  // The value and its lower and upper bounds.  The lower bound is closer when
+  // the value is an exact power of two.
+  const uint64_t mv = 4 * m2;
+  const uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+  // Scale by a power of 10, keeping one more digit than required so that the
+  // last removed digit is known for rounding
+  uint64_t vr, vp, vm;
+  int e10;
+  bool vm_trailing_zeros = false;
+  bool vr_trailing_zeros = false;
+  if (e2 >= 0) {
+    const int q = Log10Pow2(e2) - (e2 > 3);
+    e10 = q;
+    const int k = kPow5InvBitCount + Pow5Bits(q) - 1;
+    const int i = -e2 + q + k;
+    const auto& multiplier = tables.pow5_inv[q];
+    vr = MultiplyShift(4 * m2, multiplier, i);
+    vp = MultiplyShift(4 * m2 + 2, multiplier, i);
+    vm = MultiplyShift(4 * m2 - 1 - mm_shift, multiplier, i);
+    if (q <= 21) {
+      // Only one of mp, mv and mm can be a multiple of 5, if any
+      if (mv % 5 == 0)
+        vr_trailing_zeros = MultipleOfPowerOf5(mv, q);
+      else if (accept_bounds)
+        vm_trailing_zeros = MultipleOfPowerOf5(mv - 1 - mm_shift, q);
+      else
+        vp -= MultipleOfPowerOf5(mv + 2, q);
+    }
+  } else {
+    const int q = Log10Pow5(-e2) - (-e2 > 1);
+    e10 = q + e2;
+    const int i = -e2 - q;
+    const int k = Pow5Bits(i) - kPow5BitCount;
+    const int j = q - k;
+    const auto& multiplier = tables.pow5[i];
+    vr = MultiplyShift(4 * m2, multiplier, j);
+    vp = MultiplyShift(4 * m2 + 2, multiplier, j);
+    vm = MultiplyShift(4 * m2 - 1 - mm_shift, multiplier, j);
+    if (q <= 1) {
+      // mv has at least q trailing zero bits, since it is a multiple of 4
+      vr_trailing_zeros = true;
+      if (accept_bounds)
+        vm_trailing_zeros = mm_shift == 1;
+      else
+        --vp;
+    } else if (q < 63) {
+      vr_trailing_zeros = MultipleOfPowerOf2(mv, q);
+    }
+  }
+
+  // Remove digits while the bounds still differ
+  int removed = 0;
+  uint64_t output;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    // Rare case where the exact value or lower bound has trailing zeros, which
+    // affect rounding and whether the lower bound can be used
+    uint8_t last_removed_digit = 0;
+    while (vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed_digit == 0;
+      last_removed_digit = (uint8_t)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    if (vm_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed_digit == 0;
+        last_removed_digit = (uint8_t)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        ++removed;
+      }
+    }
+    // Round half to even when the value is exactly half way
+    if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0)
+      last_removed_digit = 4;
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed_digit >= 5);
+  } else {
+    bool round_up = false;
+    if (vp / 100 > vm / 100) {
+      round_up = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      round_up = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    output = vr + (vr == vm || round_up);
+  }
+
+  return { output, e10 + removed };
+}
+
+// Lay out the digits as printf's %g would at a precision of the number of
+// digits, or min_precision if that is greater
+size_t WriteDecimal(bool negative, const Decimal& decimal, int min_precision, char* buffer)
+{
+  char digits[20];
+  int length = 0;
+  for (auto value = decimal.digits; value; value /= 10)
+    digits[sizeof(digits) - ++length] = (char)('0' + value % 10);
+  const char* first = digits + sizeof(digits) - length;
+
+  char* p = buffer;
+  if (negative)
+    *p++ = '-';
+
+  // Exponent of the leading digit
+  const int exponent = decimal.exponent + length - 1;
+  const int precision = length > min_precision ? length : min_precision;
+  if (exponent < -4 || exponent >= precision) {
+    *p++ = first[0];
+    if (length > 1) {
+      *p++ = '.';
+      std::memcpy(p, first + 1, length - 1);
+      p += length - 1;
+    }
+    *p++ = 'e';
+    *p++ = exponent < 0 ? '-' : '+';
+    const int magnitude = exponent < 0 ? -exponent : exponent;
+    if (magnitude >= 100)
+      *p++ = (char)('0' + magnitude / 100);
+    *p++ = (char)('0' + magnitude / 10 % 10);
+    *p++ = (char)('0' + magnitude % 10);
+  } else if (exponent < 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (auto i = -1; i > exponent; --i)
+      *p++ = '0';
+    std::memcpy(p, first, length);
+    p += length;
+  } else if (length <= exponent + 1) {
+    std::memcpy(p, first, length);
+    p += length;
+    for (auto i = length; i <= exponent; ++i)
+      *p++ = '0';
+  } else {
+    std::memcpy(p, first, exponent + 1);
+    p += exponent + 1;
+    *p++ = '.';
+    std::memcpy(p, first + exponent + 1, length - exponent - 1);
+    p += length - exponent - 1;
+  }
+
+  return p - buffer;
+}
+
+size_t FormatDouble(double value, char* buffer)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const bool negative = (bits >> 63) != 0;
+  const uint64_t mantissa = bits & ((1ull << 52) - 1);
+  const int exponent = (int)((bits >> 52) & 0x7ff);
+
+  if (mantissa == 0 && exponent == 0) {
+    if (negative) {
+      std::memcpy(buffer, "-0", 2);
+      return 2;
+    }
+    buffer[0] = '0';
+    return 1;
+  }
+
+  return WriteDecimal(negative, ToDecimal(mantissa, exponent, 52, 1023), 15, buffer);
+}
+
+size_t FormatFloat(float value, char* buffer)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const bool negative = (bits >> 31) != 0;
+  const uint32_t mantissa = bits & ((1u << 23) - 1);
+  const int exponent = (int)((bits >> 23) & 0xff);
+
+  if (mantissa == 0 && exponent == 0) {
+    if (negative) {
+      std::memcpy(buffer, "-0", 2);
+      return 2;
+    }
+    buffer[0] = '0';
+    return 1;
+  }
+
+  return WriteDecimal(negative, ToDecimal(mantissa, exponent, 23, 127), 6, buffer);
+}
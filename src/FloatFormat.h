@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+
+// Longest text written by FormatDouble or FormatFloat,
+// e.g. -2.2250738585072014e-308
+const size_t kMaxFloatFormatLength = 32;
+
+// Write the shortest decimal representation which parses back to the same
+// value, returning the number of characters written.  The layout matches
+// printf's %g at the precision of that representation (or 15 digits for a
+// double and 6 for a float if that is greater), so only the number of digits
+// differs from what printf would produce.  The value must be finite.
+size_t FormatDouble(double value, char* buffer);
+size_t FormatFloat(float value, char* buffer);
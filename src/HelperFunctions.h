@@ -6,6 +6,8 @@
 #include <iomanip>
 #include <cstring>
 
+#include <avro/NodeImpl.hh>
+
 #include <k.h>
 
 
@@ -34,6 +36,14 @@ inline const std::string GetKdbString(K str)
   return str->t == -KS ? str->s : std::string((S)kG(str), str->n);
 }
 
+// As GetKdbString but also allowing a file handle such as `:data.avro
+inline const std::string GetKdbFilename(K str)
+{
+  if (str->t == -KS && str->s[0] == ':')
+    return str->s + 1;
+  return GetKdbString(str);
+}
+
 
 ////////////////////////
 // EXCEPTION HANDLING //
@@ -52,6 +62,26 @@ inline const std::string GetKdbString(K str)
   }
 
 
+//////////////////
+// Q EVALUATION //
+//////////////////
+
+// Evaluate a q expression with the main q thread, taking ownership of the
+// argument and converting a kdb+ error to an exception
+inline K Evaluate(const std::string& context, const char* expression, K argument)
+{
+  K result = k(0, (S)expression, argument, (K)0);
+  if (!result)
+    throw std::runtime_error(context);
+  if (result->t == -128) {
+    const std::string error = result->s;
+    r0(result);
+    throw std::runtime_error(context + ": " + error);
+  }
+  return result;
+}
+
+
 //////////////////////////////
 // TEMPORAL TYPE CONVERSION //
 //////////////////////////////
@@ -126,6 +156,20 @@ inline avro::LogicalType GetRealLogicalType(const avro::GenericDatum& datum)
 }
 
 
+////////////////////////
+// SYMBOLIC RESOLVING //
+////////////////////////
+
+// A named type which is referenced again elsewhere in the schema is represented
+// by a symbolic node pointing back at its definition
+inline avro::NodePtr ResolveSymbolic(const avro::NodePtr& node)
+{
+  if (node->type() == avro::AVRO_SYMBOLIC)
+    return avro::resolveSymbol(node);
+  return node;
+}
+
+
 /////////////////
 // GUID STRING //
 /////////////////
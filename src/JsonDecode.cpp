@@ -0,0 +1,616 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <avro/Schema.hh>
+#include <avro/LogicalType.hh>
+
+#include "HelperFunctions.h"
+#include "Decode.h"
+#include "JsonDecode.h"
+#include "TypeCheck.h"
+
+
+// Records and maps in a list are prefixed by a (::) to prevent type promotion
+bool HasNullPrefix(avro::Type type)
+{
+  return type == avro::AVRO_RECORD || type == avro::AVRO_MAP;
+}
+
+K CreateList(const avro::NodePtr& item_schema, bool null_prefix)
+{
+  const auto node = ResolveSymbolic(item_schema);
+  K result = ktn(GetKdbArrayType(node->type(), node->logicalType().type()), 0);
+  if (null_prefix && HasNullPrefix(node->type()))
+    jk(&result, Identity());
+  return result;
+}
+
+// Remove any items appended to a list after it had the specified length
+void TruncateList(K list, J length)
+{
+  if (list->t == 0) {
+    for (auto i = length; i < list->n; ++i)
+      r0(kK(list)[i]);
+  }
+  list->n = length;
+}
+
+void JsonAvroDecoder::Error(const std::string& message) const
+{
+  throw InvalidJson("Invalid Avro JSON at offset " + std::to_string(Offset()) + ": " + message);
+}
+
+bool JsonAvroDecoder::SkipWhitespace()
+{
+  while (position_ != end_ && (*position_ == ' ' || *position_ == '\n' || *position_ == '\r' || *position_ == '\t'))
+    ++position_;
+  return position_ != end_;
+}
+
+void JsonAvroDecoder::Expect(char c)
+{
+  if (!SkipWhitespace() || *position_ != c)
+    Error(std::string("expected '") + c + "'");
+  ++position_;
+}
+
+bool JsonAvroDecoder::Consume(char c)
+{
+  if (!SkipWhitespace() || *position_ != c)
+    return false;
+  ++position_;
+  return true;
+}
+
+bool JsonAvroDecoder::ConsumeLiteral(const char* literal, size_t length)
+{
+  if (!SkipWhitespace() || (size_t)(end_ - position_) < length || std::memcmp(position_, literal, length) != 0)
+    return false;
+  position_ += length;
+  return true;
+}
+
+bool JsonAvroDecoder::ParseBool()
+{
+  if (ConsumeLiteral("true", 4))
+    return true;
+  if (ConsumeLiteral("false", 5))
+    return false;
+  Error("expected boolean");
+}
+
+int64_t JsonAvroDecoder::ParseLong()
+{
+  SkipWhitespace();
+  const bool negative = position_ != end_ && *position_ == '-';
+  if (negative)
+    ++position_;
+  if (position_ == end_ || *position_ < '0' || *position_ > '9')
+    Error("expected integer");
+
+  // Accumulated as unsigned so that INT64_MIN can be represented
+  uint64_t value = 0;
+  const uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+  while (position_ != end_ && *position_ >= '0' && *position_ <= '9') {
+    const auto digit = (uint64_t)(*position_++ - '0');
+    if (value > (limit - digit) / 10)
+      Error("integer out of range");
+    value = value * 10 + digit;
+  }
+  if (position_ != end_ && (*position_ == '.' || *position_ == 'e' || *position_ == 'E'))
+    Error("expected integer");
+
+  return negative ? (int64_t)(0 - value) : (int64_t)value;
+}
+
+int32_t JsonAvroDecoder::ParseInt()
+{
+  const auto value = ParseLong();
+  if (value < INT32_MIN || value > INT32_MAX)
+    Error("integer out of range");
+  return (int32_t)value;
+}
+
+double JsonAvroDecoder::ParseDouble()
+{
+  SkipWhitespace();
+
+  // Non-finite values are written as strings
+  const bool quoted = Consume('"');
+  if (ConsumeLiteral("NaN", 3)) {
+    if (quoted)
+      Expect('"');
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (ConsumeLiteral("Infinity", 8)) {
+    if (quoted)
+      Expect('"');
+    return std::numeric_limits<double>::infinity();
+  }
+  if (ConsumeLiteral("-Infinity", 9)) {
+    if (quoted)
+      Expect('"');
+    return -std::numeric_limits<double>::infinity();
+  }
+  if (quoted)
+    Error("expected NaN, Infinity or -Infinity");
+
+  // strtod requires a null terminated string which the kdb+ data isn't, so
+  // the number is copied out first
+  char buffer[64];
+  size_t length = 0;
+  while (position_ != end_ && length < sizeof(buffer) - 1 && std::strchr("0123456789+-.eE", *position_) && *position_)
+    buffer[length++] = *position_++;
+  buffer[length] = 0;
+
+  char* number_end;
+  const auto value = std::strtod(buffer, &number_end);
+  if (length == 0 || number_end != buffer + length)
+    Error("expected number");
+  return value;
+}
+
+uint32_t JsonAvroDecoder::ParseHex4()
+{
+  if (end_ - position_ < 4)
+    Error("truncated unicode escape");
+  uint32_t value = 0;
+  for (auto i = 0; i < 4; ++i) {
+    const char c = *position_++;
+    value <<= 4;
+    if (c >= '0' && c <= '9')
+      value |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      value |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      value |= c - 'A' + 10;
+    else
+      Error("invalid unicode escape");
+  }
+  return value;
+}
+
+void JsonAvroDecoder::AppendUtf8(std::string& result, uint32_t code_point)
+{
+  if (code_point < 0x80) {
+    result.push_back((char)code_point);
+  } else if (code_point < 0x800) {
+    result.push_back((char)(0xc0 | (code_point >> 6)));
+    result.push_back((char)(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    result.push_back((char)(0xe0 | (code_point >> 12)));
+    result.push_back((char)(0x80 | ((code_point >> 6) & 0x3f)));
+    result.push_back((char)(0x80 | (code_point & 0x3f)));
+  } else {
+    result.push_back((char)(0xf0 | (code_point >> 18)));
+    result.push_back((char)(0x80 | ((code_point >> 12) & 0x3f)));
+    result.push_back((char)(0x80 | ((code_point >> 6) & 0x3f)));
+    result.push_back((char)(0x80 | (code_point & 0x3f)));
+  }
+}
+
+// Avro JSON bytes and fixed are strings where each character is a byte, using
+// \u00XX escapes.  Strings are UTF-8 with \uXXXX escapes for UTF-16 code
+// units.
+void JsonAvroDecoder::ParseString(std::string& result, bool binary)
+{
+  Expect('"');
+  result.clear();
+
+  while (true) {
+    // The run of characters up to the closing quote is copied in bulk, only
+    // dropping to character by character processing for escapes
+    const auto quote = (const char*)std::memchr(position_, '"', end_ - position_);
+    if (!quote)
+      Error("unterminated string");
+    const auto escape = (const char*)std::memchr(position_, '\\', quote - position_);
+    if (!escape) {
+      result.append(position_, quote);
+      position_ = quote + 1;
+      return;
+    }
+
+    result.append(position_, escape);
+    position_ = escape + 1;
+    if (position_ == end_)
+      Error("unterminated string");
+
+    switch (*position_++) {
+    case '"': result.push_back('"'); break;
+    case '\\': result.push_back('\\'); break;
+    case '/': result.push_back('/'); break;
+    case 'b': result.push_back('\b'); break;
+    case 'f': result.push_back('\f'); break;
+    case 'n': result.push_back('\n'); break;
+    case 'r': result.push_back('\r'); break;
+    case 't': result.push_back('\t'); break;
+    case 'u':
+    {
+      auto code_point = ParseHex4();
+      if (binary) {
+        if (code_point > 0xff)
+          Error("invalid byte value in bytes string");
+        result.push_back((char)code_point);
+        break;
+      }
+      if (code_point >= 0xd800 && code_point <= 0xdbff) {
+        // Surrogate pair
+        if (end_ - position_ < 2 || position_[0] != '\\' || position_[1] != 'u')
+          Error("invalid surrogate pair");
+        position_ += 2;
+        const auto low = ParseHex4();
+        if (low < 0xdc00 || low > 0xdfff)
+          Error("invalid surrogate pair");
+        code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+      }
+      AppendUtf8(result, code_point);
+      break;
+    }
+    default:
+      Error("invalid escape character");
+    }
+  }
+}
+
+K JsonAvroDecoder::DecodeBytes(const std::string& field, const avro::NodePtr& node)
+{
+  ParseString(scratch_, true);
+
+  const auto logical_type = node->logicalType();
+  if (node->type() == avro::AVRO_FIXED) {
+    TYPE_CHECK_FIXED(field, node->fixedSize(), scratch_.length());
+  }
+
+  if (logical_type.type() == avro::LogicalType::DECIMAL) {
+    return DecimalFromBytes(field, logical_type, std::vector<uint8_t>(scratch_.begin(), scratch_.end()));
+  } else if (logical_type.type() == avro::LogicalType::DURATION) {
+    return DurationFromBytes(field, std::vector<uint8_t>(scratch_.begin(), scratch_.end()));
+  } else {
+    K result = ktn(KG, scratch_.length());
+    std::memcpy(kG(result), scratch_.data(), scratch_.length());
+    return result;
+  }
+}
+
+K JsonAvroDecoder::Decode(const std::string& field, const avro::NodePtr& schema)
+{
+  const auto node = ResolveSymbolic(schema);
+  const auto logical_type = node->logicalType().type();
+
+  switch (node->type()) {
+  case avro::AVRO_NULL:
+    if (!ConsumeLiteral("null", 4))
+      Error("expected null");
+    return Identity();
+  case avro::AVRO_BOOL:
+    return kb(ParseBool());
+  case avro::AVRO_INT:
+  {
+    const auto value = ParseInt();
+    if (logical_type == avro::LogicalType::DATE) {
+      TemporalConversion tc(field, logical_type);
+      return kd(tc.AvroToKdb(value));
+    } else if (logical_type == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(field, logical_type);
+      return kt(tc.AvroToKdb(value));
+    } else {
+      return ki(value);
+    }
+  }
+  case avro::AVRO_LONG:
+  {
+    const auto value = ParseLong();
+    if (logical_type == avro::LogicalType::TIME_MICROS) {
+      TemporalConversion tc(field, logical_type);
+      return ktj(-KN, tc.AvroToKdb(value));
+    } else if (logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(field, logical_type);
+      return ktj(-KP, tc.AvroToKdb(value));
+    } else {
+      return kj(value);
+    }
+  }
+  case avro::AVRO_FLOAT:
+    return ke((float)ParseDouble());
+  case avro::AVRO_DOUBLE:
+    return kf(ParseDouble());
+  case avro::AVRO_BYTES:
+  case avro::AVRO_FIXED:
+    return DecodeBytes(field, node);
+  case avro::AVRO_STRING:
+  {
+    ParseString(scratch_, false);
+    if (logical_type == avro::LogicalType::UUID) {
+      TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_STRING), "avro uuid length", 36, scratch_.length());
+      return ku(StringToGuid(scratch_));
+    }
+    K result = ktn(KC, scratch_.length());
+    std::memcpy(kG(result), scratch_.data(), scratch_.length());
+    return result;
+  }
+  case avro::AVRO_ENUM:
+  {
+    ParseString(scratch_, false);
+    size_t index;
+    if (!node->nameIndex(scratch_, index))
+      Error("unknown enum symbol '" + scratch_ + "'");
+    return ks((S)node->nameAt(index).c_str());
+  }
+  case avro::AVRO_RECORD:
+    return DecodeRecord(node);
+  case avro::AVRO_ARRAY:
+    return DecodeArray(field, node);
+  case avro::AVRO_MAP:
+    return DecodeMap(field, node);
+  case avro::AVRO_UNION:
+    return DecodeUnion(field, node);
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED(field, avro::toString(node->type()));
+  }
+}
+
+size_t JsonAvroDecoder::ParseFieldIndex(const avro::NodePtr& record)
+{
+  ParseString(scratch_, false);
+  size_t index;
+  if (!record->nameIndex(scratch_, index))
+    Error("unknown field '" + scratch_ + "'");
+  Expect(':');
+  return index;
+}
+
+K JsonAvroDecoder::DecodeRecord(const avro::NodePtr& node)
+{
+  const auto field_count = node->leaves();
+  K keys = ktn(KS, field_count + 1);
+  K values = ktn(0, field_count + 1);
+  kS(keys)[0] = ss((S)"");
+  for (auto i = 0ull; i < field_count; ++i)
+    kS(keys)[i + 1] = ss((S)node->nameAt(i).c_str());
+  for (auto i = 0ull; i <= field_count; ++i)
+    kK(values)[i] = Identity();
+
+  try {
+    // Fields are accepted in any order but each must be present exactly once
+    std::vector<bool> found(field_count);
+    size_t found_count = 0;
+    Expect('{');
+    if (!Consume('}')) {
+      do {
+        const auto index = ParseFieldIndex(node);
+        if (found[index])
+          Error("duplicate field '" + node->nameAt(index) + "'");
+        r0(kK(values)[index + 1]);
+        kK(values)[index + 1] = Decode(node->nameAt(index), node->leafAt(index));
+        found[index] = true;
+        ++found_count;
+      } while (Consume(','));
+      Expect('}');
+    }
+    if (found_count != field_count) {
+      for (auto i = 0ull; i < field_count; ++i)
+        if (!found[i])
+          Error("missing field '" + node->nameAt(i) + "'");
+    }
+  } catch (...) {
+    r0(keys);
+    r0(values);
+    throw;
+  }
+
+  return xD(keys, values);
+}
+
+void JsonAvroDecoder::AppendItem(const std::string& field, const avro::NodePtr& schema, K& list)
+{
+  const auto node = ResolveSymbolic(schema);
+  const auto logical_type = node->logicalType().type();
+
+  switch (node->type()) {
+  case avro::AVRO_BOOL:
+  {
+    G value = ParseBool();
+    ja(&list, &value);
+    break;
+  }
+  case avro::AVRO_INT:
+  {
+    I value = ParseInt();
+    if (logical_type == avro::LogicalType::DATE || logical_type == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(field, logical_type);
+      value = tc.AvroToKdb(value);
+    }
+    ja(&list, &value);
+    break;
+  }
+  case avro::AVRO_LONG:
+  {
+    J value = ParseLong();
+    if (logical_type == avro::LogicalType::TIME_MICROS || logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(field, logical_type);
+      value = tc.AvroToKdb(value);
+    }
+    ja(&list, &value);
+    break;
+  }
+  case avro::AVRO_FLOAT:
+  {
+    E value = (E)ParseDouble();
+    ja(&list, &value);
+    break;
+  }
+  case avro::AVRO_DOUBLE:
+  {
+    F value = ParseDouble();
+    ja(&list, &value);
+    break;
+  }
+  case avro::AVRO_ENUM:
+  {
+    ParseString(scratch_, false);
+    size_t index;
+    if (!node->nameIndex(scratch_, index))
+      Error("unknown enum symbol '" + scratch_ + "'");
+    js(&list, ss((S)node->nameAt(index).c_str()));
+    break;
+  }
+  case avro::AVRO_STRING:
+  {
+    if (logical_type == avro::LogicalType::UUID) {
+      ParseString(scratch_, false);
+      TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_STRING), "avro uuid length", 36, scratch_.length());
+      U value = StringToGuid(scratch_);
+      ja(&list, &value);
+    } else {
+      jk(&list, Decode(field, node));
+    }
+    break;
+  }
+
+  default:
+    jk(&list, Decode(field, node));
+  }
+}
+
+K JsonAvroDecoder::DecodeArray(const std::string& field, const avro::NodePtr& node)
+{
+  const auto& item_schema = node->leafAt(0);
+  K result = CreateList(item_schema, true);
+
+  try {
+    Expect('[');
+    if (!Consume(']')) {
+      do {
+        AppendItem(field, item_schema, result);
+      } while (Consume(','));
+      Expect(']');
+    }
+  } catch (...) {
+    r0(result);
+    throw;
+  }
+
+  return result;
+}
+
+K JsonAvroDecoder::DecodeMap(const std::string& field, const avro::NodePtr& node)
+{
+  const auto& value_schema = node->leafAt(1);
+  K keys = ktn(KS, 0);
+  K values = CreateList(value_schema, true);
+  if (values->n)
+    js(&keys, ss((S)""));
+
+  try {
+    Expect('{');
+    if (!Consume('}')) {
+      do {
+        ParseString(scratch_, false);
+        Expect(':');
+        js(&keys, ss((S)scratch_.c_str()));
+        AppendItem(field, value_schema, values);
+      } while (Consume(','));
+      Expect('}');
+    }
+  } catch (...) {
+    r0(keys);
+    r0(values);
+    throw;
+  }
+
+  return xD(keys, values);
+}
+
+// Unions are either null or an object with a single key naming the branch,
+// which is the fullname for named types or the type name otherwise
+K JsonAvroDecoder::DecodeUnion(const std::string& field, const avro::NodePtr& node)
+{
+  if (ConsumeLiteral("null", 4)) {
+    for (auto i = 0ull; i < node->leaves(); ++i) {
+      if (node->leafAt(i)->type() == avro::AVRO_NULL)
+        return knk(2, kh((I)i), Identity());
+    }
+    Error("union has no null branch");
+  }
+
+  Expect('{');
+  ParseString(scratch_, false);
+  size_t branch = node->leaves();
+  for (auto i = 0ull; i < node->leaves() && branch == node->leaves(); ++i) {
+    const auto& leaf = node->leafAt(i);
+    switch (leaf->type()) {
+    case avro::AVRO_RECORD:
+    case avro::AVRO_ENUM:
+    case avro::AVRO_FIXED:
+    case avro::AVRO_SYMBOLIC:
+      if (leaf->name().fullname() == scratch_ || leaf->name().simpleName() == scratch_)
+        branch = i;
+      break;
+    default:
+      if (avro::toString(leaf->type()) == scratch_)
+        branch = i;
+    }
+  }
+  if (branch == node->leaves())
+    Error("unknown union branch '" + scratch_ + "'");
+  Expect(':');
+
+  K value = Decode(field, node->leafAt(branch));
+  try {
+    Expect('}');
+  } catch (...) {
+    r0(value);
+    throw;
+  }
+
+  return knk(2, kh((I)branch), value);
+}
+
+K JsonAvroDecoder::CreateColumns(const avro::NodePtr& record_schema)
+{
+  const auto node = ResolveSymbolic(record_schema);
+  K columns = ktn(0, node->leaves());
+  for (auto i = 0ull; i < node->leaves(); ++i)
+    kK(columns)[i] = CreateList(node->leafAt(i), false);
+  return columns;
+}
+
+void JsonAvroDecoder::DecodeColumns(const avro::NodePtr& record_schema, K columns)
+{
+  const auto node = ResolveSymbolic(record_schema);
+  const auto field_count = node->leaves();
+  const auto row = field_count ? kK(columns)[0]->n : 0;
+
+  try {
+    std::vector<bool> found(field_count);
+    size_t found_count = 0;
+    Expect('{');
+    if (!Consume('}')) {
+      do {
+        const auto index = ParseFieldIndex(node);
+        if (found[index])
+          Error("duplicate field '" + node->nameAt(index) + "'");
+        AppendItem(node->nameAt(index), node->leafAt(index), kK(columns)[index]);
+        found[index] = true;
+        ++found_count;
+      } while (Consume(','));
+      Expect('}');
+    }
+    if (found_count != field_count) {
+      for (auto i = 0ull; i < field_count; ++i)
+        if (!found[i])
+          Error("missing field '" + node->nameAt(i) + "'");
+    }
+  } catch (...) {
+    // Leave every column the same length
+    for (auto i = 0ull; i < field_count; ++i)
+      TruncateList(kK(columns)[i], row);
+    throw;
+  }
+}
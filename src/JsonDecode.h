@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+#include "HelperFunctions.h"
+
+
+// Decodes Avro JSON encoded data directly to kdb+ objects.
+//
+// Rather than going through avro::jsonDecoder and an avro::GenericDatum this
+// parses the JSON text in a single pass guided by the schema, writing scalars
+// straight into the kdb+ lists.  The result follows the same type mapping as
+// DecodeDatum.
+class JsonAvroDecoder
+{
+private:
+  const char* begin_;
+  const char* position_;
+  const char* end_;
+  std::string scratch_;
+
+public:
+  // Thrown if the JSON is malformed or doesn't match the schema
+  class InvalidJson : public std::invalid_argument
+  {
+  public:
+    InvalidJson(const std::string& message) : std::invalid_argument(message.c_str())
+    {};
+  };
+
+  JsonAvroDecoder(const char* data, size_t length) :
+    begin_(data), position_(data), end_(data + length)
+  {}
+
+  size_t Offset() const
+  {
+    return position_ - begin_;
+  }
+
+  // Advance past any whitespace, returning true if there is more data
+  bool SkipWhitespace();
+
+  // Decode a datum of the specified schema to its kdb+ representation
+  K Decode(const std::string& field, const avro::NodePtr& schema);
+
+  // Decode a record, appending each field to the corresponding list in columns
+  // (as created by CreateColumns).  The columns are left unchanged if an error
+  // occurs.
+  void DecodeColumns(const avro::NodePtr& record_schema, K columns);
+
+  // Create a mixed list containing an empty list for each field of the record,
+  // of the type used for an array of that field's datatype
+  static K CreateColumns(const avro::NodePtr& record_schema);
+
+private:
+  [[noreturn]] void Error(const std::string& message) const;
+
+  void Expect(char c);
+  bool Consume(char c);
+  bool ConsumeLiteral(const char* literal, size_t length);
+
+  bool ParseBool();
+  int64_t ParseLong();
+  int32_t ParseInt();
+  double ParseDouble();
+  void ParseString(std::string& result, bool binary);
+  void AppendUtf8(std::string& result, uint32_t code_point);
+  uint32_t ParseHex4();
+
+  K DecodeBytes(const std::string& field, const avro::NodePtr& node);
+  K DecodeRecord(const avro::NodePtr& node);
+  K DecodeArray(const std::string& field, const avro::NodePtr& node);
+  K DecodeMap(const std::string& field, const avro::NodePtr& node);
+  K DecodeUnion(const std::string& field, const avro::NodePtr& node);
+
+  // Append a datum to a list following the type mapping used for arrays
+  void AppendItem(const std::string& field, const avro::NodePtr& schema, K& list);
+
+  // Find the field of the record named in the next object key
+  size_t ParseFieldIndex(const avro::NodePtr& record);
+};
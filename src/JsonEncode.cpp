@@ -0,0 +1,727 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <avro/Schema.hh>
+#include <avro/LogicalType.hh>
+#include <avro/Exception.hh>
+
+#include "HelperFunctions.h"
+#include "Encode.h"
+#include "FloatFormat.h"
+#include "JsonEncode.h"
+#include "TypeCheck.h"
+
+
+// Characters which avro::jsonEncoder escapes: the JSON control characters and
+// DEL, quote, backslash and solidus, and anything outside of 7-bit ASCII (which
+// is written as a \u escape of the code point, or of the byte for binary data)
+inline bool NeedsEscape(uint8_t c)
+{
+  return c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || c == '/';
+}
+
+// Check eight characters at once, using the bitwise tricks for finding a byte
+// in a word, so that long runs of plain text can be skipped without testing
+// each character.  Returns false only if none of the characters needs escaping.
+inline bool WordNeedsEscape(const char* p)
+{
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  uint64_t word;
+  std::memcpy(&word, p, sizeof(word));
+
+  auto has_zero = [ones, highs](uint64_t v) { return ((v - ones) & ~v & highs) != 0; };
+  return (word & highs) != 0 ||
+    ((word - ones * 0x20) & ~word & highs) != 0 ||
+    has_zero(word ^ (ones * '"')) ||
+    has_zero(word ^ (ones * '\\')) ||
+    has_zero(word ^ (ones * '/')) ||
+    has_zero(word ^ (ones * 0x7f));
+}
+
+inline char HexDigit(uint32_t value)
+{
+  return value < 10 ? (char)('0' + value) : (char)('a' + value - 10);
+}
+
+// Name avro::jsonEncoder uses to identify the selected branch of a union
+std::string UnionBranchName(const avro::NodePtr& leaf)
+{
+  switch (leaf->type()) {
+  case avro::AVRO_RECORD:
+  case avro::AVRO_ENUM:
+  case avro::AVRO_FIXED:
+  case avro::AVRO_SYMBOLIC:
+    return leaf->name().fullname();
+  default:
+    return avro::toString(leaf->type());
+  }
+}
+
+void CheckItemType(const std::string& field, avro::Type avro_type, int expected, int received, bool map)
+{
+  if (map) {
+    TYPE_CHECK_MAP(field, avro::toString(avro_type), expected, received);
+  } else {
+    TYPE_CHECK_ARRAY(field, avro::toString(avro_type), expected, received);
+  }
+}
+
+JsonAvroEncoder::JsonAvroEncoder(avro::OutputStream& out, bool pretty) :
+  out_(out), next_(nullptr), end_(nullptr), pretty_(pretty), level_(0)
+{}
+
+void JsonAvroEncoder::NextChunk()
+{
+  size_t length;
+  if (!out_.next(&next_, &length))
+    throw avro::Exception("EOF reached");
+  end_ = next_ + length;
+}
+
+void JsonAvroEncoder::Flush()
+{
+  if (next_ != end_)
+    out_.backup(end_ - next_);
+  next_ = end_ = nullptr;
+  out_.flush();
+}
+
+// The pretty layout follows avro::jsonPrettyEncoder: a new line after each
+// opening bracket and value, with two spaces of indentation per level
+void JsonAvroEncoder::Indent()
+{
+  for (auto i = 0ull; i < level_ * 2; ++i)
+    Put(' ');
+}
+
+void JsonAvroEncoder::StartContainer(char c)
+{
+  Put(c);
+  if (pretty_) {
+    Put('\n');
+    ++level_;
+    Indent();
+  }
+}
+
+void JsonAvroEncoder::EndContainer(char c)
+{
+  if (pretty_) {
+    Put('\n');
+    --level_;
+    Indent();
+  }
+  Put(c);
+}
+
+void JsonAvroEncoder::Separator()
+{
+  Put(',');
+  if (pretty_) {
+    Put('\n');
+    Indent();
+  }
+}
+
+void JsonAvroEncoder::WriteKey(const char* key, size_t length)
+{
+  WriteString("", key, length, false);
+  Put(':');
+  if (pretty_)
+    Put(' ');
+}
+
+void JsonAvroEncoder::WriteLong(int64_t value)
+{
+  char buffer[24];
+  char* p = buffer + sizeof(buffer);
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  do {
+    *--p = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0)
+    *--p = '-';
+  Write(p, buffer + sizeof(buffer) - p);
+}
+
+void JsonAvroEncoder::WriteInfinity(bool positive)
+{
+  if (positive)
+    Write("\"Infinity\"", 10);
+  else
+    Write("\"-Infinity\"", 11);
+}
+
+// Non-finite values are written as strings, as avro::jsonEncoder does.
+// Otherwise use the fewest significant digits which parse back to the same
+// value rather than always writing 17 (or 9 for a float).
+void JsonAvroEncoder::WriteDouble(double value)
+{
+  if (std::isnan(value))
+    return Write("\"NaN\"", 5);
+  if (std::isinf(value))
+    return WriteInfinity(value > 0);
+
+  char buffer[kMaxFloatFormatLength];
+  Write(buffer, FormatDouble(value, buffer));
+}
+
+void JsonAvroEncoder::WriteFloat(float value)
+{
+  if (std::isnan(value))
+    return Write("\"NaN\"", 5);
+  if (std::isinf(value))
+    return WriteInfinity(value > 0);
+
+  char buffer[kMaxFloatFormatLength];
+  Write(buffer, FormatFloat(value, buffer));
+}
+
+void JsonAvroEncoder::WriteUnicodeEscape(uint32_t code_point)
+{
+  if (code_point >= 0x10000) {
+    code_point -= 0x10000;
+    WriteUnicodeEscape(((code_point >> 10) & 0x3ff) | 0xd800);
+    WriteUnicodeEscape((code_point & 0x3ff) | 0xdc00);
+    return;
+  }
+
+  const char escape[6] = { '\\', 'u', HexDigit((code_point >> 12) & 0xf), HexDigit((code_point >> 8) & 0xf),
+    HexDigit((code_point >> 4) & 0xf), HexDigit(code_point & 0xf) };
+  Write(escape, sizeof(escape));
+}
+
+const char* JsonAvroEncoder::WriteEscape(const std::string& field, const char* p, const char* end, bool binary)
+{
+  const uint8_t c = (uint8_t)*p;
+  switch (c) {
+  case '"':
+  case '\\':
+  case '/':
+    Put('\\');
+    Put((char)c);
+    return p + 1;
+  case '\b':
+    Write("\\b", 2);
+    return p + 1;
+  case '\f':
+    Write("\\f", 2);
+    return p + 1;
+  case '\n':
+    Write("\\n", 2);
+    return p + 1;
+  case '\r':
+    Write("\\r", 2);
+    return p + 1;
+  case '\t':
+    Write("\\t", 2);
+    return p + 1;
+  default:
+    break;
+  }
+
+  if (c < 0x80 || binary) {
+    WriteUnicodeEscape(c);
+    return p + 1;
+  }
+
+  // Decode the UTF-8 sequence so that the code point can be escaped
+  int more;
+  uint32_t code_point;
+  if ((c & 0xe0) == 0xc0) {
+    more = 1;
+    code_point = c & 0x1f;
+  } else if ((c & 0xf0) == 0xe0) {
+    more = 2;
+    code_point = c & 0x0f;
+  } else if ((c & 0xf8) == 0xf0) {
+    more = 3;
+    code_point = c & 0x07;
+  } else {
+    throw TypeCheck("Invalid UTF-8 string, field: '" + field + "'");
+  }
+  for (auto i = 0; i < more; ++i) {
+    if (++p == end || ((uint8_t)*p & 0xc0) != 0x80)
+      throw TypeCheck("Invalid UTF-8 string, field: '" + field + "'");
+    code_point = (code_point << 6) | ((uint8_t)*p & 0x3f);
+  }
+  if (code_point >= 0x110000)
+    throw TypeCheck("Invalid UTF-8 string, field: '" + field + "'");
+  WriteUnicodeEscape(code_point);
+  return p + 1;
+}
+
+void JsonAvroEncoder::WriteString(const std::string& field, const char* data, size_t length, bool binary)
+{
+  Put('"');
+
+  // Copy runs of characters which don't need escaping in one go
+  const char* p = data;
+  const char* end = data + length;
+  const char* run = p;
+  while (p != end) {
+    if (end - p >= 8 && !WordNeedsEscape(p)) {
+      p += 8;
+      continue;
+    }
+    if (!NeedsEscape((uint8_t)*p)) {
+      ++p;
+      continue;
+    }
+    Write(run, p - run);
+    p = WriteEscape(field, p, end, binary);
+    run = p;
+  }
+  Write(run, p - run);
+
+  Put('"');
+}
+
+void JsonAvroEncoder::EncodeBytes(const std::string& field, const avro::NodePtr& node, K data)
+{
+  const auto avro_type = node->type();
+  const auto logical_type = node->logicalType();
+  if (logical_type.type() == avro::LogicalType::DECIMAL) {
+    const auto bytes = DecimalToBytes(field, avro_type, logical_type, data);
+    WriteString(field, (const char*)bytes.data(), bytes.size(), true);
+  } else if (avro_type == avro::AVRO_FIXED && logical_type.type() == avro::LogicalType::DURATION) {
+    const auto bytes = DurationToBytes(field, avro_type, data);
+    WriteString(field, (const char*)bytes.data(), bytes.size(), true);
+  } else {
+    if (avro_type == avro::AVRO_FIXED)
+      TYPE_CHECK_FIXED(field, node->fixedSize(), (size_t)data->n);
+    WriteString(field, (const char*)kG(data), data->n, true);
+  }
+}
+
+void JsonAvroEncoder::EncodeEnum(const std::string& field, const avro::NodePtr& node, S symbol)
+{
+  size_t index;
+  if (!node->nameIndex(symbol, index))
+    throw avro::Exception("No such symbol: " + std::string(symbol));
+  WriteString(field, symbol, std::strlen(symbol), false);
+}
+
+void JsonAvroEncoder::EncodeArray(const std::string& field, const avro::NodePtr& node, K data)
+{
+  assert(node->leaves() == 1);
+  StartContainer('[');
+  EncodeItems(field, node->leafAt(0), nullptr, data);
+  EndContainer(']');
+}
+
+void JsonAvroEncoder::EncodeMap(const std::string& field, const avro::NodePtr& node, K data)
+{
+  K keys = kK(data)[0];
+  K values = kK(data)[1];
+  TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_MAP), "dict keys", KS, keys->t);
+  assert(keys->n == values->n);
+
+  assert(node->leaves() == 2);
+  StartContainer('{');
+  EncodeItems(field, node->leafAt(1), keys, values);
+  EndContainer('}');
+}
+
+void JsonAvroEncoder::EncodeRecord(const std::string& field, const avro::NodePtr& node, K data)
+{
+  K keys = kK(data)[0];
+  K values = kK(data)[1];
+  TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_RECORD), "dict keys", KS, keys->t);
+  TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_RECORD), "dict values", 0, values->t);
+  assert(keys->n == values->n);
+
+  // Fields are written in schema order.  The dictionary is normally in the same
+  // order so try the next field before searching for it by name.
+  const auto field_count = node->leaves();
+  std::vector<K> fields(field_count, nullptr);
+  size_t position = 0;
+  for (auto i = 0; i < keys->n; ++i) {
+    const S key = kS(keys)[i];
+    K value = kK(values)[i];
+    if (key[0] == '\0' && value->t == 101)
+      continue;
+
+    size_t index = position;
+    if (index >= field_count || node->nameAt(index) != key) {
+      if (!node->nameIndex(key, index))
+        throw avro::Exception("Invalid field name: " + std::string(key));
+    }
+    fields[index] = value;
+    position = index + 1;
+  }
+
+  StartContainer('{');
+  for (auto i = 0ull; i < field_count; ++i) {
+    if (i)
+      Separator();
+    const auto& name = node->nameAt(i);
+    WriteKey(name.c_str(), name.size());
+    if (fields[i])
+      Encode(name, node->leafAt(i), fields[i]);
+    else
+      WriteDefault(node->leafAt(i));
+  }
+  EndContainer('}');
+}
+
+void JsonAvroEncoder::EncodeUnion(const std::string& field, const avro::NodePtr& node, K data)
+{
+  TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_UNION), "mixed list length", 2, (int)data->n);
+
+  K k_branch = kK(data)[0];
+  K k_datum = kK(data)[1];
+  TYPE_CHECK_KDB(field, avro::toString(avro::AVRO_UNION), "mixed list[0] branch selector", -KH, k_branch->t);
+  if (k_branch->h < 0 || (size_t)k_branch->h >= node->leaves())
+    throw avro::Exception("Invalid branch: " + std::to_string(k_branch->h));
+
+  // The null branch is written as a plain null, anything else is wrapped in an
+  // object keyed by the branch's name
+  const auto& leaf = node->leafAt(k_branch->h);
+  if (leaf->type() == avro::AVRO_NULL)
+    return Encode(field, leaf, k_datum);
+
+  StartContainer('{');
+  const auto name = UnionBranchName(leaf);
+  WriteKey(name.c_str(), name.size());
+  Encode(field, leaf, k_datum);
+  EndContainer('}');
+}
+
+void JsonAvroEncoder::NextItem(K keys, J index, bool& first)
+{
+  if (!first)
+    Separator();
+  first = false;
+  if (keys) {
+    const S key = kS(keys)[index];
+    WriteKey(key, std::strlen(key));
+  }
+}
+
+void JsonAvroEncoder::EncodeItems(const std::string& field, const avro::NodePtr& item_schema, K keys, K values)
+{
+  const auto node = ResolveSymbolic(item_schema);
+  const auto item_type = node->type();
+  const auto item_logical_type = node->logicalType().type();
+  const bool map = keys != nullptr;
+  bool first = true;
+
+  switch (item_type) {
+  case avro::AVRO_BOOL:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      NextItem(keys, i, first);
+      if (kG(values)[i])
+        Write("true", 4);
+      else
+        Write("false", 5);
+    }
+    break;
+  }
+  case avro::AVRO_BYTES:
+  case avro::AVRO_FIXED:
+  {
+    int expected = KG;
+    if (item_logical_type == avro::LogicalType::DECIMAL)
+      expected = 0;
+    else if (item_type == avro::AVRO_FIXED && item_logical_type == avro::LogicalType::DURATION)
+      expected = KI;
+    for (auto i = 0; i < values->n; ++i) {
+      K k_bytes = kK(values)[i];
+      CheckItemType(field, item_type, expected, k_bytes->t, map);
+      NextItem(keys, i, first);
+      EncodeBytes(field, node, k_bytes);
+    }
+    break;
+  }
+  case avro::AVRO_DOUBLE:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      NextItem(keys, i, first);
+      WriteDouble(kF(values)[i]);
+    }
+    break;
+  }
+  case avro::AVRO_ENUM:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      NextItem(keys, i, first);
+      EncodeEnum(field, node, kS(values)[i]);
+    }
+    break;
+  }
+  case avro::AVRO_FLOAT:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      NextItem(keys, i, first);
+      WriteFloat(kE(values)[i]);
+    }
+    break;
+  }
+  case avro::AVRO_INT:
+  {
+    if (item_logical_type == avro::LogicalType::DATE || item_logical_type == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(field, item_logical_type);
+      for (auto i = 0; i < values->n; ++i) {
+        NextItem(keys, i, first);
+        WriteLong(tc.KdbToAvro(kI(values)[i]));
+      }
+    } else {
+      for (auto i = 0; i < values->n; ++i) {
+        NextItem(keys, i, first);
+        WriteLong(kI(values)[i]);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_LONG:
+  {
+    if (item_logical_type == avro::LogicalType::TIME_MICROS || item_logical_type == avro::LogicalType::TIMESTAMP_MILLIS || item_logical_type == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(field, item_logical_type);
+      for (auto i = 0; i < values->n; ++i) {
+        NextItem(keys, i, first);
+        WriteLong(tc.KdbToAvro<int64_t>(kJ(values)[i]));
+      }
+    } else {
+      for (auto i = 0; i < values->n; ++i) {
+        NextItem(keys, i, first);
+        WriteLong(kJ(values)[i]);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_NULL:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      CheckItemType(field, item_type, 101, kK(values)[i]->t, map);
+      NextItem(keys, i, first);
+      Write("null", 4);
+    }
+    break;
+  }
+  case avro::AVRO_STRING:
+  {
+    if (item_logical_type == avro::LogicalType::UUID) {
+      for (auto i = 0; i < values->n; ++i) {
+        NextItem(keys, i, first);
+        const auto uuid = GuidToString(kU(values)[i]);
+        WriteString(field, uuid.c_str(), uuid.size(), false);
+      }
+    } else {
+      for (auto i = 0; i < values->n; ++i) {
+        K k_string = kK(values)[i];
+        TYPE_CHECK_ARRAY(field, avro::toString(item_type), KC, k_string->t);
+        NextItem(keys, i, first);
+        WriteString(field, (const char*)kG(k_string), k_string->n, false);
+      }
+    }
+    break;
+  }
+  case avro::AVRO_ARRAY:
+  {
+    assert(node->leaves() == 1);
+    const auto sub_item = ResolveSymbolic(node->leafAt(0));
+    const auto sub_array_type = GetKdbArrayType(sub_item->type(), sub_item->logicalType().type());
+    for (auto i = 0; i < values->n; ++i) {
+      K k_array = kK(values)[i];
+      CheckItemType(field, item_type, sub_array_type, k_array->t, map);
+      NextItem(keys, i, first);
+      EncodeArray(field, node, k_array);
+    }
+    break;
+  }
+  case avro::AVRO_RECORD:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      K k_record = kK(values)[i];
+      if (k_record->t == 101)
+        continue;
+      CheckItemType(field, item_type, 99, k_record->t, map);
+      NextItem(keys, i, first);
+      EncodeRecord(field, node, k_record);
+    }
+    break;
+  }
+  case avro::AVRO_UNION:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      K k_union = kK(values)[i];
+      CheckItemType(field, item_type, 0, k_union->t, map);
+      NextItem(keys, i, first);
+      EncodeUnion(field, node, k_union);
+    }
+    break;
+  }
+  case avro::AVRO_MAP:
+  {
+    for (auto i = 0; i < values->n; ++i) {
+      K k_map = kK(values)[i];
+      if (k_map->t == 101)
+        continue;
+      CheckItemType(field, item_type, 99, k_map->t, map);
+      NextItem(keys, i, first);
+      EncodeMap(field, node, k_map);
+    }
+    break;
+  }
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED(field, avro::toString(item_type));
+  }
+}
+
+void JsonAvroEncoder::WriteDefault(const avro::NodePtr& schema)
+{
+  const auto node = ResolveSymbolic(schema);
+  switch (node->type()) {
+  case avro::AVRO_NULL:
+    return Write("null", 4);
+  case avro::AVRO_BOOL:
+    return Write("false", 5);
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+  case avro::AVRO_FLOAT:
+  case avro::AVRO_DOUBLE:
+    return Put('0');
+  case avro::AVRO_STRING:
+  case avro::AVRO_BYTES:
+    return Write("\"\"", 2);
+  case avro::AVRO_ENUM:
+    return WriteString("", node->nameAt(0).c_str(), node->nameAt(0).size(), false);
+  case avro::AVRO_FIXED:
+  {
+    const std::vector<char> fixed(node->fixedSize());
+    return WriteString("", fixed.data(), fixed.size(), true);
+  }
+  case avro::AVRO_ARRAY:
+    StartContainer('[');
+    return EndContainer(']');
+  case avro::AVRO_MAP:
+    StartContainer('{');
+    return EndContainer('}');
+  case avro::AVRO_RECORD:
+  {
+    StartContainer('{');
+    for (auto i = 0ull; i < node->leaves(); ++i) {
+      if (i)
+        Separator();
+      WriteKey(node->nameAt(i).c_str(), node->nameAt(i).size());
+      WriteDefault(node->leafAt(i));
+    }
+    return EndContainer('}');
+  }
+  case avro::AVRO_UNION:
+  {
+    // An uninitialised union has its first branch selected
+    const auto& leaf = node->leafAt(0);
+    if (leaf->type() == avro::AVRO_NULL)
+      return Write("null", 4);
+    StartContainer('{');
+    const auto name = UnionBranchName(leaf);
+    WriteKey(name.c_str(), name.size());
+    WriteDefault(leaf);
+    return EndContainer('}');
+  }
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED("", avro::toString(node->type()));
+  }
+}
+
+void JsonAvroEncoder::Encode(const std::string& field, const avro::NodePtr& schema, K data)
+{
+  const auto node = ResolveSymbolic(schema);
+  const auto avro_type = node->type();
+  const auto logical_type = node->logicalType().type();
+
+  KdbType expected;
+  if (avro_type == avro::AVRO_ARRAY) {
+    const auto item = ResolveSymbolic(node->leafAt(0));
+    expected = GetKdbArrayType(item->type(), item->logicalType().type());
+  } else {
+    expected = GetKdbSimpleType(avro_type, logical_type);
+  }
+  TYPE_CHECK_DATUM(field, avro::toString(avro_type), expected, data->t);
+
+  switch (avro_type) {
+  case avro::AVRO_BOOL:
+    if (data->g)
+      Write("true", 4);
+    else
+      Write("false", 5);
+    break;
+  case avro::AVRO_BYTES:
+  case avro::AVRO_FIXED:
+    EncodeBytes(field, node, data);
+    break;
+  case avro::AVRO_DOUBLE:
+    WriteDouble(data->f);
+    break;
+  case avro::AVRO_ENUM:
+    EncodeEnum(field, node, data->s);
+    break;
+  case avro::AVRO_FLOAT:
+    WriteFloat(data->e);
+    break;
+  case avro::AVRO_INT:
+  {
+    if (logical_type == avro::LogicalType::DATE || logical_type == avro::LogicalType::TIME_MILLIS) {
+      TemporalConversion tc(field, logical_type);
+      WriteLong(tc.KdbToAvro(data->i));
+    } else {
+      WriteLong(data->i);
+    }
+    break;
+  }
+  case avro::AVRO_LONG:
+  {
+    if (logical_type == avro::LogicalType::TIME_MICROS || logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS) {
+      TemporalConversion tc(field, logical_type);
+      WriteLong(tc.KdbToAvro(data->j));
+    } else {
+      WriteLong(data->j);
+    }
+    break;
+  }
+  case avro::AVRO_NULL:
+    Write("null", 4);
+    break;
+  case avro::AVRO_STRING:
+  {
+    if (logical_type == avro::LogicalType::UUID) {
+      const auto uuid = GuidToString(*(U*)kG(data));
+      WriteString(field, uuid.c_str(), uuid.size(), false);
+    } else {
+      WriteString(field, (const char*)kG(data), data->n, false);
+    }
+    break;
+  }
+  case avro::AVRO_RECORD:
+    EncodeRecord(field, node, data);
+    break;
+  case avro::AVRO_ARRAY:
+    EncodeArray(field, node, data);
+    break;
+  case avro::AVRO_UNION:
+    EncodeUnion(field, node, data);
+    break;
+  case avro::AVRO_MAP:
+    EncodeMap(field, node, data);
+    break;
+
+  case avro::AVRO_SYMBOLIC:
+  case avro::AVRO_UNKNOWN:
+  default:
+    TYPE_CHECK_UNSUPPORTED(field, avro::toString(avro_type));
+  }
+}
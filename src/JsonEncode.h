@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <avro/Stream.hh>
+
+#include "HelperFunctions.h"
+
+
+// Encodes kdb+ objects directly to Avro JSON.
+//
+// Rather than populating an avro::GenericDatum and passing it through
+// avro::jsonEncoder this walks the kdb+ object guided by the schema, writing
+// the JSON text straight to an avro::OutputStream.  The kdb+ object must follow
+// the same type mapping as EncodeDatum and the output matches the layout of
+// avro::jsonEncoder (or avro::jsonPrettyEncoder) except that floats and doubles
+// are written using the shortest representation which round trips.
+//
+// As with the avro encoders the text is written into the chunks handed out by
+// the stream, so Flush must be called once encoding is complete to return the
+// unused part of the last chunk.
+class JsonAvroEncoder
+{
+private:
+  avro::OutputStream& out_;
+  uint8_t* next_;
+  uint8_t* end_;
+  const bool pretty_;
+  size_t level_;
+
+public:
+  JsonAvroEncoder(avro::OutputStream& out, bool pretty);
+
+  JsonAvroEncoder(const JsonAvroEncoder&) = delete;
+  JsonAvroEncoder& operator=(const JsonAvroEncoder&) = delete;
+
+  // Encode a kdb+ object of the specified schema, appending its JSON
+  // representation to the output
+  void Encode(const std::string& field, const avro::NodePtr& schema, K data);
+
+  // Return the unused part of the current chunk to the stream, after which
+  // the stream's byteCount is the length of the JSON written
+  void Flush();
+
+private:
+  // Move on to the stream's next chunk
+  void NextChunk();
+
+  void Put(char c)
+  {
+    if (next_ == end_)
+      NextChunk();
+    *next_++ = (uint8_t)c;
+  }
+
+  void Write(const char* data, size_t length)
+  {
+    while (length) {
+      if (next_ == end_)
+        NextChunk();
+      const auto bytes = std::min(length, (size_t)(end_ - next_));
+      std::memcpy(next_, data, bytes);
+      next_ += bytes;
+      data += bytes;
+      length -= bytes;
+    }
+  }
+
+  void Indent();
+  void StartContainer(char c);
+  void EndContainer(char c);
+  void Separator();
+  void WriteKey(const char* key, size_t length);
+
+  void WriteLong(int64_t value);
+  void WriteInfinity(bool positive);
+  void WriteDouble(double value);
+  void WriteFloat(float value);
+  void WriteString(const std::string& field, const char* data, size_t length, bool binary);
+  const char* WriteEscape(const std::string& field, const char* p, const char* end, bool binary);
+  void WriteUnicodeEscape(uint32_t code_point);
+
+  void EncodeBytes(const std::string& field, const avro::NodePtr& node, K data);
+  void EncodeEnum(const std::string& field, const avro::NodePtr& node, S symbol);
+  void EncodeArray(const std::string& field, const avro::NodePtr& node, K data);
+  void EncodeMap(const std::string& field, const avro::NodePtr& node, K data);
+  void EncodeRecord(const std::string& field, const avro::NodePtr& node, K data);
+  void EncodeUnion(const std::string& field, const avro::NodePtr& node, K data);
+
+  // Encode the items of an array, or the values of a map if keys is non-null
+  void EncodeItems(const std::string& field, const avro::NodePtr& item_schema, K keys, K values);
+
+  // Write the separator and, for a map, the key preceding an item
+  void NextItem(K keys, J index, bool& first);
+
+  // Write the value an avro::GenericDatum is initialised with, used for
+  // record fields which are missing from the kdb+ dictionary
+  void WriteDefault(const avro::NodePtr& schema);
+};
@@ -14,17 +14,63 @@ namespace Options
 {
   // Int options
   const std::string DECODE_OFFSET = "DECODE_OFFSET";
+  const std::string DECODE_MAX_ITEMS = "DECODE_MAX_ITEMS";
+  const std::string ENCODE_OFFSET = "ENCODE_OFFSET";
   const std::string MULTITHREADED = "MULTITHREADED";
+  const std::string CONTINUE_ON_ERROR = "CONTINUE_ON_ERROR";
+  const std::string LAZY_DECODE = "LAZY_DECODE";
+  const std::string SINGLE_OBJECT = "SINGLE_OBJECT";
+  const std::string READ_BATCH_SIZE = "READ_BATCH_SIZE";
+  const std::string READ_AHEAD = "READ_AHEAD";
+  const std::string START_OFFSET = "START_OFFSET";
+  const std::string END_OFFSET = "END_OFFSET";
+  const std::string START_ROW = "START_ROW";
+  const std::string END_ROW = "END_ROW";
+  const std::string BLOCK_ROWS = "BLOCK_ROWS";
+  const std::string THREADS = "THREADS";
+  const std::string FLUSH_INTERVAL = "FLUSH_INTERVAL";
+  const std::string MAX_PENDING = "MAX_PENDING";
 
   // String options
   const std::string AVRO_FORMAT = "AVRO_FORMAT";
+  const std::string INDEX_FILE = "INDEX_FILE";
+  const std::string PARTITION = "PARTITION";
+  const std::string CODEC = "CODEC";
+
+  // Object options
+  const std::string FILTER = "FILTER";
+  const std::string READER_SCHEMA = "READER_SCHEMA";
+  const std::string ERROR_CALLBACK = "ERROR_CALLBACK";
 
   const static std::set<std::string> int_options = {
     DECODE_OFFSET,
-    MULTITHREADED
+    DECODE_MAX_ITEMS,
+    ENCODE_OFFSET,
+    MULTITHREADED,
+    CONTINUE_ON_ERROR,
+    LAZY_DECODE,
+    SINGLE_OBJECT,
+    READ_BATCH_SIZE,
+    READ_AHEAD,
+    START_OFFSET,
+    END_OFFSET,
+    START_ROW,
+    END_ROW,
+    BLOCK_ROWS,
+    THREADS,
+    FLUSH_INTERVAL,
+    MAX_PENDING
   };
   const static std::set<std::string> string_options = {
-    AVRO_FORMAT
+    AVRO_FORMAT,
+    INDEX_FILE,
+    PARTITION,
+    CODEC
+  };
+  const static std::set<std::string> object_options = {
+    FILTER,
+    READER_SCHEMA,
+    ERROR_CALLBACK
   };
 }
 
@@ -34,15 +80,20 @@ namespace Options
 // Dictionary key:    KS
 // Dictionary value:  KS or
 //                    KJ or
-//                    0 of -KS|-KJ|KC
+//                    0 of -KS|-KJ|KC or any kdb+ object for an object option
+//
+// Object options are not copied so are only valid while the options
+// dictionary is.
 class KdbOptions
 {
 private:
   std::map<std::string, std::string> string_options;
   std::map<std::string, int64_t> int_options;
+  std::map<std::string, K> object_options;
 
   const std::set<std::string> supported_string_options;
   const std::set<std::string> supported_int_options;
+  const std::set<std::string> supported_object_options;
 
 private:
   const std::string ToUpper(std::string str) const
@@ -84,6 +135,10 @@ private:
     for (auto i = 0ll; i < values->n; ++i) {
       const std::string key = kS(keys)[i];
       K value = kK(values)[i];
+      if (supported_object_options.find(key) != supported_object_options.end()) {
+        object_options[key] = value;
+        continue;
+      }
       switch (value->t) {
       case -KJ:
         if (supported_int_options.find(key) == supported_int_options.end())
@@ -119,8 +174,8 @@ public:
     {};
   };
 
-  KdbOptions(K options, const std::set<std::string>& supported_string_options_, const std::set<std::string>& supported_int_options_) :
-    supported_string_options(supported_string_options_), supported_int_options(supported_int_options_)
+  KdbOptions(K options, const std::set<std::string>& supported_string_options_, const std::set<std::string>& supported_int_options_, const std::set<std::string>& supported_object_options_ = std::set<std::string>()) :
+    supported_string_options(supported_string_options_), supported_int_options(supported_int_options_), supported_object_options(supported_object_options_)
   {
     if (options != NULL && options->t != 101) {
       if (options->t != 99)
@@ -166,5 +221,15 @@ public:
       return true;
     }
   }
-};
 
+  bool GetObjectOption(const std::string key, K& result) const
+  {
+    const auto it = object_options.find(key);
+    if (it == object_options.end())
+      return false;
+    else {
+      result = it->second;
+      return true;
+    }
+  }
+};
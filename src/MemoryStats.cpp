@@ -0,0 +1,173 @@
+#include <string>
+#include <vector>
+
+#include <avro/GenericDatum.hh>
+
+#include "HelperFunctions.h"
+#include "MemoryStats.h"
+
+
+const char* const kOperationNames[MEMORY_OPERATIONS] = { "encode", "decode", "stream", "file", "writer", "pool" };
+
+// Approximate size of the holder allocated for each value of a datum
+const size_t kValueBytes = 4 * sizeof(void*);
+
+// Return a (current; peak) table keyed by the supplied key column
+K AccountsToKdb(const std::string& key_name, K key_column, const std::vector<const MemoryAccount*>& accounts)
+{
+  K current = ktn(KJ, accounts.size());
+  K peak = ktn(KJ, accounts.size());
+  for (size_t i = 0; i < accounts.size(); ++i) {
+    kJ(current)[i] = accounts[i]->Current();
+    kJ(peak)[i] = accounts[i]->Peak();
+  }
+
+  K key_names = ktn(KS, 1);
+  kS(key_names)[0] = ss((S)key_name.c_str());
+  K value_names = ktn(KS, 2);
+  kS(value_names)[0] = ss((S)"current");
+  kS(value_names)[1] = ss((S)"peak");
+
+  return xD(xT(xD(key_names, knk(1, key_column))), xT(xD(value_names, knk(2, current, peak))));
+}
+
+MemoryAccount* MemoryStats::Schema(uint64_t fingerprint)
+{
+  std::lock_guard<std::mutex> lock(schemas_mutex_);
+  auto& account = schemas_[fingerprint];
+  if (!account)
+    account.reset(new MemoryAccount());
+  return account.get();
+}
+
+void MemoryStats::Charge(MemoryAccount* schema, MemoryOperation operation, int64_t bytes)
+{
+  if (!TryCharge(schema, operation, bytes))
+    throw MemoryLimitExceeded("avrokdb memory limit of " + std::to_string(limit_) + " bytes exceeded by " + kOperationNames[operation] + " of " + std::to_string(bytes) + " bytes, " + std::to_string(total_.Current()) + " bytes in use");
+}
+
+bool MemoryStats::TryCharge(MemoryAccount* schema, MemoryOperation operation, int64_t bytes)
+{
+  // The limit is soft so concurrent charges may together take the total
+  // slightly above it
+  const auto limit = limit_.load();
+  if (limit && total_.Current() + bytes > limit)
+    return false;
+
+  total_.Add(bytes);
+  operations_[operation].Add(bytes);
+  if (schema)
+    schema->Add(bytes);
+  return true;
+}
+
+void MemoryStats::Release(MemoryAccount* schema, MemoryOperation operation, int64_t bytes)
+{
+  total_.Subtract(bytes);
+  operations_[operation].Subtract(bytes);
+  if (schema)
+    schema->Subtract(bytes);
+}
+
+K MemoryStats::ToKdb()
+{
+  K operation_names = ktn(KS, MEMORY_OPERATIONS);
+  std::vector<const MemoryAccount*> operations;
+  for (auto i = 0; i < MEMORY_OPERATIONS; ++i) {
+    kS(operation_names)[i] = ss((S)kOperationNames[i]);
+    operations.push_back(&operations_[i]);
+  }
+
+  K fingerprints = ktn(0, 0);
+  std::vector<const MemoryAccount*> schemas;
+  {
+    std::lock_guard<std::mutex> lock(schemas_mutex_);
+    for (const auto& i : schemas_) {
+      // Matches the CRC64 fingerprint returned by SchemaFingerprint
+      K fingerprint = ktn(KG, 8);
+      for (auto j = 0; j < 8; ++j)
+        kG(fingerprint)[j] = (G)(i.first >> (j * 8));
+      jk(&fingerprints, fingerprint);
+      schemas.push_back(i.second.get());
+    }
+  }
+
+  K keys = ktn(KS, 5);
+  kS(keys)[0] = ss((S)"limit");
+  kS(keys)[1] = ss((S)"current");
+  kS(keys)[2] = ss((S)"peak");
+  kS(keys)[3] = ss((S)"operations");
+  kS(keys)[4] = ss((S)"schemas");
+
+  return xD(keys, knk(5, kj(limit_), kj(total_.Current()), kj(total_.Peak()),
+    AccountsToKdb("operation", operation_names, operations),
+    AccountsToKdb("fingerprint", fingerprints, schemas)));
+}
+
+size_t DatumBytes(const avro::GenericDatum& datum)
+{
+  size_t bytes = kValueBytes;
+  switch (datum.type()) {
+  case avro::AVRO_NULL:
+    return 0;
+  case avro::AVRO_STRING:
+    bytes += datum.value<std::string>().capacity();
+    break;
+  case avro::AVRO_BYTES:
+    bytes += datum.value<std::vector<uint8_t>>().capacity();
+    break;
+  case avro::AVRO_FIXED:
+    bytes += datum.value<avro::GenericFixed>().value().capacity();
+    break;
+  case avro::AVRO_RECORD:
+  {
+    const auto& record = datum.value<avro::GenericRecord>();
+    bytes += record.fieldCount() * sizeof(avro::GenericDatum);
+    for (size_t i = 0; i < record.fieldCount(); ++i)
+      bytes += DatumBytes(record.fieldAt(i));
+    break;
+  }
+  case avro::AVRO_ARRAY:
+  {
+    const auto& elements = datum.value<avro::GenericArray>().value();
+    bytes += elements.capacity() * sizeof(avro::GenericDatum);
+    for (const auto& element : elements)
+      bytes += DatumBytes(element);
+    break;
+  }
+  case avro::AVRO_MAP:
+  {
+    const auto& entries = datum.value<avro::GenericMap>().value();
+    bytes += entries.capacity() * sizeof(std::pair<std::string, avro::GenericDatum>);
+    for (const auto& entry : entries)
+      bytes += entry.first.capacity() + DatumBytes(entry.second);
+    break;
+  }
+  default:
+    break;
+  }
+  return bytes;
+}
+
+K MemStats(K unused)
+{
+  KDB_EXCEPTION_TRY;
+
+  return MemoryStats::Instance().ToKdb();
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K SetMemoryLimit(K limit)
+{
+  if (limit->t != -KJ)
+    return krr((S)"limit not -7h");
+  if (limit->j < 0)
+    return krr((S)"limit must be non-negative");
+
+  KDB_EXCEPTION_TRY;
+
+  return kj(MemoryStats::Instance().SetLimit(limit->j));
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <avro/GenericDatum.hh>
+
+#include "HelperFunctions.h"
+
+
+// Operations which memory allocated by avrokdb outside of kdb+ is charged to
+enum MemoryOperation
+{
+  MEMORY_ENCODE,  // Encode output streams and encodeBatch chunks
+  MEMORY_DECODE,  // Datums held by decodeBatch and async decoders
+  MEMORY_STREAM,  // Partial datums buffered by stream decoders
+  MEMORY_FILE,    // Datums read by readFiles
+  MEMORY_WRITER,  // Blocks being built by async writers
+  MEMORY_POOL,    // Datums held by the schemas' datum pools
+  MEMORY_OPERATIONS
+};
+
+// Thrown when a charge would take avrokdb's memory over the soft limit
+class MemoryLimitExceeded : public std::runtime_error
+{
+public:
+  explicit MemoryLimitExceeded(const std::string& message) :
+    std::runtime_error(message)
+  {}
+};
+
+// Current and peak bytes charged to one schema or operation
+class MemoryAccount
+{
+private:
+  std::atomic<int64_t> current_;
+  std::atomic<int64_t> peak_;
+
+public:
+  MemoryAccount() :
+    current_(0), peak_(0)
+  {}
+
+  MemoryAccount(const MemoryAccount&) = delete;
+  MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+  void Add(int64_t bytes)
+  {
+    const auto current = current_ += bytes;
+    auto peak = peak_.load();
+    while (current > peak && !peak_.compare_exchange_weak(peak, current));
+  }
+
+  void Subtract(int64_t bytes)
+  {
+    current_ -= bytes;
+  }
+
+  int64_t Current() const
+  {
+    return current_;
+  }
+
+  int64_t Peak() const
+  {
+    return peak_;
+  }
+};
+
+// Accounts of the memory which avrokdb allocates outside of kdb+, and so which
+// isn't reported by .Q.w.
+//
+// Memory is charged, by the code which allocates it, to both the operation
+// and the schema (identified by its CRC-64-AVRO fingerprint) it is used for.
+// The schema accounts outlive the schema foreigns so that the peak used by a
+// schema can still be seen after it has been freed.
+//
+// If a soft limit is set then a charge which would take the total above it
+// fails with MemoryLimitExceeded, before the memory has been allocated.
+class MemoryStats
+{
+private:
+  MemoryAccount total_;
+  MemoryAccount operations_[MEMORY_OPERATIONS];
+  std::atomic<int64_t> limit_;
+
+  std::mutex schemas_mutex_;
+  std::map<uint64_t, std::unique_ptr<MemoryAccount>> schemas_;
+
+  MemoryStats() :
+    limit_(0)
+  {}
+
+public:
+  // Deliberately never destroyed since charges held by other statics (such as
+  // the schemas in the schema cache) are released on their destruction
+  static MemoryStats& Instance()
+  {
+    static MemoryStats* memory_stats = new MemoryStats();
+    return *memory_stats;
+  }
+
+  // Return the account of the schema with this fingerprint, creating it if
+  // required
+  MemoryAccount* Schema(uint64_t fingerprint);
+
+  // Charge bytes to an operation and schema, throwing if the soft limit would
+  // be exceeded
+  void Charge(MemoryAccount* schema, MemoryOperation operation, int64_t bytes);
+
+  // As Charge but returning false rather than throwing
+  bool TryCharge(MemoryAccount* schema, MemoryOperation operation, int64_t bytes);
+
+  void Release(MemoryAccount* schema, MemoryOperation operation, int64_t bytes);
+
+  // Set the soft limit, 0 for no limit, returning the previous limit
+  int64_t SetLimit(int64_t limit)
+  {
+    return limit_.exchange(limit);
+  }
+
+  K ToKdb();
+};
+
+// Bytes charged by an object for one operation of a schema, which are released
+// when it is destroyed.  Can be added to from several threads at once.
+class MemoryCharge
+{
+private:
+  MemoryAccount* schema_;
+  MemoryOperation operation_;
+  std::atomic<int64_t> bytes_;
+
+public:
+  MemoryCharge(MemoryAccount* schema, MemoryOperation operation) :
+    schema_(schema), operation_(operation), bytes_(0)
+  {}
+
+  ~MemoryCharge()
+  {
+    Remove(bytes_);
+  }
+
+  MemoryCharge(const MemoryCharge&) = delete;
+  MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+  // Throws MemoryLimitExceeded if the soft limit would be exceeded
+  void Add(size_t bytes)
+  {
+    MemoryStats::Instance().Charge(schema_, operation_, bytes);
+    bytes_ += bytes;
+  }
+
+  bool TryAdd(size_t bytes)
+  {
+    if (!MemoryStats::Instance().TryCharge(schema_, operation_, bytes))
+      return false;
+    bytes_ += bytes;
+    return true;
+  }
+
+  void Remove(size_t bytes)
+  {
+    if (!bytes)
+      return;
+    MemoryStats::Instance().Release(schema_, operation_, bytes);
+    bytes_ -= bytes;
+  }
+
+  // Adjust the charge to a new total, only an increase can throw
+  void Set(size_t bytes)
+  {
+    const auto current = (size_t)bytes_.load();
+    if (bytes > current)
+      Add(bytes - current);
+    else
+      Remove(current - bytes);
+  }
+
+  size_t Bytes() const
+  {
+    return bytes_;
+  }
+};
+
+// Estimate the heap memory used by a datum tree, including the values held by
+// its records, arrays, maps and strings
+size_t DatumBytes(const avro::GenericDatum& datum);
+
+extern "C"
+{
+  /// @brief Return the memory allocated by avrokdb outside of kdb+
+  ///
+  /// This memory, used by datums, encoded data and buffers held between
+  /// calls, is not included in .Q.w.  Memory used internally by avro-cpp,
+  /// such as its encoders and decoders, is not tracked.
+  ///
+  /// @param unused.
+  ///
+  /// @return Dictionary of:
+  ///
+  /// * limit.  Soft limit in bytes, 0 if there is no limit.
+  ///
+  /// * current.  Total bytes currently allocated.
+  ///
+  /// * peak.  Largest total allocated at any one time.
+  ///
+  /// * operations.  Table keyed by operation of its current and peak bytes.
+  ///
+  /// * schemas.  Table keyed by the 8 byte CRC-64-AVRO fingerprint of each
+  /// schema of its current and peak bytes.
+  EXP K MemStats(K unused);
+
+  /// @brief Set a soft limit on the memory avrokdb allocates outside of kdb+
+  ///
+  /// Once the limit would be exceeded an operation fails with an error rather
+  /// than allocating more memory.  Memory already allocated is unaffected.
+  ///
+  /// @param limit.  Long limit in bytes, 0 to remove the limit.
+  ///
+  /// @return Long previous limit.
+  EXP K SetMemoryLimit(K limit);
+}
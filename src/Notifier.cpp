@@ -0,0 +1,162 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include <iostream>
+
+#include "Notifier.h"
+
+
+#ifdef _WIN32
+
+// sd1 only accepts sockets on Windows so a connected loopback pair is used
+static void CreateDescriptors(I& read_fd, I& write_fd)
+{
+  SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listener == INVALID_SOCKET)
+    throw std::runtime_error("Cannot create notification socket");
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int length = sizeof(address);
+  SOCKET writer = INVALID_SOCKET;
+  SOCKET reader = INVALID_SOCKET;
+  if (bind(listener, (sockaddr*)&address, sizeof(address)) == 0 &&
+    getsockname(listener, (sockaddr*)&address, &length) == 0 &&
+    listen(listener, 1) == 0 &&
+    (writer = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) != INVALID_SOCKET &&
+    connect(writer, (sockaddr*)&address, sizeof(address)) == 0)
+    reader = accept(listener, NULL, NULL);
+  closesocket(listener);
+
+  u_long non_blocking = 1;
+  if (reader == INVALID_SOCKET || ioctlsocket(reader, FIONBIO, &non_blocking) != 0) {
+    if (writer != INVALID_SOCKET)
+      closesocket(writer);
+    if (reader != INVALID_SOCKET)
+      closesocket(reader);
+    throw std::runtime_error("Cannot connect notification socket");
+  }
+  read_fd = (I)reader;
+  write_fd = (I)writer;
+}
+
+static void CloseDescriptor(I fd)
+{
+  closesocket((SOCKET)fd);
+}
+
+static void WriteByte(I fd)
+{
+  const char byte = 0;
+  send((SOCKET)fd, &byte, 1, 0);
+}
+
+static bool ReadBytes(I fd)
+{
+  char buffer[64];
+  return recv((SOCKET)fd, buffer, sizeof(buffer), 0) > 0;
+}
+
+#else
+
+static void CreateDescriptors(I& read_fd, I& write_fd)
+{
+  int fds[2];
+  if (pipe(fds) != 0)
+    throw std::runtime_error("Cannot create notification pipe");
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  read_fd = fds[0];
+  write_fd = fds[1];
+}
+
+static void CloseDescriptor(I fd)
+{
+  close(fd);
+}
+
+static void WriteByte(I fd)
+{
+  const char byte = 0;
+  while (write(fd, &byte, 1) < 0 && errno == EINTR);
+}
+
+static bool ReadBytes(I fd)
+{
+  char buffer[64];
+  return read(fd, buffer, sizeof(buffer)) > 0;
+}
+
+#endif // _WIN32
+
+std::map<I, MainThreadNotifier*>& MainThreadNotifier::Registry()
+{
+  static std::map<I, MainThreadNotifier*> registry;
+  return registry;
+}
+
+K MainThreadNotifier::OnReadable(I fd)
+{
+  auto notifier = Registry().find(fd);
+  if (notifier == Registry().end())
+    return (K)0;
+
+  while (ReadBytes(fd));
+
+  // The handler may destroy the notifier so it is copied first.  Clearing the
+  // flag before running the handler ensures that anything queued after the
+  // handler has started results in another notification.
+  auto handler = notifier->second->handler_;
+  notifier->second->signalled_ = false;
+  handler();
+
+  return (K)0;
+}
+
+MainThreadNotifier::MainThreadNotifier(std::function<void()> handler) :
+  read_fd_(-1), write_fd_(-1), handler_(handler), signalled_(false)
+{
+  CreateDescriptors(read_fd_, write_fd_);
+  if (!sd1(read_fd_, &MainThreadNotifier::OnReadable)) {
+    CloseDescriptor(read_fd_);
+    CloseDescriptor(write_fd_);
+    throw std::runtime_error("Cannot register notification descriptor");
+  }
+  Registry()[read_fd_] = this;
+}
+
+MainThreadNotifier::~MainThreadNotifier()
+{
+  Registry().erase(read_fd_);
+  sd0x(read_fd_, 0);
+  CloseDescriptor(read_fd_);
+  CloseDescriptor(write_fd_);
+}
+
+void MainThreadNotifier::Notify()
+{
+  if (!signalled_.exchange(true))
+    WriteByte(write_fd_);
+}
+
+bool IsCallback(K callback)
+{
+  return callback->t == -KS || (callback->t >= 100 && callback->t <= 112);
+}
+
+void CallCallback(const std::string& context, K callback, K id, K argument)
+{
+  K args = knk(2, id, argument);
+  K result = dot(callback, args);
+  r0(args);
+  if (!result)
+    return;
+  if (result->t == -128)
+    std::cerr << "avrokdb " << context << " callback error: " << result->s << std::endl;
+  r0(result);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+
+#include "HelperFunctions.h"
+
+
+// Runs a handler on the main q thread when woken by another thread.
+//
+// The notifier owns a connected pair of descriptors, the read end of which is
+// registered with q's event loop using sd1.  Notify writes a byte to the other
+// end, so the handler is run by q between the processing of other messages.
+// Repeated notifications before the handler has run are coalesced.
+//
+// The notifier must be created and destroyed on the main q thread.
+class MainThreadNotifier
+{
+private:
+  I read_fd_;
+  I write_fd_;
+  std::function<void()> handler_;
+  std::atomic<bool> signalled_;
+
+  static std::map<I, MainThreadNotifier*>& Registry();
+
+  static K OnReadable(I fd);
+
+public:
+  explicit MainThreadNotifier(std::function<void()> handler);
+
+  ~MainThreadNotifier();
+
+  MainThreadNotifier(const MainThreadNotifier&) = delete;
+  MainThreadNotifier& operator=(const MainThreadNotifier&) = delete;
+
+  // Wake the main thread.  Can be called from any thread.
+  void Notify();
+};
+
+// Whether a kdb+ object can be used as a callback: a function or the symbol
+// name of one
+bool IsCallback(K callback);
+
+// Call a q callback with (id; argument) from the main thread, consuming the
+// arguments.  Any error is reported on stderr, prefixed by context, since
+// there is no caller to return it to.
+void CallCallback(const std::string& context, K callback, K id, K argument);
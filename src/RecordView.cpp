@@ -0,0 +1,104 @@
+#include <avro/ValidSchema.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/Decoder.hh>
+#include <avro/Stream.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Decode.h"
+#include "BinaryCursor.h"
+#include "RecordView.h"
+#include "TypeCheck.h"
+#include "GenericForeign.h"
+
+
+// Walk a record recording the offset of each field, descending into any fields
+// which are themselves records
+void IndexRecord(BinaryCursor& cursor, const avro::NodePtr& schema, const std::string& prefix, RecordView& record_view)
+{
+  const auto record = ResolveSymbolic(schema);
+  for (auto i = 0ull; i < record->leaves(); ++i) {
+    const auto& field_schema = record->leafAt(i);
+    const auto path = prefix + record->nameAt(i);
+    record_view.index[path] = RecordView::Field{ cursor.Offset(), field_schema };
+    record_view.paths.push_back(path);
+
+    if (ResolveSymbolic(field_schema)->type() == avro::AVRO_RECORD)
+      IndexRecord(cursor, field_schema, path + ".", record_view);
+    else
+      cursor.SkipDatum(field_schema);
+  }
+}
+
+K CreateRecordView(std::shared_ptr<AvroForeign> avro_foreign, K data, size_t decode_offset)
+{
+  const auto& root = avro_foreign->schema->root();
+  if (root->type() != avro::AVRO_RECORD)
+    throw TypeCheck("LAZY_DECODE requires a record schema");
+
+  auto record_view = std::make_shared<RecordView>(avro_foreign, data, decode_offset);
+  record_view->index[""] = RecordView::Field{ 0, root };
+
+  BinaryCursor cursor(record_view->Data(), record_view->data_length);
+  IndexRecord(cursor, root, "", *record_view.get());
+
+  return MakeForeign(record_view);
+}
+
+K DecodeViewField(const RecordView& record_view, const std::string& path)
+{
+  const auto field = record_view.index.find(path);
+  if (field == record_view.index.end())
+    throw std::invalid_argument("Field path not found: '" + path + "'");
+
+  auto istream = avro::memoryInputStream(record_view.Data() + field->second.offset, record_view.data_length - field->second.offset);
+  auto decoder = avro::binaryDecoder();
+  decoder->init(*istream);
+
+  avro::GenericDatum datum(field->second.schema);
+  avro::GenericReader::read(*decoder, datum);
+
+  return DecodeDatum(path, datum, false);
+}
+
+K RecordViewGet(K record_view, K path)
+{
+  if (path->t != -KS && path->t != KS)
+    return krr((S)"path not -11|11h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto view = GetForeign<RecordView>(record_view);
+
+  if (path->t == -KS)
+    return DecodeViewField(*view.get(), path->s);
+
+  K result = ktn(0, 0);
+  try {
+    for (auto i = 0; i < path->n; ++i)
+      jk(&result, DecodeViewField(*view.get(), kS(path)[i]));
+  } catch (...) {
+    r0(result);
+    throw;
+  }
+
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K RecordViewPaths(K record_view)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto view = GetForeign<RecordView>(record_view);
+
+  K result = ktn(KS, view->paths.size());
+  for (auto i = 0ull; i < view->paths.size(); ++i)
+    kS(result)[i] = ss((S)view->paths[i].c_str());
+
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Schema.h"
+
+
+// The structure that is stored in the record view foreign.
+//
+// Holds a reference to the kdb+ buffer containing the Avro binary serialised
+// record together with the offset and schema of every field reachable through
+// nested records.  The index is built with a single skip pass so that only the
+// fields which are subsequently requested are ever decoded.
+struct RecordView
+{
+  struct Field
+  {
+    size_t offset;
+    avro::NodePtr schema;
+  };
+
+  std::shared_ptr<AvroForeign> avro_foreign;
+  K data;
+  size_t data_offset;
+  size_t data_length;
+  std::unordered_map<std::string, Field> index;
+  std::vector<std::string> paths;
+
+  RecordView(std::shared_ptr<AvroForeign> avro_foreign_, K data_, size_t data_offset_) :
+    avro_foreign(avro_foreign_), data(r1(data_)), data_offset(data_offset_), data_length(data_->n - data_offset_)
+  {}
+
+  ~RecordView()
+  {
+    r0(data);
+  }
+
+  RecordView(const RecordView&) = delete;
+  RecordView& operator=(const RecordView&) = delete;
+
+  const uint8_t* Data() const
+  {
+    return (const uint8_t*)kG(data) + data_offset;
+  }
+};
+
+// Build a record view over Avro binary serialised data, used by Decode when
+// LAZY_DECODE is set
+K CreateRecordView(std::shared_ptr<AvroForeign> avro_foreign, K data, size_t decode_offset);
+
+extern "C"
+{
+  /// @brief Decode the value at a field path from a record view
+  ///
+  /// @param record_view.  Foreign object containing the record view, created
+  /// by decoding with the LAZY_DECODE option.
+  ///
+  /// @param path.  Symbol containing the dot separated path to the field,
+  /// descending through nested records (e.g. `a.b.c).  A null symbol decodes
+  /// the whole record.  Alternatively a symbol list of paths.
+  ///
+  /// @return kdb+ object representing the field having applied the appropriate
+  /// type mappings, or a mixed list of such objects if a list of paths was
+  /// specified.
+  EXP K RecordViewGet(K record_view, K path);
+
+  /// @brief Return the field paths available in a record view
+  ///
+  /// @param record_view.  Foreign object containing the record view.
+  ///
+  /// @return Symbol list of field paths in schema order.
+  EXP K RecordViewPaths(K record_view);
+}
@@ -0,0 +1,551 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/LogicalType.hh>
+
+#include "RowFilter.h"
+#include "TypeCheck.h"
+
+
+FieldPredicate::Op GetFilterOp(const std::string& op)
+{
+  if (op == "eq" || op == "=")
+    return FieldPredicate::EQ;
+  if (op == "ne" || op == "<>")
+    return FieldPredicate::NE;
+  if (op == "lt" || op == "<")
+    return FieldPredicate::LT;
+  if (op == "le" || op == "<=")
+    return FieldPredicate::LE;
+  if (op == "gt" || op == ">")
+    return FieldPredicate::GT;
+  if (op == "ge" || op == ">=")
+    return FieldPredicate::GE;
+  if (op == "in")
+    return FieldPredicate::IN;
+  if (op == "within")
+    return FieldPredicate::WITHIN;
+  throw TypeCheck("Unsupported filter op '" + op + "'");
+}
+
+// Read item i of a kdb+ atom or simple list of any integral or temporal type
+int64_t GetKdbLong(K value, size_t i)
+{
+  const bool atom = value->t < 0;
+  switch (std::abs(value->t)) {
+  case KB:
+  case KG:
+    return atom ? value->g : kG(value)[i];
+  case KH:
+    return atom ? value->h : kH(value)[i];
+  case KI:
+  case KM:
+  case KD:
+  case KU:
+  case KV:
+  case KT:
+    return atom ? value->i : kI(value)[i];
+  case KJ:
+  case KP:
+  case KN:
+    return atom ? value->j : kJ(value)[i];
+  default:
+    throw TypeCheck("Filter value has unsupported type " + std::to_string(value->t) + "h");
+  }
+}
+
+FieldPredicate::FieldPredicate(const avro::NodePtr& record, const std::string& op, const std::string& field, K value) :
+  field_(field), index_(0), value_branch_(-1), kind_(LONG), op_(GetFilterOp(op))
+{
+  if (!record->nameIndex(field_, index_))
+    throw TypeCheck("Filter field '" + field_ + "' is not a field of the record");
+
+  // Optional fields are a union of null and the field's type
+  node_ = ResolveSymbolic(record->leafAt(index_));
+  if (node_->type() == avro::AVRO_UNION) {
+    if (node_->leaves() != 2 || (node_->leafAt(0)->type() != avro::AVRO_NULL && node_->leafAt(1)->type() != avro::AVRO_NULL))
+      throw TypeCheck("Filter field '" + field_ + "' must be a union of null and one other type");
+    value_branch_ = node_->leafAt(0)->type() == avro::AVRO_NULL ? 1 : 0;
+    node_ = ResolveSymbolic(node_->leafAt(value_branch_));
+  }
+
+  const auto logical_type = node_->logicalType().type();
+  switch (node_->type()) {
+  case avro::AVRO_BOOL:
+  case avro::AVRO_ENUM:
+    if (op_ != EQ && op_ != NE && op_ != IN)
+      throw TypeCheck("Filter field '" + field_ + "' only supports eq, ne and in");
+    kind_ = LONG;
+    break;
+  case avro::AVRO_INT:
+    if (logical_type == avro::LogicalType::DATE || logical_type == avro::LogicalType::TIME_MILLIS)
+      temporal_ = std::make_shared<TemporalConversion>(field_, logical_type);
+    kind_ = LONG;
+    break;
+  case avro::AVRO_LONG:
+    if (logical_type == avro::LogicalType::TIME_MICROS || logical_type == avro::LogicalType::TIMESTAMP_MILLIS || logical_type == avro::LogicalType::TIMESTAMP_MICROS)
+      temporal_ = std::make_shared<TemporalConversion>(field_, logical_type);
+    kind_ = LONG;
+    break;
+  case avro::AVRO_FLOAT:
+  case avro::AVRO_DOUBLE:
+    kind_ = DOUBLE;
+    break;
+  case avro::AVRO_STRING:
+    if (logical_type != avro::LogicalType::NONE)
+      TYPE_CHECK_UNSUPPORTED(field_, "string with logical type");
+    kind_ = STRING;
+    break;
+  default:
+    TYPE_CHECK_UNSUPPORTED(field_, avro::toString(node_->type()));
+  }
+
+  SetValues(value);
+}
+
+void FieldPredicate::SetValues(K value)
+{
+  // A string is a single value of a string field rather than a list
+  const bool single = value->t < 0 || (kind_ == STRING && value->t == KC);
+  const size_t count = single ? 1 : value->n;
+  if (op_ == WITHIN) {
+    if (single || count != 2)
+      throw TypeCheck("Filter field '" + field_ + "' within requires a 2 item list");
+  } else if (op_ != IN && !single) {
+    throw TypeCheck("Filter field '" + field_ + "' value must be an atom");
+  }
+
+  const auto type_error = [this](K item) {
+    return TypeCheck("Filter field '" + field_ + "' value has unsupported type " + std::to_string(item->t) + "h");
+  };
+
+  // The items of a mixed list must each be an atom, which is read regardless
+  // of the index
+  const auto item_at = [value, &type_error](size_t i) -> K {
+    if (value->t != 0)
+      return value;
+    K item = kK(value)[i];
+    if (item->t >= 0)
+      throw type_error(item);
+    return item;
+  };
+
+  switch (kind_) {
+  case STRING:
+  {
+    for (size_t i = 0; i < count; ++i) {
+      K item = value->t == 0 ? kK(value)[i] : value;
+      if (item->t == KC)
+        strings_.push_back(std::string((const char*)kG(item), item->n));
+      else if (item->t == -KS)
+        strings_.push_back(item->s);
+      else if (item->t == KS)
+        strings_.push_back(kS(item)[i]);
+      else
+        throw type_error(item);
+    }
+    break;
+  }
+  case DOUBLE:
+  {
+    for (size_t i = 0; i < count; ++i) {
+      K item = item_at(i);
+      switch (std::abs(item->t)) {
+      case KE:
+        doubles_.push_back(item->t < 0 ? item->e : kE(item)[i]);
+        break;
+      case KF:
+        doubles_.push_back(item->t < 0 ? item->f : kF(item)[i]);
+        break;
+      case KH:
+      case KI:
+      case KJ:
+        doubles_.push_back((double)GetKdbLong(item, i));
+        break;
+      default:
+        throw type_error(item);
+      }
+    }
+    break;
+  }
+  case LONG:
+  default:
+  {
+    const auto datatype = avro::toString(node_->type());
+    if (node_->type() == avro::AVRO_ENUM) {
+      // Symbols are compared by their index in the enum, with those that are
+      // not in the enum never matching
+      for (size_t i = 0; i < count; ++i) {
+        K item = item_at(i);
+        TYPE_CHECK_KDB(field_, datatype, "filter value", KS, std::abs(item->t));
+        size_t symbol;
+        const std::string name = item->t < 0 ? item->s : kS(item)[i];
+        longs_.push_back(node_->nameIndex(name, symbol) ? (int64_t)symbol : -1);
+      }
+      break;
+    }
+
+    // Temporal fields must be compared with the kdb+ type they decode to
+    const auto expected = GetKdbArrayType(node_->type(), node_->logicalType().type());
+    for (size_t i = 0; i < count; ++i) {
+      K item = item_at(i);
+      const auto type = std::abs(item->t);
+      if (temporal_ || expected == KB) {
+        TYPE_CHECK_KDB(field_, datatype, "filter value", expected, type);
+      } else if (type != KH && type != KI && type != KJ) {
+        throw type_error(item);
+      }
+      longs_.push_back(GetKdbLong(item, i));
+    }
+    break;
+  }
+  }
+}
+
+size_t FieldPredicate::ValueCount() const
+{
+  switch (kind_) {
+  case STRING:
+    return strings_.size();
+  case DOUBLE:
+    return doubles_.size();
+  case LONG:
+  default:
+    return longs_.size();
+  }
+}
+
+int FieldPredicate::CompareTo(const FilterValue& value, size_t i) const
+{
+  switch (kind_) {
+  case STRING:
+  {
+    const auto& other = strings_[i];
+    const auto result = std::memcmp(value.string_value, other.data(), std::min(value.string_length, other.length()));
+    if (result != 0)
+      return result < 0 ? -1 : 1;
+    return value.string_length < other.length() ? -1 : value.string_length > other.length() ? 1 : 0;
+  }
+  case DOUBLE:
+    return value.double_value < doubles_[i] ? -1 : value.double_value > doubles_[i] ? 1 : 0;
+  case LONG:
+  default:
+    return value.long_value < longs_[i] ? -1 : value.long_value > longs_[i] ? 1 : 0;
+  }
+}
+
+void FieldPredicate::Read(BinaryCursor& cursor, FilterValue& value) const
+{
+  value.is_null = false;
+  if (value_branch_ >= 0) {
+    const auto branch = cursor.ReadLong();
+    if (branch != value_branch_) {
+      if (branch != 1 - value_branch_)
+        throw BinaryCursor::InvalidData("Invalid union branch: " + std::to_string(branch));
+      value.is_null = true;
+      return;
+    }
+  }
+
+  switch (node_->type()) {
+  case avro::AVRO_BOOL:
+    value.long_value = *cursor.Read(1) != 0;
+    break;
+  case avro::AVRO_INT:
+  case avro::AVRO_LONG:
+    value.long_value = cursor.ReadLong();
+    if (temporal_)
+      value.long_value = temporal_->AvroToKdb(value.long_value);
+    break;
+  case avro::AVRO_ENUM:
+    value.long_value = cursor.ReadLong();
+    break;
+  case avro::AVRO_FLOAT:
+  {
+    float float_value;
+    std::memcpy(&float_value, cursor.Read(sizeof(float)), sizeof(float));
+    value.double_value = float_value;
+    value.is_null = std::isnan(value.double_value);
+    break;
+  }
+  case avro::AVRO_DOUBLE:
+    std::memcpy(&value.double_value, cursor.Read(sizeof(double)), sizeof(double));
+    value.is_null = std::isnan(value.double_value);
+    break;
+  case avro::AVRO_STRING:
+  default:
+    value.string_length = cursor.ReadLength();
+    value.string_value = (const char*)cursor.Read(value.string_length);
+    break;
+  }
+}
+
+void FieldPredicate::Read(const avro::GenericRecord& record, FilterValue& value) const
+{
+  const auto& datum = record.fieldAt(index_);
+  value.is_null = datum.type() == avro::AVRO_NULL;
+  if (value.is_null)
+    return;
+
+  switch (node_->type()) {
+  case avro::AVRO_BOOL:
+    value.long_value = datum.value<bool>();
+    break;
+  case avro::AVRO_INT:
+    value.long_value = datum.value<int32_t>();
+    if (temporal_)
+      value.long_value = temporal_->AvroToKdb(value.long_value);
+    break;
+  case avro::AVRO_LONG:
+    value.long_value = datum.value<int64_t>();
+    if (temporal_)
+      value.long_value = temporal_->AvroToKdb(value.long_value);
+    break;
+  case avro::AVRO_ENUM:
+    value.long_value = datum.value<avro::GenericEnum>().value();
+    break;
+  case avro::AVRO_FLOAT:
+    value.double_value = datum.value<float>();
+    value.is_null = std::isnan(value.double_value);
+    break;
+  case avro::AVRO_DOUBLE:
+    value.double_value = datum.value<double>();
+    value.is_null = std::isnan(value.double_value);
+    break;
+  case avro::AVRO_STRING:
+  default:
+  {
+    const auto& string = datum.value<std::string>();
+    value.string_value = string.data();
+    value.string_length = string.length();
+    break;
+  }
+  }
+}
+
+bool FieldPredicate::Evaluate(const FilterValue& value) const
+{
+  // Null never satisfies a predicate
+  if (value.is_null)
+    return false;
+
+  switch (op_) {
+  case EQ:
+    return CompareTo(value, 0) == 0;
+  case NE:
+    return CompareTo(value, 0) != 0;
+  case LT:
+    return CompareTo(value, 0) < 0;
+  case LE:
+    return CompareTo(value, 0) <= 0;
+  case GT:
+    return CompareTo(value, 0) > 0;
+  case GE:
+    return CompareTo(value, 0) >= 0;
+  case WITHIN:
+    return CompareTo(value, 0) >= 0 && CompareTo(value, 1) <= 0;
+  case IN:
+  default:
+    for (size_t i = 0; i < ValueCount(); ++i) {
+      if (CompareTo(value, i) == 0)
+        return true;
+    }
+    return false;
+  }
+}
+
+// Whether a block index min or max column holds values which can be compared
+// with the predicate
+bool IsIndexColumnComparable(K column, FieldPredicate::Kind kind)
+{
+  switch (column->t) {
+  case KE:
+  case KF:
+    return kind == FieldPredicate::DOUBLE;
+  case KH:
+  case KI:
+  case KJ:
+  case KM:
+  case KD:
+  case KT:
+  case KP:
+  case KN:
+    return kind == FieldPredicate::LONG;
+  default:
+    return false;
+  }
+}
+
+// Read item i of a block index min or max column, returning false if it is
+// null
+bool GetIndexValue(K column, size_t i, FilterValue& value)
+{
+  value.is_null = false;
+  switch (column->t) {
+  case KE:
+  case KF:
+    value.double_value = column->t == KE ? kE(column)[i] : kF(column)[i];
+    return !std::isnan(value.double_value);
+  case KH:
+    value.long_value = kH(column)[i];
+    return value.long_value != nh;
+  case KJ:
+  case KP:
+  case KN:
+    value.long_value = kJ(column)[i];
+    return value.long_value != nj;
+  default:
+    value.long_value = kI(column)[i];
+    return value.long_value != ni;
+  }
+}
+
+bool FieldPredicate::MayMatch(K min_column, K max_column, size_t block) const
+{
+  if (kind_ == STRING || node_->type() == avro::AVRO_BOOL || node_->type() == avro::AVRO_ENUM)
+    return true;
+  if (!IsIndexColumnComparable(min_column, kind_) || !IsIndexColumnComparable(max_column, kind_))
+    return true;
+
+  // A null range means the field was null throughout the block, which no
+  // predicate matches
+  FilterValue min;
+  FilterValue max;
+  if (!GetIndexValue(min_column, block, min) || !GetIndexValue(max_column, block, max))
+    return false;
+
+  switch (op_) {
+  case EQ:
+    return CompareTo(min, 0) <= 0 && CompareTo(max, 0) >= 0;
+  case NE:
+    return !(CompareTo(min, 0) == 0 && CompareTo(max, 0) == 0);
+  case LT:
+    return CompareTo(min, 0) < 0;
+  case LE:
+    return CompareTo(min, 0) <= 0;
+  case GT:
+    return CompareTo(max, 0) > 0;
+  case GE:
+    return CompareTo(max, 0) >= 0;
+  case WITHIN:
+    return CompareTo(max, 0) >= 0 && CompareTo(min, 1) <= 0;
+  case IN:
+  default:
+    for (size_t i = 0; i < ValueCount(); ++i) {
+      if (CompareTo(min, i) <= 0 && CompareTo(max, i) >= 0)
+        return true;
+    }
+    return false;
+  }
+}
+
+RowFilter::RowFilter(const avro::NodePtr& record, K filter) :
+  record_(ResolveSymbolic(record))
+{
+  if (record_->type() != avro::AVRO_RECORD)
+    throw TypeCheck("FILTER requires a record schema");
+  if (filter->t != 0 && filter->t != KS)
+    throw TypeCheck("FILTER not 0|11h");
+
+  if (filter->t == KS || (filter->n == 3 && kK(filter)[0]->t == -KS)) {
+    AddPredicate(filter);
+  } else {
+    for (auto i = 0; i < filter->n; ++i)
+      AddPredicate(kK(filter)[i]);
+  }
+
+  std::stable_sort(predicates_.begin(), predicates_.end(), [](const FieldPredicate& a, const FieldPredicate& b) {
+    return a.Index() < b.Index();
+  });
+}
+
+void RowFilter::AddPredicate(K predicate)
+{
+  if ((predicate->t != 0 && predicate->t != KS) || predicate->n != 3)
+    throw TypeCheck("Filter predicate must be a 3 item (op; field; value) list");
+
+  // A predicate comparing with a symbol is collapsed by kdb+ to a symbol list
+  if (predicate->t == KS) {
+    K value = ks(kS(predicate)[2]);
+    try {
+      predicates_.emplace_back(record_, kS(predicate)[0], kS(predicate)[1], value);
+    } catch (...) {
+      r0(value);
+      throw;
+    }
+    r0(value);
+    return;
+  }
+
+  K op = kK(predicate)[0];
+  K field = kK(predicate)[1];
+  if (op->t != -KS)
+    throw TypeCheck("Filter op not -11h");
+  if (field->t != -KS)
+    throw TypeCheck("Filter field not -11h");
+  predicates_.emplace_back(record_, op->s, field->s, kK(predicate)[2]);
+}
+
+bool RowFilter::Matches(const uint8_t* data, size_t length) const
+{
+  BinaryCursor cursor(data, length);
+  FilterValue value;
+  size_t field = 0;
+  for (const auto& predicate : predicates_) {
+    // Several predicates on the same field share the value already read
+    while (field < predicate.Index())
+      cursor.SkipDatum(record_->leafAt(field++));
+    if (field == predicate.Index()) {
+      predicate.Read(cursor, value);
+      ++field;
+    }
+    if (!predicate.Evaluate(value))
+      return false;
+  }
+  return true;
+}
+
+bool RowFilter::Matches(const avro::GenericDatum& datum) const
+{
+  const auto& record = datum.value<avro::GenericRecord>();
+  FilterValue value;
+  for (const auto& predicate : predicates_) {
+    predicate.Read(record, value);
+    if (!predicate.Evaluate(value))
+      return false;
+  }
+  return true;
+}
+
+bool RowFilter::MayMatch(K index, size_t block) const
+{
+  K keys = kK(index->k)[0];
+  K values = kK(index->k)[1];
+  auto column = [keys, values](const std::string& name) -> K {
+    for (auto i = 0; i < keys->n; ++i) {
+      if (name == kS(keys)[i])
+        return kK(values)[i];
+    }
+    return NULL;
+  };
+
+  for (const auto& predicate : predicates_) {
+    K min_column = column(predicate.Field() + "Min");
+    K max_column = column(predicate.Field() + "Max");
+    if (min_column && max_column && !predicate.MayMatch(min_column, max_column, block))
+      return false;
+  }
+  return true;
+}
+
+std::shared_ptr<RowFilter> GetRowFilter(const avro::NodePtr& record, const KdbOptions& options)
+{
+  K filter;
+  if (!options.GetObjectOption(Options::FILTER, filter))
+    return nullptr;
+  return std::make_shared<RowFilter>(record, filter);
+}
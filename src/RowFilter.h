@@ -0,0 +1,117 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <avro/GenericDatum.hh>
+
+#include "HelperFunctions.h"
+#include "BinaryCursor.h"
+#include "KdbOptions.h"
+
+
+// Value of a top level field read for comparison against a predicate.
+// Integral, boolean, enum (as its symbol index) and temporal fields are held
+// as a long in their kdb+ representation, float and double as a double and
+// strings as a pointer to their bytes.
+struct FilterValue
+{
+  bool is_null;
+  int64_t long_value;
+  double double_value;
+  const char* string_value;
+  size_t string_length;
+};
+
+// A single (op; field; value) predicate on a top level field of a record
+class FieldPredicate
+{
+public:
+  enum Op { EQ, NE, LT, LE, GT, GE, IN, WITHIN };
+  enum Kind { LONG, DOUBLE, STRING };
+
+private:
+  std::string field_;
+  size_t index_;
+  avro::NodePtr node_;
+  // Union branch holding the value, or -1 if the field is not a union
+  int64_t value_branch_;
+  Kind kind_;
+  std::shared_ptr<TemporalConversion> temporal_;
+  Op op_;
+
+  // Values to compare against, in the representation described by FilterValue
+  std::vector<int64_t> longs_;
+  std::vector<double> doubles_;
+  std::vector<std::string> strings_;
+
+  void SetValues(K value);
+
+  size_t ValueCount() const;
+
+  // Three way comparison of a field value with one of the predicate's values
+  int CompareTo(const FilterValue& value, size_t i) const;
+
+public:
+  FieldPredicate(const avro::NodePtr& record, const std::string& op, const std::string& field, K value);
+
+  const std::string& Field() const
+  {
+    return field_;
+  }
+
+  size_t Index() const
+  {
+    return index_;
+  }
+
+  // Read the field's value from binary data positioned at the start of the
+  // field, leaving the cursor positioned after it
+  void Read(BinaryCursor& cursor, FilterValue& value) const;
+
+  // Read the field's value from a decoded record
+  void Read(const avro::GenericRecord& record, FilterValue& value) const;
+
+  bool Evaluate(const FilterValue& value) const;
+
+  // Whether a block whose values of the field lie within the min and max items
+  // of the block index columns could contain a matching row.  Null min and
+  // max mean the field was null throughout the block.
+  bool MayMatch(K min_column, K max_column, size_t block) const;
+};
+
+// A set of predicates which must all be satisfied for a record to be kept.
+//
+// The filter can be evaluated against Avro binary data, reading only as far
+// as the last field referenced by a predicate and stopping at the first
+// predicate which fails, so records which are rejected are never decoded.
+class RowFilter
+{
+private:
+  avro::NodePtr record_;
+  // Sorted by field index so the fields are visited in the order they are
+  // serialised
+  std::vector<FieldPredicate> predicates_;
+
+  void AddPredicate(K predicate);
+
+public:
+  // The filter is either a single (op; field; value) predicate or a list of
+  // them
+  RowFilter(const avro::NodePtr& record, K filter);
+
+  // Evaluate against a record in Avro binary format
+  bool Matches(const uint8_t* data, size_t length) const;
+
+  // Evaluate against a decoded record
+  bool Matches(const avro::GenericDatum& datum) const;
+
+  // Whether the block at the specified row of a block index could contain a
+  // matching row, using the <field>Min and <field>Max columns for any field
+  // with a predicate
+  bool MayMatch(K index, size_t block) const;
+};
+
+// Parse the FILTER option if it has been set, returning NULL otherwise
+std::shared_ptr<RowFilter> GetRowFilter(const avro::NodePtr& record, const KdbOptions& options);
@@ -2,6 +2,8 @@
 #include <memory>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <map>
 #include <set>
 #include <mutex>
 
@@ -16,10 +18,91 @@
 #include "Schema.h"
 #include "TypeCheck.h"
 #include "GenericForeign.h"
+#include "Fingerprint.h"
 
 #include "k.h"
 
 
+avro::EncoderPtr AvroForeign::BinaryEncoder()
+{
+  if (!binary_encoder)
+    binary_encoder = avro::validatingEncoder(*schema.get(), avro::binaryEncoder());
+  return binary_encoder;
+}
+
+avro::DecoderPtr AvroForeign::BinaryDecoder()
+{
+  if (!binary_decoder)
+    binary_decoder = avro::validatingDecoder(*schema.get(), avro::binaryDecoder());
+  return binary_decoder;
+}
+
+void AvroForeign::SetBinaryDecoder(avro::DecoderPtr decoder)
+{
+  binary_decoder = decoder;
+}
+
+// Compiled schemas keyed by the SHA-256 digest of their JSON text.  Compiling
+// a schema is expensive, so identical schemas share the same compiled
+// ValidSchema rather than each compiling their own.
+//
+// Each schema foreign has its own AvroForeign, so the encoders, decoders and
+// datums which are reused from one call to the next are never shared between
+// foreigns.  Only weak references are held so a compiled schema is freed with
+// the last foreign using it, and its expired entry is removed on the next
+// miss.
+class SchemaCache
+{
+private:
+  std::map<std::string, std::weak_ptr<avro::ValidSchema>> schemas;
+  std::mutex schemas_mutex;
+
+  void RemoveExpired()
+  {
+    for (auto it = schemas.begin(); it != schemas.end();) {
+      if (it->second.expired())
+        it = schemas.erase(it);
+      else
+        ++it;
+    }
+  }
+
+public:
+  static SchemaCache& Instance()
+  {
+    static SchemaCache schema_cache;
+    return schema_cache;
+  }
+
+  std::shared_ptr<avro::ValidSchema> Get(const std::string& json)
+  {
+    const auto digest = Sha256(json.data(), json.length());
+    const std::string key(digest.begin(), digest.end());
+
+    std::lock_guard<std::mutex> lock(schemas_mutex);
+    auto cached = schemas.find(key);
+    if (cached != schemas.end()) {
+      auto schema = cached->second.lock();
+      if (schema)
+        return schema;
+    }
+
+    RemoveExpired();
+    auto schema = std::make_shared<avro::ValidSchema>(avro::compileJsonSchemaFromString(json));
+    schemas[key] = schema;
+    return schema;
+  }
+
+  size_t Clear()
+  {
+    std::lock_guard<std::mutex> lock(schemas_mutex);
+    RemoveExpired();
+    const auto count = schemas.size();
+    schemas.clear();
+    return count;
+  }
+};
+
 K SchemaFromFile(K filename)
 {
   if (!IsKdbString(filename))
@@ -27,9 +110,14 @@ K SchemaFromFile(K filename)
 
   KDB_EXCEPTION_TRY;
 
-  auto avro_schema = avro::compileJsonSchemaFromFile(GetKdbString(filename).c_str());
+  const auto filename_str = GetKdbString(filename);
+  std::ifstream file(filename_str, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Cannot open file: " + filename_str);
+  std::ostringstream json;
+  json << file.rdbuf();
 
-  return MakeForeign(AvroForeign(avro_schema));
+  return MakeForeign(std::make_shared<AvroForeign>(SchemaCache::Instance().Get(json.str())));
 
   KDB_EXCEPTION_CATCH;
 }
@@ -41,9 +129,7 @@ K SchemaFromString(K schema)
 
   KDB_EXCEPTION_TRY;
 
-  auto avro_schema = avro::compileJsonSchemaFromString(GetKdbString(schema));
-
-  return MakeForeign(AvroForeign(avro_schema));
+  return MakeForeign(std::make_shared<AvroForeign>(SchemaCache::Instance().Get(GetKdbString(schema))));
 
   KDB_EXCEPTION_CATCH;
 }
@@ -61,3 +147,12 @@ K GetSchema(K schema)
 
   KDB_EXCEPTION_CATCH;
 }
+
+K ClearSchemaCache(K unused)
+{
+  KDB_EXCEPTION_TRY;
+
+  return kj(SchemaCache::Instance().Clear());
+
+  KDB_EXCEPTION_CATCH;
+}
@@ -5,36 +5,70 @@
 #include <mutex>
 
 #include "HelperFunctions.h"
+#include "Fingerprint.h"
+#include "DatumPool.h"
+#include "MemoryStats.h"
 
 
 // The structure that is stored in the avro foreign.
 //
-// Creating/destructing encoders and decoders is expensive so we create the
-// various types here in advance for this schema and associate them with the
-// foreign.  This allows these encoders/decoders to be reused on each subsequent
-// encode or decode operation.
+// The compiled schema is immutable so may be shared, via the schema cache, with
+// other foreigns created from identical JSON.  Everything else is owned by this
+// foreign alone.
+//
+// Creating/destructing encoders and decoders is expensive so those created for
+// this schema are associated with the foreign.  This allows these
+// encoders/decoders to be reused on each subsequent encode or decode
+// operation.
+//
+// The encoders/decoders are only created on first use since many schemas are
+// only used for encoding or decoding.  JSON is encoded and decoded directly
+// between kdb+ and text so doesn't use them.
+//
+// The CRC-64-AVRO fingerprint used to identify the schema in single object
+// encoding is also calculated once up front.
+//
+// Datums used by Encode and Decode are leased from the schema's datum pool so
+// that their storage is reused between calls.
+//
+// Memory allocated for the schema outside of kdb+ is charged to its account,
+// which is shared by every schema with the same fingerprint.
 struct AvroForeign
 {
   std::shared_ptr<avro::ValidSchema> schema;
+  uint64_t fingerprint;
+  MemoryAccount* memory;
+  DatumPool datums;
+
+private:
   avro::EncoderPtr binary_encoder;
-  avro::EncoderPtr json_encoder;
-  avro::EncoderPtr json_pretty_encoder;
   avro::DecoderPtr binary_decoder;
-  avro::DecoderPtr json_decoder;
-
-  AvroForeign(const avro::ValidSchema& schema_) :
-    schema(std::make_shared<avro::ValidSchema>(schema_)),
-    binary_encoder(avro::validatingEncoder(schema_, avro::binaryEncoder())),
-    json_encoder(avro::validatingEncoder(schema_, avro::jsonEncoder(schema_))),
-    json_pretty_encoder(avro::validatingEncoder(schema_, avro::jsonPrettyEncoder(schema_))),
-    binary_decoder(avro::validatingDecoder(schema_, avro::binaryDecoder())),
-    json_decoder(avro::validatingDecoder(schema_, avro::jsonDecoder(schema_)))
+
+public:
+  AvroForeign(std::shared_ptr<avro::ValidSchema> schema_) :
+    schema(schema_),
+    fingerprint(Crc64Fingerprint(schema_->root())),
+    memory(MemoryStats::Instance().Schema(fingerprint)),
+    datums(schema_->root(), memory)
   {}
+
+  AvroForeign(const AvroForeign&) = delete;
+  AvroForeign& operator=(const AvroForeign&) = delete;
+
+  // Getter functions for the encoders/decoders, creating them if required
+  avro::EncoderPtr BinaryEncoder();
+  avro::DecoderPtr BinaryDecoder();
+
+  // Replace a decoder which can no longer be reused
+  void SetBinaryDecoder(avro::DecoderPtr decoder);
 };
 
 extern "C" {
   /// @brief Create a compiled Avro schema from a JSON file
   ///
+  /// If a schema with identical JSON has already been compiled, and is still
+  /// in use, then the cached compiled schema is reused.
+  ///
   /// @param filename.  String containing the filename.
   ///
   /// @return foreign containing the compiled Avro schema.  This will be garbage
@@ -43,6 +77,9 @@ extern "C" {
 
   /// @brief Create a compiled Avro schema from a JSON string
   ///
+  /// If a schema with identical JSON has already been compiled, and is still
+  /// in use, then the cached compiled schema is reused.
+  ///
   /// @param filename.  String containing the Avro JSON schema.
   ///
   /// @return foreign containing the compiled Avro schema.  This will be garbage
@@ -56,4 +93,19 @@ extern "C" {
   ///
   /// @return String containing the Avro JSON schema
   EXP K GetSchema(K schema);
+
+  /// @brief Remove all the compiled schemas from the schema cache
+  ///
+  /// SchemaFromFile and SchemaFromString cache each compiled schema, keyed by
+  /// the SHA-256 digest of its JSON, so that compiling an identical schema
+  /// again reuses the existing compiled schema.  The cache only references
+  /// schemas which are in use by a schema foreign, so an entry is dropped once
+  /// every foreign using it has been freed.  Schema foreigns which are already
+  /// in use are unaffected.
+  ///
+  /// @param unused.
+  ///
+  /// @return Number of compiled schemas still in use which were removed from
+  /// the cache
+  EXP K ClearSchemaCache(K unused);
 }
@@ -0,0 +1,128 @@
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Decode.h"
+#include "SingleObject.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+// Schemas which have been registered for single object decoding, keyed by
+// their CRC-64-AVRO fingerprint
+class SchemaRegistry
+{
+private:
+  std::map<uint64_t, std::shared_ptr<AvroForeign>> schemas;
+  std::mutex schemas_mutex;
+
+public:
+  static SchemaRegistry& Instance()
+  {
+    static SchemaRegistry schema_registry;
+    return schema_registry;
+  }
+
+  void Add(std::shared_ptr<AvroForeign> avro_foreign)
+  {
+    std::lock_guard<std::mutex> lock(schemas_mutex);
+    schemas[avro_foreign->fingerprint] = avro_foreign;
+  }
+
+  std::shared_ptr<AvroForeign> Find(uint64_t fingerprint)
+  {
+    std::lock_guard<std::mutex> lock(schemas_mutex);
+    const auto it = schemas.find(fingerprint);
+    if (it == schemas.end())
+      return nullptr;
+    return it->second;
+  }
+};
+
+void WriteSingleObjectHeader(avro::OutputStream& ostream, uint64_t fingerprint)
+{
+  uint8_t header[kSingleObjectHeaderSize];
+  header[0] = kSingleObjectMarker[0];
+  header[1] = kSingleObjectMarker[1];
+  for (auto i = 0; i < 8; ++i)
+    header[2 + i] = (uint8_t)(fingerprint >> (i * 8));
+
+  // The stream may return less space than requested so keep going until the
+  // whole header has been written
+  size_t written = 0;
+  while (written < sizeof(header)) {
+    uint8_t* data;
+    size_t length;
+    ostream.next(&data, &length);
+    const auto n = std::min(length, sizeof(header) - written);
+    std::memcpy(data, header + written, n);
+    ostream.backup(length - n);
+    written += n;
+  }
+}
+
+uint64_t ReadSingleObjectHeader(const uint8_t* data, size_t length)
+{
+  if (length < kSingleObjectHeaderSize)
+    throw std::invalid_argument("Single object data shorter than header");
+  if (data[0] != kSingleObjectMarker[0] || data[1] != kSingleObjectMarker[1])
+    throw std::invalid_argument("Single object marker not found");
+
+  uint64_t fingerprint = 0;
+  for (auto i = 0; i < 8; ++i)
+    fingerprint |= (uint64_t)data[2 + i] << (i * 8);
+  return fingerprint;
+}
+
+std::shared_ptr<AvroForeign> FindRegisteredSchema(uint64_t fingerprint)
+{
+  auto avro_foreign = SchemaRegistry::Instance().Find(fingerprint);
+  if (!avro_foreign) {
+    std::ostringstream error;
+    error << "No schema registered with fingerprint 0x" << std::hex << std::setfill('0') << std::setw(16) << fingerprint;
+    throw std::invalid_argument(error.str());
+  }
+  return avro_foreign;
+}
+
+K RegisterSchema(K schema)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  SchemaRegistry::Instance().Add(avro_foreign);
+
+  K result = ktn(KG, 8);
+  for (auto i = 0; i < 8; ++i)
+    kG(result)[i] = (G)(avro_foreign->fingerprint >> (i * 8));
+
+  return result;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K DecodeSingleObject(K data, K options)
+{
+  if (data->t != KG)
+    return krr((S)"data not 4h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  int64_t decode_offset = 0;
+  options_parser.GetIntOption(Options::DECODE_OFFSET, decode_offset);
+  if (decode_offset < 0)
+    return krr((S)"DECODE_OFFSET must be non-negative");
+  if (decode_offset > data->n)
+    return krr((S)"Decode offset is greater than length of data");
+
+  const auto fingerprint = ReadSingleObjectHeader(kG(data) + decode_offset, data->n - decode_offset);
+
+  return DecodeForeign(FindRegisteredSchema(fingerprint), data, options_parser, true);
+
+  KDB_EXCEPTION_CATCH;
+}
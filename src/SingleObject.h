@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <avro/Stream.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+
+
+// Avro single object encoding prefixes the binary datum with a two byte marker
+// followed by the little endian CRC-64-AVRO fingerprint of the writer schema
+const uint8_t kSingleObjectMarker[2] = { 0xC3, 0x01 };
+const size_t kSingleObjectHeaderSize = 10;
+
+// Writes the single object header for the schema to the output stream
+void WriteSingleObjectHeader(avro::OutputStream& ostream, uint64_t fingerprint);
+
+// Returns the fingerprint from a single object header, throwing if the data is
+// too short or doesn't start with the marker
+uint64_t ReadSingleObjectHeader(const uint8_t* data, size_t length);
+
+// Returns the schema registered with the fingerprint, throwing if there isn't
+// one
+std::shared_ptr<AvroForeign> FindRegisteredSchema(uint64_t fingerprint);
+
+extern "C"
+{
+  /// @brief Register a compiled Avro schema so that single object encoded
+  /// data written with it can be decoded by DecodeSingleObject
+  ///
+  /// Schemas are registered by the CRC-64-AVRO fingerprint of their Parsing
+  /// Canonical Form.  Registering a schema with the same fingerprint as one
+  /// already registered replaces it.
+  ///
+  /// @param schema.  Foreign object containing the Avro schema.
+  ///
+  /// @return 4h list containing the 8 byte fingerprint
+  EXP K RegisterSchema(K schema);
+
+  /// @brief Decode Avro single object encoded data using the registered schema
+  /// identified by its fingerprint
+  ///
+  /// Supported options:
+  ///
+  /// * DECODE_OFFSET (long).  Offset into data that decoding should begin
+  /// from.  Default 0.
+  ///
+  /// * MULTITHREADED (long).  By default avrokdb is optimised to reuse the
+  /// existing decoder for this schema.  However, Avro decoders do not support
+  /// concurrent access and therefore if running decode with peach this option
+  /// must be set to non-zero to disable this optimisation.  Default 0.
+  ///
+  /// @param data.  4h list containing the single object encoded data.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return kdb+ object representing the Avro data having applied the
+  /// appropriate type mappings
+  EXP K DecodeSingleObject(K data, K options);
+}
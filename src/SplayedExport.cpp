@@ -0,0 +1,118 @@
+#include <deque>
+
+#include <avro/DataFile.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Encode.h"
+#include "SplayedExport.h"
+#include "ThreadPool.h"
+#include "TypeCheck.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+avro::Codec GetCodec(const std::string& codec)
+{
+  if (codec == "null")
+    return avro::NULL_CODEC;
+  if (codec == "deflate")
+    return avro::DEFLATE_CODEC;
+#ifdef SNAPPY_CODEC_AVAILABLE
+  if (codec == "snappy")
+    return avro::SNAPPY_CODEC;
+#endif
+  throw std::invalid_argument("Unsupported CODEC '" + codec + "'");
+}
+
+K ExportSplayed(K table, K schema, K filename, K options)
+{
+  if (!IsKdbString(table) && table->t != XT)
+    return krr((S)"table not -11|10|98h");
+  if (!IsKdbString(filename))
+    return krr(S("ExportSplayed, filename expected -11|10h"));
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  int64_t block_rows = 10000;
+  options_parser.GetIntOption(Options::BLOCK_ROWS, block_rows);
+  if (block_rows <= 0)
+    return krr((S)"BLOCK_ROWS must be positive");
+
+  std::string codec = "null";
+  options_parser.GetStringOption(Options::CODEC, codec);
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+  const auto& avro_schema = *avro_foreign->schema;
+  const auto root = ResolveSymbolic(avro_schema.root());
+  if (root->type() != avro::AVRO_RECORD)
+    return krr((S)"ExportSplayed requires a record schema");
+
+  // A splayed table's columns are mapped by get rather than read
+  std::vector<K> refs;
+  K data = table;
+  if (table->t != XT) {
+    auto handle = GetKdbString(table);
+    if (handle.empty() || handle[0] != ':')
+      handle = ":" + handle;
+    data = Evaluate("Cannot load table " + handle, "get", ks((S)handle.c_str()));
+    refs.push_back(data);
+    if (data->t != XT) {
+      for (auto ref : refs)
+        r0(ref);
+      return krr((S)"table is not a splayed table");
+    }
+  }
+
+  // The columns are read by the encoding tasks so must outlive them
+  std::vector<ExportColumn> columns;
+  std::deque<std::future<std::vector<uint8_t>>> pending;
+  std::deque<size_t> pending_rows;
+  try {
+    columns = GetExportColumns(root, data, refs);
+    const size_t rows = columns.empty() ? 0 : columns.front().data->n;
+
+    // Blocks are only written when flushed so the sync interval is set to its
+    // maximum to stop the writer starting a new block itself
+    avro::DataFileWriterBase writer(GetKdbFilename(filename).c_str(), avro_schema, 1 << 30, GetCodec(codec));
+
+    auto& pool = ThreadPool::Shared();
+    const size_t max_pending = pool.Size() * 2;
+    size_t next = 0;
+    bool first = true;
+    while (next < rows || !pending.empty()) {
+      while (next < rows && pending.size() < max_pending) {
+        const auto end = std::min(rows, next + (size_t)block_rows);
+        pending.push_back(pool.Submit([&avro_schema, &columns, next, end] { return EncodeRows(avro_schema, columns, next, end); }));
+        pending_rows.push_back(end - next);
+        next = end;
+      }
+
+      // Flushing ends the previous block, which leaves the final block to be
+      // ended by close
+      const auto bytes = pending.front().get();
+      pending.pop_front();
+      if (!first)
+        writer.flush();
+      first = false;
+      writer.encoder().encodeFixed(bytes.data(), bytes.size());
+      for (size_t i = 0; i < pending_rows.front(); ++i)
+        writer.incr();
+      pending_rows.pop_front();
+    }
+    writer.close();
+
+    for (auto ref : refs)
+      r0(ref);
+    return kj(rows);
+  } catch (...) {
+    WaitAll(pending);
+    for (auto ref : refs)
+      r0(ref);
+    throw;
+  }
+
+  KDB_EXCEPTION_CATCH;
+}
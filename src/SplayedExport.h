@@ -0,0 +1,48 @@
+#pragma once
+
+#include <avro/DataFile.hh>
+
+#include "HelperFunctions.h"
+
+
+// Convert the CODEC option to the avro codec, throwing if it is not supported
+avro::Codec GetCodec(const std::string& codec);
+
+extern "C"
+{
+  /// @brief Export a splayed kdb+ table to an Avro Object Container File
+  ///
+  /// The table's column files are memory mapped rather than read into memory.
+  /// Blocks of rows are encoded in parallel on avrokdb's thread pool, reading
+  /// directly from the mapped columns, and are written to the file in order as
+  /// they complete.  Only a bounded number of encoded blocks are held waiting
+  /// to be written at any time.
+  ///
+  /// Symbol columns which are enumerated against a sym file are resolved using
+  /// the enumeration's domain, which must be loaded in the q session.
+  ///
+  /// Supported options:
+  ///
+  /// * BLOCK_ROWS (long).  Number of rows in each block of the file.  Default
+  /// 10000.
+  ///
+  /// * CODEC (string).  Compression codec used for the blocks.  Valid options
+  /// "null" or "deflate", or "snappy" if avro-cpp was built with snappy
+  /// support.  Default "null".
+  ///
+  /// @param table.  Symbol or string containing the directory of the splayed
+  /// table, or an in-memory table.
+  ///
+  /// @param schema.  Foreign object containing the Avro record schema to use
+  /// for encoding.  Each field is encoded from the table column of the same
+  /// name.
+  ///
+  /// @param filename.  String or symbol containing the filename to write.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Number of rows written
+  EXP K ExportSplayed(K table, K schema, K filename, K options);
+}
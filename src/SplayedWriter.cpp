@@ -0,0 +1,79 @@
+#include <avro/GenericDatum.hh>
+
+#include "HelperFunctions.h"
+#include "Decode.h"
+#include "FileReader.h"
+#include "SplayedWriter.h"
+#include "TypeCheck.h"
+#include "KdbOptions.h"
+
+
+// Database root as a file handle, without a trailing separator
+std::string GetDatabaseHandle(K db)
+{
+  auto handle = GetKdbString(db);
+  while (!handle.empty() && handle.back() == '/')
+    handle.pop_back();
+  if (handle.empty() || handle[0] != ':')
+    handle = ":" + handle;
+  return handle;
+}
+
+K WriteSplayed(K filename, K db, K table, K options)
+{
+  if (!IsKdbString(filename))
+    return krr(S("WriteSplayed, filename expected -11|10h"));
+  if (!IsKdbString(db))
+    return krr((S)"db not -11|10h");
+  if (table->t != -KS)
+    return krr((S)"table not -11h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options, Options::object_options);
+
+  std::string partition;
+  options_parser.GetStringOption(Options::PARTITION, partition);
+
+  int64_t batch_size = 4096;
+  options_parser.GetIntOption(Options::READ_BATCH_SIZE, batch_size);
+
+  auto file_reader = CreateFileReader(GetKdbFilename(filename), options_parser);
+  const auto& root = file_reader->Schema().root();
+  if (root->type() != avro::AVRO_RECORD)
+    throw TypeCheck("WriteSplayed requires a record schema");
+
+  const auto db_handle = GetDatabaseHandle(db);
+  auto table_handle = db_handle + "/";
+  if (!partition.empty())
+    table_handle += partition + "/";
+  table_handle += std::string(table->s) + "/";
+
+  // Appending a batch to a splayed table writes only that batch to the end of
+  // each column file, while the background thread decodes the next batch
+  int64_t total = 0;
+  std::vector<avro::GenericDatum> rows;
+  while (true) {
+    rows.clear();
+    file_reader->Next(batch_size, rows);
+    if (rows.empty())
+      break;
+
+    const auto count = rows.size();
+    K batch = DecodeTable(root, rows);
+    K result = k(0, (S)"{[db;path;t] path upsert .Q.en[db] t}", ks((S)db_handle.c_str()), ks((S)table_handle.c_str()), batch, (K)0);
+    if (!result)
+      throw std::runtime_error("Failed to write " + table_handle);
+    if (result->t == -128) {
+      const std::string error = result->s;
+      r0(result);
+      throw std::runtime_error("Failed to write " + table_handle + ": " + error);
+    }
+    r0(result);
+    total += count;
+  }
+
+  return kj(total);
+
+  KDB_EXCEPTION_CATCH;
+}
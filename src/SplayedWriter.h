@@ -0,0 +1,39 @@
+#pragma once
+
+#include "HelperFunctions.h"
+
+
+extern "C"
+{
+  /// @brief Load an Avro Object Container File into a splayed or partitioned
+  /// kdb+ table on disk
+  ///
+  /// The file is read in batches by a background thread as with OpenReader.
+  /// Each batch is converted to a table, its symbol columns enumerated against
+  /// the sym file in the database root and appended to the table's column
+  /// files, so memory use is bounded by the batch size regardless of the size
+  /// of the file.  The record's fields must map to columns which can be
+  /// splayed.
+  ///
+  /// Supported options:
+  ///
+  /// * PARTITION (string).  Partition directory to write the table to, for
+  /// example "2024.01.02".  Default is to write a splayed table in the
+  /// database root.
+  ///
+  /// Also supports the options of OpenReader, with READ_BATCH_SIZE being the
+  /// number of rows appended to the column files at a time.
+  ///
+  /// @param filename.  String or symbol containing the filename.
+  ///
+  /// @param db.  String or symbol containing the database root directory.
+  ///
+  /// @param table.  Symbol containing the name of the table.
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Dictionary key must be a 11h list.  Values list can be 7h, 11h
+  /// or mixed list of -7|-11|4h.
+  ///
+  /// @return Number of rows written
+  EXP K WriteSplayed(K filename, K db, K table, K options);
+}
@@ -0,0 +1,134 @@
+#include <avro/ValidSchema.hh>
+#include <avro/GenericDatum.hh>
+#include <avro/Generic.hh>
+#include <avro/Decoder.hh>
+#include <avro/Stream.hh>
+#include <avro/Exception.hh>
+
+#include "HelperFunctions.h"
+#include "Schema.h"
+#include "Decode.h"
+#include "StreamDecoder.h"
+#include "KdbOptions.h"
+#include "GenericForeign.h"
+
+
+// Default limit on the bytes retained for an incomplete datum
+const int64_t kDefaultMaxPending = 64 * 1024 * 1024;
+
+// Decode as many complete datums as possible from the buffer, appending them to
+// results.  Returns the number of bytes consumed.
+size_t DecodeAvailable(StreamDecoder& stream_decoder, const uint8_t* data, size_t size, K* results)
+{
+  ChunkInputStream istream(data, size);
+  stream_decoder.decoder->init(istream);
+  auto datum = stream_decoder.avro_foreign->datums.Acquire();
+
+  size_t consumed = 0;
+  while (consumed < size) {
+    try {
+      avro::GenericReader::read(*stream_decoder.decoder, *datum);
+    } catch (const avro::Exception&) {
+      // Running out of data part way through a datum just means the rest of it
+      // hasn't arrived yet
+      if (istream.Exhausted())
+        break;
+      throw;
+    }
+    stream_decoder.decoder->drain();
+
+    // Guard against schemas whose datums occupy no bytes
+    if (istream.byteCount() == consumed)
+      break;
+    consumed = istream.byteCount();
+
+    jk(results, DecodeDatum("", *datum, false));
+  }
+
+  return consumed;
+}
+
+K StreamDecoderCreate(K schema, K options)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto options_parser = KdbOptions(options, Options::string_options, Options::int_options);
+
+  int64_t max_pending = kDefaultMaxPending;
+  options_parser.GetIntOption(Options::MAX_PENDING, max_pending);
+  if (max_pending <= 0)
+    return krr((S)"MAX_PENDING must be positive");
+
+  auto avro_foreign = GetForeign<AvroForeign>(schema);
+
+  return MakeForeign(std::make_shared<StreamDecoder>(avro_foreign, max_pending));
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K StreamDecode(K stream_decoder, K data)
+{
+  if (data->t != KG)
+    return krr((S)"data not 4h");
+
+  KDB_EXCEPTION_TRY;
+
+  auto decoder = GetForeign<StreamDecoder>(stream_decoder);
+  auto& pending = decoder->pending;
+
+  // A failure which followed completed datums is raised here, after those
+  // datums have been returned by the previous call
+  if (!decoder->error.empty()) {
+    const auto error = decoder->error;
+    decoder->error.clear();
+    throw std::runtime_error(error);
+  }
+
+  K results = ktn(0, 0);
+  try {
+    if (pending.empty()) {
+      // Nothing is outstanding so decode straight from the chunk and only
+      // retain whatever trailing partial datum is left over
+      const auto consumed = DecodeAvailable(*decoder.get(), kG(data), data->n, &results);
+      decoder->CheckPending(data->n - consumed);
+      decoder->ReservePending(data->n - consumed);
+      pending.assign(kG(data) + consumed, kG(data) + data->n);
+    } else {
+      // Complete the outstanding datum.  Only the unconsumed tail is moved
+      // down to the start of the buffer.
+      decoder->ReservePending(pending.size() + data->n);
+      pending.insert(pending.end(), kG(data), kG(data) + data->n);
+      const auto consumed = DecodeAvailable(*decoder.get(), pending.data(), pending.size(), &results);
+      pending.erase(pending.begin(), pending.begin() + consumed);
+      decoder->CheckPending(pending.size());
+    }
+  } catch (const std::exception& e) {
+    std::vector<uint8_t>().swap(pending);
+    decoder->memory.Set(0);
+    if (!results->n) {
+      r0(results);
+      throw;
+    }
+    decoder->error = e.what();
+  } catch (...) {
+    std::vector<uint8_t>().swap(pending);
+    decoder->memory.Set(0);
+    r0(results);
+    throw;
+  }
+
+  return results;
+
+  KDB_EXCEPTION_CATCH;
+}
+
+K StreamPending(K stream_decoder)
+{
+  KDB_EXCEPTION_TRY;
+
+  auto decoder = GetForeign<StreamDecoder>(stream_decoder);
+
+  return kj(decoder->pending.size());
+
+  KDB_EXCEPTION_CATCH;
+}
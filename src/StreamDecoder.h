@@ -0,0 +1,153 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "Schema.h"
+
+
+// Input stream over a single contiguous buffer which records whether the
+// decoder tried to read beyond its end.  This allows a datum which has been
+// truncated (because the rest of it has not yet arrived) to be distinguished
+// from one which is malformed.
+class ChunkInputStream : public avro::InputStream
+{
+private:
+  const uint8_t* data_;
+  const size_t size_;
+  size_t position_;
+  bool exhausted_;
+
+public:
+  ChunkInputStream(const uint8_t* data, size_t size) :
+    data_(data), size_(size), position_(0), exhausted_(false)
+  {}
+
+  bool next(const uint8_t** data, size_t* len) final
+  {
+    if (position_ == size_) {
+      exhausted_ = true;
+      return false;
+    }
+    *data = data_ + position_;
+    *len = size_ - position_;
+    position_ = size_;
+    return true;
+  }
+
+  void backup(size_t len) final
+  {
+    position_ -= len;
+  }
+
+  void skip(size_t len) final
+  {
+    position_ = std::min(size_, position_ + len);
+  }
+
+  size_t byteCount() const final
+  {
+    return position_;
+  }
+
+  bool Exhausted() const
+  {
+    return exhausted_;
+  }
+};
+
+// The structure that is stored in the stream decoder foreign.
+//
+// Holds its own decoder (so that it is independent of the decoders in the
+// AvroForeign) together with the partial tail of any datum which has not yet
+// been fully received.  The capacity of the buffer holding the tail is charged
+// to the schema's memory account.
+//
+// The retained tail is bounded by max_pending so that a corrupt length prefix,
+// which would otherwise leave the decoder waiting for data that never arrives,
+// fails rather than buffering the rest of the stream.
+struct StreamDecoder
+{
+  std::shared_ptr<AvroForeign> avro_foreign;
+  avro::DecoderPtr decoder;
+  std::vector<uint8_t> pending;
+  size_t max_pending;
+  MemoryCharge memory;
+  // Failure deferred to the next call so the datums completed before it could
+  // be returned
+  std::string error;
+
+  StreamDecoder(std::shared_ptr<AvroForeign> avro_foreign_, size_t max_pending_) :
+    avro_foreign(avro_foreign_),
+    decoder(avro::binaryDecoder()),
+    max_pending(max_pending_),
+    memory(avro_foreign_->memory, MEMORY_STREAM)
+  {}
+
+  // Fail if an incomplete datum of size bytes would exceed max_pending
+  void CheckPending(size_t size) const
+  {
+    if (size > max_pending)
+      throw std::runtime_error("Incomplete datum of " + std::to_string(size) + " bytes exceeds MAX_PENDING of " + std::to_string(max_pending) + " bytes");
+  }
+
+  // Grow the pending buffer to hold at least size bytes, failing before it is
+  // reallocated if that would exceed the memory limit
+  void ReservePending(size_t size)
+  {
+    if (size <= pending.capacity())
+      return;
+    const auto capacity = std::max(size, pending.capacity() * 2);
+    memory.Set(capacity);
+    pending.reserve(capacity);
+  }
+};
+
+extern "C"
+{
+  /// @brief Create a stateful decoder for Avro binary serialised data which
+  /// arrives in arbitrarily split chunks
+  ///
+  /// @param schema.  Foreign object containing the Avro schema to use for
+  /// decoding. 
+  ///
+  /// @param options. kdb+ dictionary of options or generic null(::) to use the
+  /// defaults.  Supported options are:
+  ///
+  /// * MAX_PENDING.  Long maximum number of bytes which can be retained for an
+  /// incomplete datum.  Default 64MB.
+  ///
+  /// @return foreign containing the stream decoder.  This will be garbage
+  /// collected when its refcount drops to zero.
+  EXP K StreamDecoderCreate(K schema, K options);
+
+  /// @brief Pass the next chunk of Avro binary serialised data to a stream
+  /// decoder
+  ///
+  /// Every datum which can be completely decoded is returned.  Any trailing
+  /// partial datum is retained by the stream decoder and completed by
+  /// subsequent chunks.  If a malformed datum is encountered, or the partial
+  /// datum would exceed MAX_PENDING, the retained data is discarded and an
+  /// error is returned.  If datums were completed before the failure they are
+  /// returned instead and the error is returned by the next call, without
+  /// decoding the chunk passed to it.
+  ///
+  /// @param stream_decoder.  Foreign object containing the stream decoder.
+  ///
+  /// @param data.  4h list containing the next chunk of data.
+  ///
+  /// @return Mixed list of decoded kdb+ objects, empty if no datum could be
+  /// completed.
+  EXP K StreamDecode(K stream_decoder, K data);
+
+  /// @brief Return the number of bytes retained by a stream decoder which are
+  /// waiting for the remainder of a datum
+  ///
+  /// @param stream_decoder.  Foreign object containing the stream decoder.
+  ///
+  /// @return Long count of pending bytes.
+  EXP K StreamPending(K stream_decoder);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// Fixed size pool of worker threads which run submitted tasks in the order
+// they were submitted.
+//
+// Tasks run outside the main q thread so must not allocate or free kdb+
+// objects.  They can however read kdb+ objects which the caller keeps alive
+// until the task's future has completed.
+class ThreadPool
+{
+private:
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_;
+
+  void Run()
+  {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(size_t threads) :
+    stop_(false)
+  {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+      threads_.emplace_back(&ThreadPool::Run, this);
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    not_empty_.notify_all();
+    for (auto& thread : threads_)
+      thread.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t Size() const
+  {
+    return threads_.size();
+  }
+
+  // Queue a task, returning a future for its result.  An exception thrown by
+  // the task is rethrown by the future's get().
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F task)
+  {
+    typedef typename std::result_of<F()>::type Result;
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    auto result = packaged->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace_back([packaged] { (*packaged)(); });
+    }
+    not_empty_.notify_one();
+    return result;
+  }
+
+  // Pool shared by all of avrokdb's parallel operations, with one thread per
+  // hardware thread.  Created on first use.
+  static ThreadPool& Shared()
+  {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+  }
+};
+
+// Wait for all the futures to complete, discarding their results.  Used when
+// abandoning an operation to ensure no task is still reading its arguments.
+template <typename T>
+void WaitAll(std::deque<std::future<T>>& futures)
+{
+  for (auto& future : futures) {
+    if (future.valid())
+      future.wait();
+  }
+  futures.clear();
+}
@@ -150,7 +150,6 @@ KdbType GetKdbType(const avro::GenericDatum& datum, bool decompose_union)
   case avro::AVRO_ARRAY:
   {
     const auto& avro_array = datum.value<avro::GenericArray>();
-    auto array_value = avro_array.value();
     auto array_schema = avro_array.schema();
     assert(array_schema->leaves() == 1);
     return GetKdbArrayType(array_schema->leafAt(0)->type(), array_schema->leafAt(0)->logicalType().type());
@@ -94,4 +94,272 @@ runTests:{[options]
 runTests[(enlist `AVRO_FORMAT)!enlist `BINARY];
 
 -1 "\n<----- Running tests with Avro JSON encoding ----->\n";
-runTests[(enlist `AVRO_FORMAT)!enlist `JSON];
\ No newline at end of file
+runTests[(enlist `AVRO_FORMAT)!enlist `JSON];
+
+-1 "\n<----- Encode into a preallocated buffer ----->\n";
+sc:.avrokdb.schemaFromFile["tests/simple.avsc"];
+input:(``a`b`c`d`e`f`g`h`i`j`k)!(::;0b;0x0011;1.1;`AA;0x00112233;2.2e;3i;4;::;"aa";(0h;"abc"));
+serialised:.avrokdb.encode[sc;input;::];
+buffer:(2*count serialised)#0x00;
+written:.avrokdb.encodeInto[sc;input;buffer;::];
+written+:.avrokdb.encodeInto[sc;input;buffer;(enlist `ENCODE_OFFSET)!enlist written];
+(written=2*count serialised) and buffer~serialised,serialised
+
+-1 "\n<----- Decode datums packed back to back ----->\n";
+packed:raze 3#enlist serialised;
+batch1:.avrokdb.decodeMulti[sc;packed;(enlist `DECODE_MAX_ITEMS)!enlist 2];
+batch2:.avrokdb.decodeMulti[sc;packed;(enlist `DECODE_OFFSET)!enlist batch1 1];
+(2=count batch1 0) and (all input~/:batch1[0],batch2[0]) and batch2[1]=count packed
+
+-1 "\n<----- Reject a negative decode offset ----->\n";
+negative:@[.avrokdb.decodeMulti[sc;packed;];(enlist `DECODE_OFFSET)!enlist -1;{x}];
+negative~"DECODE_OFFSET must be non-negative"
+
+-1 "\n<----- Reject data after datums which occupy no bytes ----->\n";
+empty:@[.avrokdb.decodeMulti[.avrokdb.schemaFromString["\"null\""];;::];0x00;{x}];
+empty~"Datum occupies no bytes, 1 bytes of data remaining"
+
+-1 "\n<----- Stream decode chunks split mid datum ----->\n";
+decoder:.avrokdb.streamDecoder[sc;::];
+result:raze .avrokdb.streamDecode[decoder;] each 7 cut packed;
+(3=count result) and (all input~/:result) and 0=.avrokdb.streamPending[decoder]
+
+-1 "\n<----- Stream decode rejects an oversized incomplete datum ----->\n";
+bounded:.avrokdb.streamDecoder[sc;(enlist `MAX_PENDING)!enlist (count serialised)-2];
+oversized:@[.avrokdb.streamDecode[bounded;];-1_serialised;{x}];
+(10h=type oversized) and (0=.avrokdb.streamPending[bounded]) and input~first .avrokdb.streamDecode[bounded;serialised]
+
+-1 "\n<----- Stream decode returns datums completed before an oversized incomplete datum ----->\n";
+completed:.avrokdb.streamDecode[bounded;serialised,-1_serialised];
+deferred:@[.avrokdb.streamDecode[bounded;];serialised;{x}];
+(1=count completed) and (input~first completed) and (deferred~oversized) and input~first .avrokdb.streamDecode[bounded;serialised]
+
+-1 "\n<----- Batch decode skipping bad messages ----->\n";
+result:.avrokdb.decodeBatch[sc;(serialised;0x01;serialised);(enlist `CONTINUE_ON_ERROR)!enlist 1];
+(2=count result 0) and (all (1_input)~/:result 0) and (enlist 1)~exec index from result 1
+
+-1 "\n<----- Lazy record view ----->\n";
+sc:.avrokdb.schemaFromFile["tests/nested_record.avsc"];
+input:(``a`b)!(::;0b;(``c`d)!(::;1.1;`AA));
+view:.avrokdb.decode[sc;.avrokdb.encode[sc;input;::];(enlist `LAZY_DECODE)!enlist 1];
+(`AA~.avrokdb.get[view;`b.d]) and (input[`b]~.avrokdb.get[view;`b]) and input~.avrokdb.get[view;`]
+
+-1 "\n<----- Extract a single field from each message ----->\n";
+messages:.avrokdb.encode[sc;;::] each (input;(``a`b)!(::;1b;(``c`d)!(::;2.2;`BB)));
+(`AA`BB~.avrokdb.extract[sc;messages;`b.d;::]) and (1.1 2.2~.avrokdb.extract[sc;messages;`b.c;::]) and 01b~.avrokdb.extract[sc;messages;`a;::]
+
+-1 "\n<----- Compare and hash serialised datums ----->\n";
+messages:.avrokdb.encode[sc;;::] each ((``a`b)!(::;0b;(``c`d)!(::;1.1;`BB));(``a`b)!(::;1b;(``c`d)!(::;2.2;`AA)));
+ordered:(-1i~.avrokdb.compare[sc;messages 0;messages 1;::]) and (1i~.avrokdb.compare[sc;messages 0;messages 1;`b.d]) and 0 1i~.avrokdb.compare[sc;messages;messages 0;::];
+hashes:.avrokdb.hash[sc;messages,messages;::];
+ordered and (hashes[0 1]~hashes[2 3]) and not (~/)hashes 0 1
+
+-1 "\n<----- Compare and hash NaN floats ----->\n";
+dsc:.avrokdb.schemaFromString["\"double\""];
+nans:(0x000000000000f87f;0x010000000000f8ff);
+floats:nans,.avrokdb.encode[dsc;;::] each 0w -0w 1.5;
+(0 1 1 1i~.avrokdb.compare[dsc;floats 0;1_floats;::]) and (-1i~.avrokdb.compare[dsc;floats 2;floats 1;::]) and (~/).avrokdb.hash[dsc;nans;::]
+
+-1 "\n<----- Schema canonical form and fingerprints ----->\n";
+canonical:"{\"name\":\"root\",\"type\":\"record\",\"fields\":[{\"name\":\"a\",\"type\":\"boolean\"},{\"name\":\"b\",\"type\":{\"name\":\"myrecord\",\"type\":\"record\",\"fields\":[{\"name\":\"c\",\"type\":\"double\"},{\"name\":\"d\",\"type\":{\"name\":\"myenum\",\"type\":\"enum\",\"symbols\":[\"AA\",\"BB\",\"CC\"]}}]}}]}";
+int_schema:.avrokdb.schemaFromString["\"int\""];
+fingerprints:(0x8f5c393f1ad57572~.avrokdb.fingerprint[int_schema;`CRC64]) and 0x3f2b87a9fe7cc9b13835598c3981cd45e3e355309e5090aa0933d7becb6fba45~.avrokdb.fingerprint[int_schema;`SHA256];
+fingerprints and (canonical~.avrokdb.canonicalSchema[sc]) and (canonical~.avrokdb.canonicalSchema .avrokdb.schemaFromString[canonical]) and 0<.avrokdb.clearSchemaCache[]
+
+-1 "\n<----- Schema cache only holds schemas in use ----->\n";
+.avrokdb.clearSchemaCache[];
+long1:.avrokdb.schemaFromString["\"long\""];
+long2:.avrokdb.schemaFromString["\"long\""];
+reused:(1=.avrokdb.clearSchemaCache[]) and 42~.avrokdb.decode[long2;.avrokdb.encode[long1;42;::];::];
+long3:.avrokdb.schemaFromString["\"long\""];
+long1:long2:long3:(::);
+reused and 0=.avrokdb.clearSchemaCache[]
+
+-1 "\n<----- Single object encoding ----->\n";
+sc:.avrokdb.schemaFromFile["tests/simple.avsc"];
+input:(``a`b`c`d`e`f`g`h`i`j`k)!(::;0b;0x0011;1.1;`AA;0x00112233;2.2e;3i;4;::;"aa";(0h;"abc"));
+single:.avrokdb.encode[sc;input;(enlist `SINGLE_OBJECT)!enlist 1];
+registered:(.avrokdb.registerSchema[sc]~single 2+til 8) and 0xc301~2#single;
+registered and (input~.avrokdb.decode[sc;single;(enlist `SINGLE_OBJECT)!enlist 1]) and input~.avrokdb.decodeSingleObject[single;::]
+
+-1 "\n<----- JSON decode with fields in any order ----->\n";
+sc:.avrokdb.schemaFromFile["tests/nested_record.avsc"];
+json:"{\"b\": {\"d\": \"BB\", \"c\": 2.5}, \"a\": true}";
+((``a`b)!(::;1b;(``c`d)!(::;2.5;`BB)))~.avrokdb.decode[sc;json;(enlist `AVRO_FORMAT)!enlist `JSON]
+
+-1 "\n<----- JSON encode with shortest round trip floats ----->\n";
+sc:.avrokdb.schemaFromFile["tests/simple.avsc"];
+input:(``a`b`c`d`e`f`g`h`i`j`k)!(::;0b;0x0011;1.1;`AA;0x00112233;2.2e;3i;4;::;"aa";(0h;"abc"));
+json:.avrokdb.encode[sc;input;(enlist `AVRO_FORMAT)!enlist `JSON];
+expected:"{\"a\":false,\"b\":\"\\u0000\\u0011\",\"c\":1.1,\"d\":\"AA\",\"e\":\"\\u0000\\u0011\\\"3\",\"f\":2.2,\"g\":3,\"h\":4,\"i\":null,\"j\":\"aa\",\"k\":{\"string\":\"abc\"}}";
+(expected~json) and input~.avrokdb.decode[sc;json;(enlist `AVRO_FORMAT)!enlist `JSON]
+
+-1 "\n<----- JSON encode into a buffer ----->\n";
+jsonBuffer:(count json)#" ";
+written:.avrokdb.encodeInto[sc;input;jsonBuffer;(enlist `AVRO_FORMAT)!enlist `JSON];
+small:@[.avrokdb.encodeInto[sc;input;;(enlist `AVRO_FORMAT)!enlist `JSON];(-1+count json)#" ";{x}];
+(written=count json) and (json~jsonBuffer) and small like "Encode buffer too small, required: ",(string count json),"*"
+
+-1 "\n<----- Read an object container file in batches ----->\n";
+sc:.avrokdb.schemaFromFile["tests/nested_record.avsc"];
+writeOcf:{[file;sc;blocks]
+  meta:.avrokdb.encode[.avrokdb.schemaFromString["{\"type\":\"map\",\"values\":\"bytes\"}"];(`avro.schema`avro.codec)!"x"$(.avrokdb.getSchema sc;"null");::];
+  long:.avrokdb.schemaFromString["\"long\""];
+  sync:16#0x0123456789abcdef;
+  block:{[long;sync;messages] raze (.avrokdb.encode[long;count messages;::];.avrokdb.encode[long;count raze messages;::];raze messages;sync)}[long;sync];
+  header:raze (0x4f626a01;meta;sync);
+  data:block each blocks;
+  file 1: raze header,data;
+  / Offsets of the sync marker preceding each block
+  (count[header]-16)+sums 0,-1_count each data};
+messages:{.avrokdb.encode[sc;(``a`b)!(::;0=x mod 2;(``c`d)!(::;1f*x;`AA`BB`CC x mod 3));::]} each til 10;
+writeOcf[`:tests/reader.avro;sc;(6#messages;6_messages)];
+reader:.avrokdb.openReader[`:tests/reader.avro;(`READ_BATCH_SIZE`READ_AHEAD)!2 1];
+batches:.avrokdb.next[reader;] each 4 4 4 4;
+delete reader from `.;
+hdel `:tests/reader.avro;
+(4 4 2 0~count each batches) and .avrokdb.decodeBatch[sc;messages;::]~raze batches
+
+-1 "\n<----- Read an object container file split by byte range ----->\n";
+mid:writeOcf[`:tests/reader.avro;sc;(6#messages;6_messages)] 1;
+readers:.avrokdb.openReader[`:tests/reader.avro;] each ((enlist `END_OFFSET)!enlist mid;(enlist `START_OFFSET)!enlist mid);
+splits:.avrokdb.next[;100] each readers;
+delete readers from `.;
+hdel `:tests/reader.avro;
+(all 0<count each splits) and .avrokdb.decodeBatch[sc;messages;::]~raze splits
+
+-1 "\n<----- Read an object container file using a block index ----->\n";
+sc:.avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"r\",\"fields\":[{\"name\":\"x\",\"type\":\"long\"}]}"];
+messages:{.avrokdb.encode[sc;(``x)!(::;x);::]} each 10*til 9;
+syncs:writeOcf[`:tests/index.avro;sc;3 cut messages];
+idx:.avrokdb.buildIndex[`:tests/index.avro;`x;::];
+reader:.avrokdb.openReader[`:tests/index.avro;(`START_ROW`END_ROW)!4 7];
+rows:.avrokdb.next[reader;100];
+blocks:.avrokdb.openBlockReader[`:tests/index.avro;select from idx where xMax>=60;::];
+skipped:.avrokdb.next[blocks;100];
+delete reader,blocks from `.;
+hdel each `:tests/index.avro`:tests/index.avro.idx;
+((16+syncs)~idx`offset) and (0 3 6~idx`firstRow) and (0 30 60~idx`xMin) and (20 50 80~idx`xMax) and (40 50 60~rows`x) and 60 70 80~skipped`x
+
+-1 "\n<----- Read an object container file with a filter ----->\n";
+syncs:writeOcf[`:tests/filter.avro;sc;3 cut messages];
+.avrokdb.buildIndex[`:tests/filter.avro;`x;::];
+reader:.avrokdb.openReader[`:tests/filter.avro;(enlist `FILTER)!enlist (`within;`x;35 65)];
+rows:.avrokdb.next[reader;100];
+blocks:.avrokdb.openBlockReader[`:tests/filter.avro;([] offset:16+syncs; firstRow:0 3 6; rows:3 3 3);(enlist `FILTER)!enlist (`lt;`x;25)];
+skipped:.avrokdb.next[blocks;100];
+delete reader,blocks from `.;
+hdel each `:tests/filter.avro`:tests/filter.avro.idx;
+(40 50 60~rows`x) and 0 10 20~skipped`x
+
+-1 "\n<----- Decode batch with a filter ----->\n";
+sc:.avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"r\",\"fields\":[{\"name\":\"x\",\"type\":\"long\"},{\"name\":\"s\",\"type\":\"string\"},{\"name\":\"f\",\"type\":\"double\"}]}"];
+messages:{.avrokdb.encode[sc;(``x`s`f)!(::;x;y;z);::]}'[til 6;("a";"b";"c";"a";"b";"c");0.5*til 6];
+both:.avrokdb.decodeBatch[sc;messages;(enlist `FILTER)!enlist ((`ge;`x;2);(`in;`s;`a`b))];
+bySym:.avrokdb.decodeBatch[sc;messages;(enlist `FILTER)!enlist (`eq;`s;`c)];
+range:.avrokdb.decodeBatch[sc;messages;(enlist `FILTER)!enlist (`within;`f;1 2f)];
+(3 4~both`x) and (2 5~bySym`x) and 2 3 4~range`x
+
+-1 "\n<----- Filter in values given as a mixed list ----->\n";
+mixed:.avrokdb.decodeBatch[sc;messages;(enlist `FILTER)!enlist (`in;`x;(1i;4j))];
+invalid:@[.avrokdb.decodeBatch[sc;messages;];(enlist `FILTER)!enlist (`in;`x;(1;"a"));{x}];
+(1 4~mixed`x) and invalid like "*unsupported type 10h"
+
+-1 "\n<----- Decode a large batch across threads ----->\n";
+many:{.avrokdb.encode[sc;(``x`s`f)!(::;x;(x mod 7)#"abc";0.5*x);::]} each til 5000;
+parallel:.avrokdb.decodeBatch[sc;many;::];
+serial:.avrokdb.decodeBatch[sc;many;(enlist `THREADS)!enlist 1];
+failed:@[.avrokdb.decodeBatch[sc;;::];@[many;1000 4000;:;(0x01;0x01)];{x}];
+skipped:.avrokdb.decodeBatch[sc;@[many;1000 4000;:;(0x01;0x01)];`CONTINUE_ON_ERROR`THREADS!4 2];
+(parallel~serial) and (til[5000]~parallel`x) and (failed like "message 1000: *") and (4998=count skipped 0) and 1000 4000~exec index from skipped 1
+
+-1 "\n<----- Encode a large table across threads ----->\n";
+encoded:.avrokdb.encodeBatch[sc;parallel;::];
+single:.avrokdb.encodeBatch[sc;parallel;`SINGLE_OBJECT`THREADS!1 3];
+(encoded~many) and (encoded~.avrokdb.encodeBatch[sc;parallel;(enlist `THREADS)!enlist 1]) and (single 4999)~.avrokdb.encode[sc;(``x`s`f)!(::;4999;(4999 mod 7)#"abc";2499.5);(enlist `SINGLE_OBJECT)!enlist 1]
+
+-1 "\n<----- Encode batch with optional and symbol columns ----->\n";
+optional:.avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"o\",\"fields\":[{\"name\":\"x\",\"type\":[\"null\",\"long\"]},{\"name\":\"t\",\"type\":[\"null\",{\"type\":\"long\",\"logicalType\":\"timestamp-micros\"}]},{\"name\":\"s\",\"type\":\"string\"}]}"];
+rows:.avrokdb.encodeBatch[optional;([] x:1 0N 3; t:2024.01.02D10:00:00.000001 0N 2024.01.03D00:00:00; s:`a`bc`);::];
+decoded:.avrokdb.decode[optional;;::] each rows;
+expectedRows:((``x`t`s)!(::;(1h;1);(1h;2024.01.02D10:00:00.000001);"a");(``x`t`s)!(::;(0h;::);(0h;::);"bc");(``x`t`s)!(::;(1h;3);(1h;2024.01.03D00:00:00);""));
+expectedRows~decoded
+
+-1 "\n<----- Decode each encode batch message separately ----->\n";
+messages:.avrokdb.encodeBatch[sc;([] x:til 600; s:string 600#`a`bb`ccc; f:0.5*til 600);::];
+(600=count messages) and (til[600]~{.avrokdb.decode[sc;x;::]`x} each messages) and (string 600#`a`bb`ccc)~{.avrokdb.decode[sc;x;::]`s} each messages
+
+-1 "\n<----- Decode in the background with callbacks ----->\n";
+delivered:()!();
+asyncErrors:()!();
+background:.avrokdb.asyncDecoder[sc;{[id;result] @[`delivered;id;:;result]};(enlist `ERROR_CALLBACK)!enlist {[id;error] @[`asyncErrors;id;:;error]}];
+ids:.avrokdb.asyncDecode[background;] each (many;first many;0x01);
+pending:.avrokdb.asyncPending[background];
+flushed:.avrokdb.asyncFlush[background];
+delete background from `.;
+(0 1 2~ids) and (3=pending) and (3=flushed) and (parallel~delivered 0) and ((first parallel)~1_delivered 1) and (0 1~asc key delivered) and (enlist 2)~key asyncErrors
+
+-1 "\n<----- Append tables to an object container file in the background ----->\n";
+writeErrors:()!();
+archive:.avrokdb.asyncWriter[`:tests/async.avro;sc;`BLOCK_ROWS`FLUSH_INTERVAL`ERROR_CALLBACK!(10;0;{[id;error] @[`writeErrors;id;:;error]})];
+t:([] x:til 25; s:25#("a";"bc"); f:0.5*til 25);
+ids:.avrokdb.asyncWrite[archive;] each (10#t;10_t;([] x:1 2i; s:("a";"b"); f:1 2f));
+written:.avrokdb.asyncWriterFlush[archive];
+closed:.avrokdb.asyncWriterClose[archive];
+idx:.avrokdb.buildIndex[`:tests/async.avro;`x;::];
+reader:.avrokdb.openReader[`:tests/async.avro;::];
+rows:.avrokdb.next[reader;100];
+delete archive,reader from `.;
+hdel each `:tests/async.avro`:tests/async.avro.idx;
+(0 1 2~ids) and (25=written) and (25=closed) and (10 10 5~idx`rows) and (t~rows) and (enlist 2)~key writeErrors
+
+-1 "\n<----- Write an object container file to a partitioned table ----->\n";
+sc:.avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"r\",\"fields\":[{\"name\":\"x\",\"type\":\"long\"},{\"name\":\"e\",\"type\":{\"type\":\"enum\",\"name\":\"e\",\"symbols\":[\"AA\",\"BB\"]}}]}"];
+messages:{.avrokdb.encode[sc;(``x`e)!(::;x;`AA`BB x mod 2);::]} each til 9;
+writeOcf[`:tests/splayed.avro;sc;3 cut messages];
+n:.avrokdb.writeSplayed[`:tests/splayed.avro;`:tests/db;`t;(`READ_BATCH_SIZE`PARTITION)!(2;"2024.01.02")];
+t:select x, e:value e from get `:tests/db/2024.01.02/t/;
+rmdir:{if[11h=type d:key x; .z.s each ` sv/: x,/:d]; hdel x};
+rmdir `:tests/db;
+hdel `:tests/splayed.avro;
+(9=n) and t~([] x:til 9; e:9#`AA`BB)
+
+-1 "\n<----- Export a splayed table to an object container file ----->\n";
+`:tests/db/t/ set .Q.en[`:tests/db] ([] x:til 25; e:25#`AA`BB);
+n:.avrokdb.exportSplayed[`:tests/db/t/;sc;`:tests/export.avro;(enlist `BLOCK_ROWS)!enlist 10];
+reader:.avrokdb.openReader[`:tests/export.avro;::];
+rows:.avrokdb.next[reader;100];
+idx:.avrokdb.buildIndex[`:tests/export.avro;::;::];
+delete reader from `.;
+rmdir `:tests/db;
+hdel each `:tests/export.avro`:tests/export.avro.idx;
+(25=n) and (10 10 5~idx`rows) and rows~([] x:til 25; e:25#`AA`BB)
+
+-1 "\n<----- Read several object container files into a table ----->\n";
+writeOcf[`:tests/files1.avro;sc;3 cut 6#messages];
+writeOcf[`:tests/files2.avro;sc;enlist 6_messages];
+joined:.avrokdb.readFiles[`:tests/files1.avro`:tests/files2.avro;::];
+resolved:.avrokdb.readFiles[("tests/files2.avro";"tests/files1.avro");(enlist `READER_SCHEMA)!enlist .avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"r\",\"fields\":[{\"name\":\"x\",\"type\":\"long\"}]}"]];
+missing:@[.avrokdb.readFiles[;::];`:tests/files1.avro`:tests/missing.avro`:tests/files2.avro;{x}];
+hdel each `:tests/files1.avro`:tests/files2.avro;
+(joined~([] x:til 9; e:9#`AA`BB)) and (resolved~([] x:(6_til 9),til 6)) and missing like "tests/missing.avro: *"
+
+-1 "\n<----- Reuse datums between encodes and decodes ----->\n";
+pooled:.avrokdb.schemaFromString["{\"type\":\"record\",\"name\":\"p\",\"fields\":[{\"name\":\"a\",\"type\":{\"type\":\"array\",\"items\":\"string\"}},{\"name\":\"m\",\"type\":{\"type\":\"map\",\"values\":\"long\"}},{\"name\":\"u\",\"type\":[\"null\",\"long\"]}]}"];
+vals:((``a`m`u)!(::;("a";"bc";"def");`x`y`z!1 2 3;(1h;5));(``a`m`u)!(::;("g";"hi");(enlist `w)!enlist 4;(0h;::));(``a`m)!(::;("j";"kl");`x`y!5 6));
+encoded:.avrokdb.encode[pooled;;::] each vals;
+decoded:.avrokdb.decode[pooled;;::] each encoded;
+(encoded~reverse .avrokdb.encode[pooled;;::] each reverse vals) and (decoded~reverse .avrokdb.decode[pooled;;::] each reverse encoded) and (0h;::)~decoded[2;`u]
+
+-1 "\n<----- Reset fields missing from a dictionary with duplicate keys ----->\n";
+.avrokdb.encode[pooled;vals 0;::];
+duplicated:.avrokdb.encode[pooled;(``a`a`m)!(::;enlist "b";enlist "c";(enlist `v)!enlist 7);::];
+(0h;::)~.avrokdb.decode[pooled;duplicated;::]`u
+
+-1 "\n<----- Account for memory allocated outside kdb+ ----->\n";
+batch:.avrokdb.decodeBatch[pooled;999#encoded;::];
+stats:.avrokdb.memStats[];
+previous:.avrokdb.setMemoryLimit[1];
+limited:@[.avrokdb.decodeBatch[pooled;;::];999#encoded;{x}];
+reset:.avrokdb.setMemoryLimit[0];
+(`limit`current`peak`operations`schemas~key stats) and (0=stats[`operations;`decode;`current]) and (0<stats[`operations;`decode;`peak]) and (0=previous) and (1=reset) and (limited like "avrokdb memory limit*") and 999=count batch